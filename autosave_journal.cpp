@@ -0,0 +1,475 @@
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUuid>
+#include <QtEndian>
+#include <cstring>
+
+#include "autosave_journal.h"
+#include "compression.h"
+#include "project_file.h"
+
+
+namespace
+{
+const char MAGIC[8] = {'C', 'N', 'V', 'S', 'J', 'R', 'N', 'L'};
+const quint32 VERSION = 1;
+const int HEADER_SIZE = 12;
+const int RECORD_HEADER_SIZE = 12;
+
+/** the records, a document starts a new base the tiles after it go on */
+const quint32 DOCUMENT_RECORD = 1;
+const quint32 TILE_RECORD = 2;
+const quint32 COMMIT_RECORD = 3;
+
+quint64 key(int layer, int column, int row)
+{
+    return quint64(layer) << 40 | quint64(row) << 20 | quint64(column);
+}
+
+/**
+ * @brief crc32 - the CRC-32 (IEEE 802.3) of data, as zlib computes it
+ *
+ */
+quint32 crc32(const char *data, qint64 length)
+{
+    static const QVector<quint32> table = []()
+    {
+        QVector<quint32> made(256);
+        for(quint32 i = 0; i < 256; ++i)
+        {
+            quint32 c = i;
+            for(int bit = 0; bit < 8; ++bit)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            made[int(i)] = c;
+        }
+        return made;
+    }();
+
+    quint32 crc = 0xffffffffu;
+    for(qint64 i = 0; i < length; ++i)
+        crc = table.at(int((crc ^ uchar(data[i])) & 0xff)) ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+bool writeRecord(QIODevice *file, quint32 type, const QByteArray &payload)
+{
+    uchar header[RECORD_HEADER_SIZE];
+    qToLittleEndian<quint32>(type, header);
+    qToLittleEndian<quint32>(quint32(payload.size()), header + 4);
+    qToLittleEndian<quint32>(crc32(payload.constData(), payload.size()), header + 8);
+
+    return file->write(reinterpret_cast<const char*>(header), RECORD_HEADER_SIZE)
+               == RECORD_HEADER_SIZE
+           && file->write(payload) == payload.size();
+}
+
+/** a tile as it was at a checkpoint, null if it wasn't allocated */
+struct TileSnapshot
+{
+    int layer;
+    int column;
+    int row;
+    QImage tile;
+};
+
+/** a base document and the tiles written over it */
+struct Checkpoint
+{
+    Checkpoint() : current(0), valid(false) {}
+
+    QSize size;
+    int current;
+    QVector<LayerRecord> records;
+    QHash<quint64, QByteArray> tiles;
+    bool valid;
+};
+}
+
+/** compresses a checkpoint and writes it out */
+class AutosaveJournal::Job : public QRunnable
+{
+public:
+    Job(AutosaveJournal *journal, bool full, bool document)
+        : full(full), document(full || document), current(0), journal(journal) {}
+
+    void run() override
+    {
+        if(!(full ? writeAll() : append()))
+            journal->failed.storeRelease(1);
+        journal->busy.storeRelease(0);
+    }
+
+    bool full;
+    bool document;
+    QSize size;
+    int current;
+    QVector<LayerRecord> records;
+    QVector<TileSnapshot> tiles;
+
+private:
+    bool writeAll()
+    {
+        QSaveFile file(journal->path());
+        if(!file.open(QIODevice::WriteOnly))
+            return false;
+
+        QByteArray header(HEADER_SIZE, 0);
+        memcpy(header.data(), MAGIC, sizeof(MAGIC));
+        qToLittleEndian<quint32>(VERSION, reinterpret_cast<uchar*>(header.data()) + 8);
+
+        if(file.write(header) != HEADER_SIZE
+           || !writeDocument(&file)
+           || !writeTiles(&file))
+        {
+            file.cancelWriting();
+            return false;
+        }
+        return file.commit();
+    }
+
+    bool append()
+    {
+        QFile file(journal->path());
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Append))
+            return false;
+        return (!document || writeDocument(&file)) && writeTiles(&file)
+               && file.flush();
+    }
+
+    /** the size and the layer records */
+    bool writeDocument(QIODevice *file)
+    {
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_6);
+        out << size << qint32(current) << qint32(records.size());
+        for(const LayerRecord &record : records)
+            out << record;
+        return writeRecord(file, DOCUMENT_RECORD, payload);
+    }
+
+    /** the tiles, then the commit that makes them count */
+    bool writeTiles(QIODevice *file)
+    {
+        for(TileSnapshot &snapshot : tiles)
+        {
+            QByteArray payload(12, 0);
+            uchar *at = reinterpret_cast<uchar*>(payload.data());
+            qToLittleEndian<quint32>(quint32(snapshot.layer), at);
+            qToLittleEndian<quint32>(quint32(snapshot.column), at + 4);
+            qToLittleEndian<quint32>(quint32(snapshot.row), at + 8);
+            if(!snapshot.tile.isNull())
+                payload += compressImage(snapshot.tile);
+
+            // the copy may be the last reference to an old tile
+            snapshot.tile = QImage();
+            if(!writeRecord(file, TILE_RECORD, payload))
+                return false;
+        }
+        return writeRecord(file, COMMIT_RECORD, QByteArray());
+    }
+
+    AutosaveJournal *journal;
+};
+
+AutosaveJournal::AutosaveJournal()
+    : fileName(QDir(directory()).filePath(
+          "autosave-" + QUuid::createUuid().toString().mid(1, 36) + ".journal")),
+      lock(fileName + ".lock"), all(false), document(false), started(false)
+{
+    // held until the session ends, only a dead session's lock goes stale
+    lock.setStaleLockTime(0);
+    lock.tryLock(0);
+
+    // one thread, checkpoints are appended in order
+    pool.setMaxThreadCount(1);
+}
+
+AutosaveJournal::~AutosaveJournal()
+{
+    pool.waitForDone();
+}
+
+/**
+ * @brief AutosaveJournal::directory - where the journals are kept, created
+ *                                     if needed
+ *
+ */
+QString AutosaveJournal::directory()
+{
+    QDir dir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+    dir.mkpath(".");
+    return dir.path();
+}
+
+/**
+ * @brief AutosaveJournal::orphan - the newest journal left behind by a
+ *                                  session that didn't end cleanly, empty
+ *                                  if there is none. Journals of sessions
+ *                                  still running are locked.
+ *
+ */
+QString AutosaveJournal::orphan()
+{
+    QDir dir(directory());
+    const QStringList journals = dir.entryList(
+        QStringList() << "autosave-*.journal", QDir::Files, QDir::Time);
+    for(const QString &journal : journals)
+    {
+        const QString path = dir.filePath(journal);
+        QLockFile owner(path + ".lock");
+        owner.setStaleLockTime(0);
+        if(owner.tryLock(0))
+            return path;
+    }
+    return QString();
+}
+
+/**
+ * @brief AutosaveJournal::markDirty - note tiles (in tile columns and rows)
+ *                                     of a layer changed, for the next
+ *                                     checkpoint
+ *
+ */
+void AutosaveJournal::markDirty(int layer, const QRect &tiles)
+{
+    if(all)
+        return;
+
+    for(int row = tiles.top(); row <= tiles.bottom(); ++row)
+        for(int column = tiles.left(); column <= tiles.right(); ++column)
+            dirty.insert(key(layer, column, row));
+}
+
+/**
+ * @brief AutosaveJournal::markDocumentDirty - note the layer records
+ *                                             changed, e.g. shapes, the
+ *                                             next checkpoint appends
+ *                                             them again
+ *
+ */
+void AutosaveJournal::markDocumentDirty()
+{
+    document = true;
+}
+
+/**
+ * @brief AutosaveJournal::markAllDirty - note the layers changed, the next
+ *                                        checkpoint writes everything
+ *
+ */
+void AutosaveJournal::markAllDirty()
+{
+    all = true;
+    dirty.clear();
+}
+
+/**
+ * @brief AutosaveJournal::checkpoint - write the dirty tiles of layers in
+ *                                      the background. Nothing happens
+ *                                      while the last checkpoint is still
+ *                                      being written, its tiles stay dirty.
+ *
+ */
+void AutosaveJournal::checkpoint(const LayerStack &layers)
+{
+    if(!isDirty() || layers.isNull() || !busy.testAndSetAcquire(0, 1))
+        return;
+
+    // a failed append may have left a torn record, start over
+    if(failed.fetchAndStoreAcquire(0))
+        all = true;
+
+    Job *job = new Job(this, all || !started, document);
+    if(job->document)
+    {
+        job->size = layers.size();
+        job->current = layers.currentIndex();
+        for(int i = 0; i < layers.count(); ++i)
+            job->records.append(LayerRecord(*layers.layer(i)));
+    }
+
+    if(job->full)
+    {
+        for(int i = 0; i < layers.count(); ++i)
+        {
+            const TiledImage &image = layers.layer(i)->image;
+            for(int row = 0; row < image.rows(); ++row)
+            {
+                for(int column = 0; column < image.columns(); ++column)
+                {
+                    TileSnapshot snapshot = {i, column, row, image.tile(column, row)};
+                    if(!snapshot.tile.isNull())
+                        job->tiles.append(snapshot);
+                }
+            }
+        }
+    }
+    else
+    {
+        for(quint64 dirtyKey : dirty)
+        {
+            TileSnapshot snapshot = {int(dirtyKey >> 40), int(dirtyKey & 0xfffff),
+                                     int((dirtyKey >> 20) & 0xfffff), QImage()};
+            if(snapshot.layer >= layers.count())
+                continue;
+
+            const TiledImage &image = layers.layer(snapshot.layer)->image;
+            if(snapshot.column < image.columns() && snapshot.row < image.rows())
+            {
+                snapshot.tile = image.tile(snapshot.column, snapshot.row);
+                job->tiles.append(snapshot);
+            }
+        }
+    }
+
+    dirty.clear();
+    all = false;
+    document = false;
+    started = true;
+    pool.start(job);
+}
+
+/**
+ * @brief AutosaveJournal::restore - replace the layers with the ones of the
+ *                                   last complete checkpoint in the journal
+ *                                   another session left behind at from. They are written
+ *                                   to this session's journal before this
+ *                                   returns, the old one can go then.
+ *
+ */
+bool AutosaveJournal::restore(const QString &from, LayerStack *layers)
+{
+    pool.waitForDone();
+
+    QFile file(from);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+    const qint64 size = file.size();
+    const uchar *data = size >= HEADER_SIZE ? file.map(0, size) : 0;
+    if(!data || memcmp(data, MAGIC, sizeof(MAGIC)) != 0
+       || qFromLittleEndian<quint32>(data + 8) != VERSION)
+        return false;
+
+    // read up to the first record that doesn't check out
+    Checkpoint staged;
+    Checkpoint committed;
+    qint64 at = HEADER_SIZE;
+    while(at + RECORD_HEADER_SIZE <= size)
+    {
+        const quint32 type = qFromLittleEndian<quint32>(data + at);
+        const quint32 length = qFromLittleEndian<quint32>(data + at + 4);
+        const quint32 crc = qFromLittleEndian<quint32>(data + at + 8);
+        const char *payload = reinterpret_cast<const char*>(data + at + RECORD_HEADER_SIZE);
+        if(at + RECORD_HEADER_SIZE + length > size || crc32(payload, length) != crc)
+            break;
+        at += RECORD_HEADER_SIZE + length;
+
+        if(type == DOCUMENT_RECORD)
+        {
+            Checkpoint read;
+            QDataStream in(QByteArray::fromRawData(payload, int(length)));
+            in.setVersion(QDataStream::Qt_5_6);
+            qint32 current, count;
+            in >> read.size >> current >> count;
+            for(int i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+            {
+                LayerRecord record;
+                in >> record;
+                read.records.append(record);
+            }
+            read.current = current;
+            read.valid = in.status() == QDataStream::Ok && count > 0
+                         && !read.size.isEmpty()
+                         && read.size.width() <= MAX_IMG_WIDTH
+                         && read.size.height() <= MAX_IMG_HEIGHT;
+            for(const LayerRecord &record : read.records)
+                read.valid = read.valid && record.isValid();
+
+            // appended to a checkpoint only the records changed, e.g. the
+            // shapes, and the tiles written before still count
+            bool same = staged.valid && read.size == staged.size
+                        && read.records.size() == staged.records.size();
+            for(int i = 0; same && i < read.records.size(); ++i)
+                same = read.records.at(i).fill == staged.records.at(i).fill
+                       && read.records.at(i).format == staged.records.at(i).format;
+            if(read.valid && same)
+                read.tiles = staged.tiles;
+            staged = read;
+        }
+        else if(type == TILE_RECORD && staged.valid && length >= 12)
+        {
+            const uchar *position = reinterpret_cast<const uchar*>(payload);
+            staged.tiles.insert(key(int(qFromLittleEndian<quint32>(position)),
+                                    int(qFromLittleEndian<quint32>(position + 4)),
+                                    int(qFromLittleEndian<quint32>(position + 8))),
+                                QByteArray(payload + 12, int(length) - 12));
+        }
+        else if(type == COMMIT_RECORD)
+        {
+            committed = staged;
+        }
+    }
+    if(!committed.valid)
+        return false;
+
+    // put the tiles into the images of the layers, then the layers together
+    QVector<TiledImage> images(committed.records.size());
+    for(int i = 0; i < images.size(); ++i)
+        images[i].reset(committed.size, committed.records.at(i).fill,
+                        committed.records.at(i).format);
+
+    for(auto tile = committed.tiles.constBegin(); tile != committed.tiles.constEnd();
+        ++tile)
+    {
+        const int layer = int(tile.key() >> 40);
+        const int column = int(tile.key() & 0xfffff);
+        const int row = int((tile.key() >> 20) & 0xfffff);
+        if(layer >= images.size() || column >= images[layer].columns()
+           || row >= images[layer].rows())
+            continue;
+
+        // the crc only catches accidental damage, the tile is checked to
+        // be of the size and format it has to be before it is decoded
+        TiledImage &image = images[layer];
+        if(tile.value().isEmpty())
+        {
+            image.setTile(column, row, QImage());
+            continue;
+        }
+        const QImage pixels = decompressImage(tile.value(),
+                                              image.tileRect(column, row).size(),
+                                              image.format());
+        if(!pixels.isNull())
+            image.setTile(column, row, pixels);
+    }
+
+    for(int i = 0; i < images.size(); ++i)
+        committed.records.at(i).addTo(layers, i, images.at(i));
+    layers->setCurrentIndex(qBound(0, committed.current, layers->count() - 1));
+
+    markAllDirty();
+    checkpoint(*layers);
+    pool.waitForDone();
+    return true;
+}
+
+/**
+ * @brief AutosaveJournal::discard - remove the journal, once the session
+ *                                   ends cleanly
+ *
+ */
+void AutosaveJournal::discard()
+{
+    pool.waitForDone();
+    QFile::remove(fileName);
+    dirty.clear();
+    all = false;
+    document = false;
+    started = false;
+}
@@ -0,0 +1,76 @@
+#ifndef AUTOSAVE_JOURNAL_H
+#define AUTOSAVE_JOURNAL_H
+
+#include <QAtomicInt>
+#include <QLockFile>
+#include <QRect>
+#include <QSet>
+#include <QString>
+#include <QThreadPool>
+
+#include "layer_stack.h"
+
+
+/**
+ * the crash recovery journal. Edits only mark the tiles they changed as
+ * dirty, which is all the canvas does while drawing. Every so often a
+ * checkpoint takes copy-on-write copies of the dirty tiles and a thread of
+ * the journal's own compresses them and appends them to the journal file,
+ * followed by a commit record. Changes to the layers themselves, undo and
+ * redo dirty everything, and the next checkpoint writes the journal anew
+ * with every layer and tile. Changes to shapes only append the layer
+ * records again, the tiles written before them still count.
+ *
+ * Every record carries a CRC-32 of its payload. Restoring goes up to the
+ * last commit whose records all check out, so a torn last checkpoint
+ * costs only that checkpoint. Every session keeps a journal of its own,
+ * locked for as long as the session runs, and removes it on a clean exit.
+ * A journal whose lock is stale was left by a session that didn't end
+ * cleanly.
+ */
+class AutosaveJournal
+{
+public:
+    AutosaveJournal();
+    ~AutosaveJournal();
+
+    QString path() const { return fileName; }
+    static QString orphan();
+
+    void markDirty(int layer, const QRect &tiles);
+    void markDocumentDirty();
+    void markAllDirty();
+    bool isDirty() const { return all || document || !dirty.isEmpty(); }
+
+    void checkpoint(const LayerStack&);
+    bool restore(const QString &from, LayerStack*);
+    void discard();
+
+private:
+    class Job;
+
+    static QString directory();
+
+    /** this session's journal and the lock held on it */
+    QString fileName;
+    QLockFile lock;
+
+    QThreadPool pool;
+    QAtomicInt busy;
+    QAtomicInt failed;
+
+    /** dirty tiles by layer, row and column */
+    QSet<quint64> dirty;
+    bool all;
+
+    /** whether the layer records changed, e.g. the shapes of a layer */
+    bool document;
+
+    /** whether this session wrote the journal file yet */
+    bool started;
+
+    AutosaveJournal(const AutosaveJournal&);
+    AutosaveJournal& operator=(const AutosaveJournal&);
+};
+
+#endif // AUTOSAVE_JOURNAL_H
@@ -0,0 +1,93 @@
+#include <QAtomicInt>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+#include "stroke_script.h"
+
+
+namespace
+{
+/** draws one script, on a thread of the batch pool */
+class ScriptJob : public QRunnable
+{
+public:
+    ScriptJob(const QString &fileName, const QString &output,
+              QAtomicInt &failed)
+        : fileName(fileName), output(output), failed(failed) {}
+
+    void run() override
+    {
+        // relative outputs go next to the script unless told otherwise
+        QDir dir = output.isEmpty() ? QFileInfo(fileName).absoluteDir()
+                                    : QDir(output);
+        QString error;
+        StrokeScript script;
+        if(!script.run(fileName, dir, &error))
+        {
+            qWarning("%s: %s", qPrintable(fileName), qPrintable(error));
+            failed.ref();
+        }
+    }
+
+private:
+    QString fileName;
+    QString output;
+    QAtomicInt &failed;
+};
+}
+
+int main(int argc, char* argv[])
+{
+    // nothing is ever shown, don't ask for a display
+    if(qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication a(argc, argv);
+    a.setOrganizationName("canvas");
+    a.setApplicationName("canvas-batch");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        QObject::tr("Draws stroke scripts with the canvas tools."));
+    parser.addHelpOption();
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs",
+        QObject::tr("Draw <count> scripts at once, one per core by default."),
+        QObject::tr("count"));
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+        QObject::tr("Save relative file names to <directory> instead of "
+                    "next to each script."),
+        QObject::tr("directory"));
+    parser.addOption(jobsOption);
+    parser.addOption(outputOption);
+    parser.addPositionalArgument("scripts", QObject::tr("The scripts to draw."),
+                                 QObject::tr("script..."));
+    parser.process(a);
+
+    const QStringList scripts = parser.positionalArguments();
+    if(scripts.isEmpty())
+        parser.showHelp(1);
+
+    int jobs = QThread::idealThreadCount();
+    if(parser.isSet(jobsOption))
+        jobs = parser.value(jobsOption).toInt();
+    jobs = qBound(1, jobs, scripts.size());
+
+    // every script has a core of its own already, the tools' own parallel
+    // loops would only take cores from the other scripts
+    if(jobs > 1)
+        QThreadPool::globalInstance()->setMaxThreadCount(1);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobs);
+    QAtomicInt failed(0);
+    for(const QString &script : scripts)
+        pool.start(new ScriptJob(script, parser.value(outputOption), failed));
+    pool.waitForDone();
+
+    return failed.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,496 @@
+#include <cstring>
+
+#include "blend.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLEND_X86 1
+#include <immintrin.h>
+#endif
+
+
+/**
+ * Every kernel blends 'length' premultiplied pixels of src onto dst with a
+ * constant opacity of 0-255, rounding x * a / 255 the same way:
+ *
+ *   t = x * a + 0x80,  x * a / 255 = (t + (t >> 8)) >> 8
+ *
+ * so the scalar and vector kernels give the same pixels.
+ *
+ *   - source-over:  d = s + d * (1 - sa)
+ *   - multiply:     d = s * d + s * (1 - da) + d * (1 - sa)
+ *                   and faded to d by the opacity
+ *   - coverage:     s = color * c,  d = s + b * (1 - sa)
+ *                   for a brush color through coverage c onto background b
+ */
+namespace
+{
+typedef void (*Kernel)(quint32*, const quint32*, int, int);
+typedef void (*MaxKernel)(uchar*, const uchar*, int);
+typedef void (*CoverageKernel)(quint32*, const quint32*, const uchar*,
+                               quint32, int);
+
+inline quint32 byteMul(quint32 x, quint32 a)
+{
+    quint32 t = x * a + 0x80;
+    return (t + (t >> 8)) >> 8;
+}
+
+void sourceOverScalar(quint32 *dst, const quint32 *src, int length, int opacity)
+{
+    for(int i = 0; i < length; ++i)
+    {
+        const quint32 s = src[i];
+        const quint32 d = dst[i];
+        const quint32 inverse = 255 - byteMul(s >> 24, opacity);
+
+        quint32 out = 0;
+        for(int shift = 0; shift < 32; shift += 8)
+        {
+            quint32 sc = byteMul((s >> shift) & 0xff, opacity);
+            quint32 dc = (d >> shift) & 0xff;
+            out |= (sc + byteMul(dc, inverse)) << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+void multiplyScalar(quint32 *dst, const quint32 *src, int length, int opacity)
+{
+    for(int i = 0; i < length; ++i)
+    {
+        const quint32 s = src[i];
+        const quint32 d = dst[i];
+        const quint32 sa = s >> 24;
+        const quint32 da = d >> 24;
+
+        quint32 out = 0;
+        for(int shift = 0; shift < 32; shift += 8)
+        {
+            quint32 sc = (s >> shift) & 0xff;
+            quint32 dc = (d >> shift) & 0xff;
+            quint32 m = byteMul(sc, dc) + byteMul(sc, 255 - da)
+                        + byteMul(dc, 255 - sa);
+            m = qMin<quint32>(m, 255);
+            if(opacity != 255)
+                m = byteMul(m, opacity) + byteMul(dc, 255 - opacity);
+            out |= m << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+void maxScalar(uchar *dst, const uchar *src, int length)
+{
+    for(int i = 0; i < length; ++i)
+        dst[i] = qMax(dst[i], src[i]);
+}
+
+void coverageScalar(quint32 *dst, const quint32 *background,
+                    const uchar *coverage, quint32 color, int length)
+{
+    for(int i = 0; i < length; ++i)
+    {
+        const quint32 c = coverage[i];
+        const quint32 b = background[i];
+        if(c == 0)
+        {
+            dst[i] = b;
+            continue;
+        }
+
+        const quint32 inverse = 255 - byteMul(color >> 24, c);
+        quint32 out = 0;
+        for(int shift = 0; shift < 32; shift += 8)
+        {
+            quint32 sc = byteMul((color >> shift) & 0xff, c);
+            quint32 bc = (b >> shift) & 0xff;
+            out |= (sc + byteMul(bc, inverse)) << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+#ifdef BLEND_X86
+
+/////////////////////////////////////////
+// SSE2, two pixels per 128-bit register //
+/////////////////////////////////////////
+
+__attribute__((target("sse2")))
+inline __m128i byteMulSse2(__m128i x, __m128i a)
+{
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, a), _mm_set1_epi16(0x80));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+inline __m128i alphaSse2(__m128i x)
+{
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)),
+                               _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+__attribute__((target("sse2")))
+void sourceOverSse2(quint32 *dst, const quint32 *src, int length, int opacity)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i constant = _mm_set1_epi16(opacity);
+    const __m128i opaque = _mm_set1_epi32(int(0xff000000));
+
+    int i = 0;
+    for(; i + 4 <= length; i += 4)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+        // transparent pixels leave dst alone, opaque ones replace it
+        if(_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xffff)
+            continue;
+        if(opacity == 255 && _mm_movemask_epi8(
+               _mm_cmpeq_epi32(_mm_and_si128(s, opaque), opaque)) == 0xffff)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), s);
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i sl = _mm_unpacklo_epi8(s, zero);
+        __m128i sh = _mm_unpackhi_epi8(s, zero);
+        if(opacity != 255)
+        {
+            sl = byteMulSse2(sl, constant);
+            sh = byteMulSse2(sh, constant);
+        }
+
+        __m128i dl = _mm_unpacklo_epi8(d, zero);
+        __m128i dh = _mm_unpackhi_epi8(d, zero);
+        dl = _mm_add_epi16(sl, byteMulSse2(dl, _mm_sub_epi16(full, alphaSse2(sl))));
+        dh = _mm_add_epi16(sh, byteMulSse2(dh, _mm_sub_epi16(full, alphaSse2(sh))));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_packus_epi16(dl, dh));
+    }
+    sourceOverScalar(dst + i, src + i, length - i, opacity);
+}
+
+__attribute__((target("sse2")))
+inline __m128i multiplyPixelsSse2(__m128i s, __m128i d, __m128i constant,
+                                  int opacity)
+{
+    const __m128i full = _mm_set1_epi16(255);
+    __m128i m = _mm_add_epi16(
+        _mm_add_epi16(byteMulSse2(s, d),
+                      byteMulSse2(s, _mm_sub_epi16(full, alphaSse2(d)))),
+        byteMulSse2(d, _mm_sub_epi16(full, alphaSse2(s))));
+    m = _mm_min_epi16(m, full);
+    if(opacity != 255)
+        m = _mm_add_epi16(byteMulSse2(m, constant),
+                          byteMulSse2(d, _mm_sub_epi16(full, constant)));
+    return m;
+}
+
+__attribute__((target("sse2")))
+void multiplySse2(quint32 *dst, const quint32 *src, int length, int opacity)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i constant = _mm_set1_epi16(opacity);
+
+    int i = 0;
+    for(; i + 4 <= length; i += 4)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xffff)
+            continue;
+
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i low = multiplyPixelsSse2(_mm_unpacklo_epi8(s, zero),
+                                         _mm_unpacklo_epi8(d, zero),
+                                         constant, opacity);
+        __m128i high = multiplyPixelsSse2(_mm_unpackhi_epi8(s, zero),
+                                          _mm_unpackhi_epi8(d, zero),
+                                          constant, opacity);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_packus_epi16(low, high));
+    }
+    multiplyScalar(dst + i, src + i, length - i, opacity);
+}
+
+__attribute__((target("sse2")))
+void maxSse2(uchar *dst, const uchar *src, int length)
+{
+    int i = 0;
+    for(; i + 16 <= length; i += 16)
+    {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_max_epu8(d, s));
+    }
+    maxScalar(dst + i, src + i, length - i);
+}
+
+__attribute__((target("sse2")))
+void coverageSse2(quint32 *dst, const quint32 *background,
+                  const uchar *coverage, quint32 color, int length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i colors = _mm_unpacklo_epi8(_mm_set1_epi32(int(color)), zero);
+
+    int i = 0;
+    for(; i + 4 <= length; i += 4)
+    {
+        int bytes;
+        memcpy(&bytes, coverage + i, sizeof(bytes));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(background + i));
+        if(bytes == 0)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), b);
+            continue;
+        }
+
+        // every pixel's coverage in the four 16-bit lanes of its channels
+        __m128i c = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+        c = _mm_unpacklo_epi16(c, c);
+        __m128i sl = byteMulSse2(colors, _mm_unpacklo_epi32(c, c));
+        __m128i sh = byteMulSse2(colors, _mm_unpackhi_epi32(c, c));
+
+        __m128i bl = _mm_unpacklo_epi8(b, zero);
+        __m128i bh = _mm_unpackhi_epi8(b, zero);
+        bl = _mm_add_epi16(sl, byteMulSse2(bl, _mm_sub_epi16(full, alphaSse2(sl))));
+        bh = _mm_add_epi16(sh, byteMulSse2(bh, _mm_sub_epi16(full, alphaSse2(sh))));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_packus_epi16(bl, bh));
+    }
+    coverageScalar(dst + i, background + i, coverage + i, color, length - i);
+}
+
+//////////////////////////////////////////
+// AVX2, four pixels per 256-bit register //
+//////////////////////////////////////////
+
+__attribute__((target("avx2")))
+inline __m256i byteMulAvx2(__m256i x, __m256i a)
+{
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, a), _mm256_set1_epi16(0x80));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+inline __m256i alphaAvx2(__m256i x)
+{
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)),
+                                  _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+__attribute__((target("avx2")))
+void sourceOverAvx2(quint32 *dst, const quint32 *src, int length, int opacity)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi16(255);
+    const __m256i constant = _mm256_set1_epi16(opacity);
+    const __m256i opaque = _mm256_set1_epi32(int(0xff000000));
+
+    int i = 0;
+    for(; i + 8 <= length; i += 8)
+    {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+
+        // transparent pixels leave dst alone, opaque ones replace it
+        if(_mm256_movemask_epi8(_mm256_cmpeq_epi32(s, zero)) == -1)
+            continue;
+        if(opacity == 255 && _mm256_movemask_epi8(
+               _mm256_cmpeq_epi32(_mm256_and_si256(s, opaque), opaque)) == -1)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), s);
+            continue;
+        }
+
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i sl = _mm256_unpacklo_epi8(s, zero);
+        __m256i sh = _mm256_unpackhi_epi8(s, zero);
+        if(opacity != 255)
+        {
+            sl = byteMulAvx2(sl, constant);
+            sh = byteMulAvx2(sh, constant);
+        }
+
+        __m256i dl = _mm256_unpacklo_epi8(d, zero);
+        __m256i dh = _mm256_unpackhi_epi8(d, zero);
+        dl = _mm256_add_epi16(sl, byteMulAvx2(dl, _mm256_sub_epi16(full, alphaAvx2(sl))));
+        dh = _mm256_add_epi16(sh, byteMulAvx2(dh, _mm256_sub_epi16(full, alphaAvx2(sh))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                            _mm256_packus_epi16(dl, dh));
+    }
+    sourceOverSse2(dst + i, src + i, length - i, opacity);
+}
+
+__attribute__((target("avx2")))
+inline __m256i multiplyPixelsAvx2(__m256i s, __m256i d, __m256i constant,
+                                  int opacity)
+{
+    const __m256i full = _mm256_set1_epi16(255);
+    __m256i m = _mm256_add_epi16(
+        _mm256_add_epi16(byteMulAvx2(s, d),
+                         byteMulAvx2(s, _mm256_sub_epi16(full, alphaAvx2(d)))),
+        byteMulAvx2(d, _mm256_sub_epi16(full, alphaAvx2(s))));
+    m = _mm256_min_epi16(m, full);
+    if(opacity != 255)
+        m = _mm256_add_epi16(byteMulAvx2(m, constant),
+                             byteMulAvx2(d, _mm256_sub_epi16(full, constant)));
+    return m;
+}
+
+__attribute__((target("avx2")))
+void multiplyAvx2(quint32 *dst, const quint32 *src, int length, int opacity)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i constant = _mm256_set1_epi16(opacity);
+
+    int i = 0;
+    for(; i + 8 <= length; i += 8)
+    {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        if(_mm256_movemask_epi8(_mm256_cmpeq_epi32(s, zero)) == -1)
+            continue;
+
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i low = multiplyPixelsAvx2(_mm256_unpacklo_epi8(s, zero),
+                                         _mm256_unpacklo_epi8(d, zero),
+                                         constant, opacity);
+        __m256i high = multiplyPixelsAvx2(_mm256_unpackhi_epi8(s, zero),
+                                          _mm256_unpackhi_epi8(d, zero),
+                                          constant, opacity);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                            _mm256_packus_epi16(low, high));
+    }
+    multiplySse2(dst + i, src + i, length - i, opacity);
+}
+
+__attribute__((target("avx2")))
+void maxAvx2(uchar *dst, const uchar *src, int length)
+{
+    int i = 0;
+    for(; i + 32 <= length; i += 32)
+    {
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                            _mm256_max_epu8(d, s));
+    }
+    maxSse2(dst + i, src + i, length - i);
+}
+
+__attribute__((target("avx2")))
+void coverageAvx2(quint32 *dst, const quint32 *background,
+                  const uchar *coverage, quint32 color, int length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi16(255);
+    const __m256i colors = _mm256_unpacklo_epi8(_mm256_set1_epi32(int(color)), zero);
+
+    int i = 0;
+    for(; i + 8 <= length; i += 8)
+    {
+        long long bytes;
+        memcpy(&bytes, coverage + i, sizeof(bytes));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(background + i));
+        if(bytes == 0)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), b);
+            continue;
+        }
+
+        // every pixel's coverage in the four 16-bit lanes of its channels,
+        // in the order the 128-bit halves are unpacked
+        __m256i c = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(bytes));
+        c = _mm256_or_si256(c, _mm256_slli_epi32(c, 16));
+        __m256i sl = byteMulAvx2(colors, _mm256_unpacklo_epi32(c, c));
+        __m256i sh = byteMulAvx2(colors, _mm256_unpackhi_epi32(c, c));
+
+        __m256i bl = _mm256_unpacklo_epi8(b, zero);
+        __m256i bh = _mm256_unpackhi_epi8(b, zero);
+        bl = _mm256_add_epi16(sl, byteMulAvx2(bl, _mm256_sub_epi16(full, alphaAvx2(sl))));
+        bh = _mm256_add_epi16(sh, byteMulAvx2(bh, _mm256_sub_epi16(full, alphaAvx2(sh))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                            _mm256_packus_epi16(bl, bh));
+    }
+    coverageSse2(dst + i, background + i, coverage + i, color, length - i);
+}
+
+#endif // BLEND_X86
+
+struct Kernels
+{
+    Kernel sourceOver;
+    Kernel multiply;
+    MaxKernel max;
+    CoverageKernel coverage;
+};
+
+/** the best kernels the CPU runs, picked once */
+Kernels detectKernels()
+{
+#ifdef BLEND_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return Kernels{sourceOverAvx2, multiplyAvx2, maxAvx2, coverageAvx2};
+    if(__builtin_cpu_supports("sse2"))
+        return Kernels{sourceOverSse2, multiplySse2, maxSse2, coverageSse2};
+#endif
+    return Kernels{sourceOverScalar, multiplyScalar, maxScalar, coverageScalar};
+}
+
+const Kernels& kernels()
+{
+    static const Kernels detected = detectKernels();
+    return detected;
+}
+}
+
+/**
+ * @brief blendImage - blend source onto destination row by row with the
+ *                     kernel for the mode
+ *
+ */
+bool blendImage(QImage &destination, const QImage &source,
+                QPainter::CompositionMode mode, int opacity)
+{
+    if(destination.format() != QImage::Format_ARGB32_Premultiplied
+       || (source.format() != QImage::Format_ARGB32_Premultiplied
+           && source.format() != QImage::Format_RGB32)
+       || source.size() != destination.size())
+        return false;
+
+    Kernel kernel = 0;
+    if(mode == QPainter::CompositionMode_SourceOver)
+        kernel = kernels().sourceOver;
+    else if(mode == QPainter::CompositionMode_Multiply)
+        kernel = kernels().multiply;
+    if(!kernel)
+        return false;
+
+    opacity = qBound(0, opacity, 255);
+    for(int y = 0; y < destination.height(); ++y)
+        kernel(reinterpret_cast<quint32*>(destination.scanLine(y)),
+               reinterpret_cast<const quint32*>(source.constScanLine(y)),
+               destination.width(), opacity);
+    return true;
+}
+
+/**
+ * @brief maxCoverage - raise destination to source with the best kernel
+ *
+ */
+void maxCoverage(uchar *destination, const uchar *source, int length)
+{
+    kernels().max(destination, source, length);
+}
+
+/**
+ * @brief paintCoverage - draw color through coverage with the best kernel
+ *
+ */
+void paintCoverage(quint32 *destination, const quint32 *background,
+                   const uchar *coverage, quint32 color, int length)
+{
+    kernels().coverage(destination, background, coverage, color, length);
+}
@@ -0,0 +1,32 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <QImage>
+#include <QPainter>
+
+
+/**
+ * vectorised source-over and multiply of a premultiplied ARGB32 or RGB32
+ * image onto a premultiplied ARGB32 image of the same size, with an
+ * opacity of 0-255. Uses AVX2 or SSE2 when the CPU has them. Returns
+ * false, leaving destination alone, for any other mode or format.
+ */
+bool blendImage(QImage &destination, const QImage &source,
+                QPainter::CompositionMode, int opacity);
+
+/**
+ * raise destination to source byte by byte, to stamp a brush dab into the
+ * 8 bit coverage of a stroke. Vectorised like blendImage.
+ */
+void maxCoverage(uchar *destination, const uchar *source, int length);
+
+/**
+ * draw a premultiplied color source-over length pixels of a premultiplied
+ * ARGB32 or RGB32 background through 8 bit coverage into destination,
+ * which may be the background. Opaque backgrounds stay opaque. Vectorised
+ * like blendImage.
+ */
+void paintCoverage(quint32 *destination, const quint32 *background,
+                   const uchar *coverage, quint32 color, int length);
+
+#endif // BLEND_H
@@ -0,0 +1,275 @@
+#include <QtMath>
+#include <climits>
+
+#include "blend.h"
+#include "brush.h"
+
+
+namespace
+{
+/** a row of a tile nothing was stamped on */
+const uchar noCoverage[TILE_SIZE] = {};
+
+/** subsamples per pixel side when measuring round dabs */
+const int DAB_SUBSAMPLES = 8;
+}
+
+Brush::Brush()
+    : color(0), shape(0), spacing(1), columns(0)
+{
+}
+
+/**
+ * @brief Brush::reset - start a new stroke of the pen, dabs are only
+ *                       stamped within clip
+ *
+ */
+void Brush::reset(const QPen &pen, const QRect &clip)
+{
+    this->clip = clip.normalized().intersected(QRect(0, 0, INT_MAX / 2, INT_MAX / 2));
+    color = qPremultiply(pen.color().rgba());
+    shape = &dab(pen.widthF(), pen.capStyle());
+
+    // dabs overlap enough for the edges of wide strokes to stay smooth
+    spacing = qMax(1, shape->mask.width() / 16);
+
+    tiles.clear();
+    columns = 0;
+    if(this->clip.isEmpty())
+        return;
+
+    columns = this->clip.right() / TILE_SIZE + 1;
+    tiles.resize(columns * (this->clip.bottom() / TILE_SIZE + 1));
+}
+
+/**
+ * @brief Brush::stamp - stamp dabs from one point to another, ends
+ *                       included, and return the area they covered
+ *
+ */
+QRect Brush::stamp(const QPoint &from, const QPoint &to)
+{
+    if(!shape || clip.isEmpty())
+        return QRect();
+
+    // a segment whose dabs all miss the clip is skipped whole, so redrawing
+    // a small area of a long stroke only walks the segments crossing it
+    const QPoint offset = shape->offset;
+    const QRect area = QRect(from, to).normalized()
+        .adjusted(offset.x(), offset.y(), -offset.x(), -offset.y());
+    if(!area.intersects(clip))
+        return QRect();
+
+    const QPoint delta = to - from;
+    const qreal length = qSqrt(qreal(delta.x()) * delta.x()
+                               + qreal(delta.y()) * delta.y());
+    const int steps = qMax(1, qCeil(length / spacing));
+
+    QPoint last;
+    for(int step = 0; step <= steps; ++step)
+    {
+        QPoint center = from + QPoint(qRound(delta.x() * qreal(step) / steps),
+                                      qRound(delta.y() * qreal(step) / steps));
+        if(step > 0 && center == last)
+            continue;
+        stampDab(center);
+        last = center;
+    }
+
+    return area.intersected(clip);
+}
+
+/**
+ * @brief Brush::stamp - stamp dabs through every point in turn, a single
+ *                       point is a single dab
+ *
+ */
+QRect Brush::stamp(const QVector<QPoint> &points)
+{
+    if(points.isEmpty())
+        return QRect();
+
+    QRect area = stamp(points.first(), points.first());
+    for(int i = 1; i < points.size(); ++i)
+        area |= stamp(points.at(i - 1), points.at(i));
+    return area;
+}
+
+/**
+ * @brief Brush::composite - set area of image to the background with the
+ *                           stroke drawn over it
+ *
+ */
+void Brush::composite(TiledImage *image, const TiledImage &background,
+                      const QRect &area) const
+{
+    image->process(area.intersected(clip),
+                   [&](QImage &tile, const QRect &part, int column, int row)
+    {
+        const QImage under = background.tileImage(column, row);
+        const QPoint origin = image->tileRect(column, row).topLeft();
+
+        for(int y = part.top(); y <= part.bottom(); ++y)
+        {
+            paintCoverage(reinterpret_cast<quint32*>(tile.scanLine(y)) + part.left(),
+                          reinterpret_cast<const quint32*>(under.constScanLine(y))
+                              + part.left(),
+                          coverage(origin.x() + part.left(), origin.y() + y),
+                          color, part.width());
+        }
+    });
+}
+
+/**
+ * @brief Brush::toImage - the stroke within area on its own, premultiplied
+ *
+ */
+QImage Brush::toImage(const QRect &area) const
+{
+    QImage image(area.size(), QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    for(int y = 0; y < image.height(); ++y)
+    {
+        quint32 *line = reinterpret_cast<quint32*>(image.scanLine(y));
+
+        // coverage rows end at tile edges
+        for(int x = 0; x < image.width();)
+        {
+            const int left = area.left() + x;
+            const int length = qMin(image.width() - x,
+                                    TILE_SIZE - left % TILE_SIZE);
+            paintCoverage(line + x, line + x, coverage(left, area.top() + y),
+                          color, length);
+            x += length;
+        }
+    }
+    return image;
+}
+
+/**
+ * @brief Brush::dab - the dab for a pen width and cap, made the first time
+ *                     any dab is asked for
+ *
+ */
+const Brush::Dab& Brush::dab(qreal width, Qt::PenCapStyle cap)
+{
+    static const QVector<Dab> dabs = []()
+    {
+        QVector<Dab> made;
+        for(int round = 0; round < 2; ++round)
+            for(int size = MIN_PEN_SIZE; size <= MAX_PEN_SIZE; ++size)
+                made.append(makeDab(size, round));
+        return made;
+    }();
+
+    const int size = qBound(MIN_PEN_SIZE, qRound(width), MAX_PEN_SIZE);
+    const int round = cap == Qt::RoundCap ? 1 : 0;
+    return dabs.at(round * (MAX_PEN_SIZE - MIN_PEN_SIZE + 1) + size - MIN_PEN_SIZE);
+}
+
+/**
+ * @brief Brush::makeDab - the coverage of a circle or square width pixels
+ *                         across, centered on a pixel. Circles are measured
+ *                         from DAB_SUBSAMPLES^2 samples a pixel, squares
+ *                         exactly.
+ *
+ */
+Brush::Dab Brush::makeDab(int width, bool round)
+{
+    const int half = width / 2 + 1;
+    const int side = 2 * half + 1;
+    const qreal center = half + 0.5;
+    const qreal radius = width / 2.0;
+
+    Dab dab;
+    dab.offset = QPoint(-half, -half);
+    dab.mask = QImage(side, side, QImage::Format_Alpha8);
+
+    for(int y = 0; y < side; ++y)
+    {
+        uchar *line = dab.mask.scanLine(y);
+        for(int x = 0; x < side; ++x)
+        {
+            qreal covered = 0;
+            if(round)
+            {
+                int inside = 0;
+                for(int sy = 0; sy < DAB_SUBSAMPLES; ++sy)
+                {
+                    for(int sx = 0; sx < DAB_SUBSAMPLES; ++sx)
+                    {
+                        qreal dx = x + (sx + 0.5) / DAB_SUBSAMPLES - center;
+                        qreal dy = y + (sy + 0.5) / DAB_SUBSAMPLES - center;
+                        if(dx * dx + dy * dy <= radius * radius)
+                            ++inside;
+                    }
+                }
+                covered = qreal(inside) / (DAB_SUBSAMPLES * DAB_SUBSAMPLES);
+            }
+            else
+            {
+                qreal across = qMin<qreal>(x + 1, center + radius)
+                               - qMax<qreal>(x, center - radius);
+                qreal down = qMin<qreal>(y + 1, center + radius)
+                             - qMax<qreal>(y, center - radius);
+                covered = qMax<qreal>(across, 0) * qMax<qreal>(down, 0);
+            }
+            line[x] = uchar(qRound(covered * 255));
+        }
+    }
+    return dab;
+}
+
+/**
+ * @brief Brush::stampDab - raise the coverage under a dab centered on a
+ *                          pixel to the dab's
+ *
+ */
+void Brush::stampDab(const QPoint &center)
+{
+    const QRect bounds(center + shape->offset, shape->mask.size());
+    const QRect area = bounds.intersected(clip);
+    if(area.isEmpty())
+        return;
+
+    for(int row = area.top() / TILE_SIZE; row <= area.bottom() / TILE_SIZE; ++row)
+    {
+        for(int column = area.left() / TILE_SIZE;
+            column <= area.right() / TILE_SIZE; ++column)
+        {
+            QImage &tile = tiles[row * columns + column];
+            if(tile.isNull())
+            {
+                tile = QImage(TILE_SIZE, TILE_SIZE, QImage::Format_Alpha8);
+                tile.fill(0);
+            }
+
+            const QRect tileArea(column * TILE_SIZE, row * TILE_SIZE,
+                                 TILE_SIZE, TILE_SIZE);
+            const QRect part = area.intersected(tileArea);
+            for(int y = part.top(); y <= part.bottom(); ++y)
+                maxCoverage(tile.scanLine(y - tileArea.top())
+                                + part.left() - tileArea.left(),
+                            shape->mask.constScanLine(y - bounds.top())
+                                + part.left() - bounds.left(),
+                            part.width());
+        }
+    }
+}
+
+/**
+ * @brief Brush::coverage - the stroke's coverage from a pixel to the end of
+ *                          its tile row
+ *
+ */
+const uchar* Brush::coverage(int x, int y) const
+{
+    if(!clip.contains(x, y))
+        return noCoverage;
+
+    const QImage &tile = tiles.at((y / TILE_SIZE) * columns + x / TILE_SIZE);
+    if(tile.isNull())
+        return noCoverage;
+    return tile.constScanLine(y % TILE_SIZE) + x % TILE_SIZE;
+}
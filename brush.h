@@ -0,0 +1,57 @@
+#ifndef BRUSH_H
+#define BRUSH_H
+
+#include <QImage>
+#include <QPen>
+#include <QRect>
+#include <QVector>
+
+#include "tiled_image.h"
+
+
+/**
+ * the stamp based brush of the pen and eraser. Anti-aliased dabs are
+ * stamped along the segments of a stroke into its 8 bit coverage, which
+ * keeps the highest coverage of any dab, so overlapping dabs don't darken
+ * each other. The stroke's pixels are the image before the stroke with
+ * the pen color drawn over it through the coverage. Both steps run on the
+ * vectorised kernels of blend.h.
+ *
+ * The dabs are made once for every pen width from MIN_PEN_SIZE to
+ * MAX_PEN_SIZE, round for round caps and square for the others.
+ */
+class Brush
+{
+public:
+    Brush();
+
+    void reset(const QPen&, const QRect &clip);
+    QRect stamp(const QPoint &from, const QPoint &to);
+    QRect stamp(const QVector<QPoint>&);
+
+    void composite(TiledImage*, const TiledImage &background,
+                   const QRect&) const;
+    QImage toImage(const QRect&) const;
+
+private:
+    /** the coverage of a dab, centered on the pixel at -offset */
+    struct Dab
+    {
+        QImage mask;
+        QPoint offset;
+    };
+
+    static const Dab& dab(qreal width, Qt::PenCapStyle);
+    static Dab makeDab(int width, bool round);
+    void stampDab(const QPoint&);
+    const uchar* coverage(int x, int y) const;
+
+    QRect clip;
+    quint32 color;
+    const Dab* shape;
+    int spacing;
+    int columns;
+    QVector<QImage> tiles;
+};
+
+#endif // BRUSH_H
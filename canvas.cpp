@@ -1,5 +1,12 @@
+#include <QDataStream>
+#include <QEventLoop>
 #include <QPainter>
 #include <QPaintEvent>
+#include <QProgressDialog>
+#include <QSettings>
+#include <QThread>
+#include <QWheelEvent>
+#include <QtMath>
 
 //
 #include <vtkActor.h>
@@ -10,6 +17,7 @@
 #include <vtkProperty.h>
 #include <vtkRenderWindow.h>
 #include <vtkRenderer.h>
+#include <vtkRendererCollection.h>
 #include <vtkSphereSource.h>
 #include <vtkCubeSource.h>
 #include <vtkCylinderSource.h>
@@ -33,8 +41,33 @@
 #include "commands.h"
 #include "canvas.h"
 #include "main_window.h"
+#include "resample.h"
 
 
+namespace
+{
+/** resamples the images of the raster layers off the GUI thread */
+class ResizeThread : public QThread
+{
+public:
+    ResizeThread(const QVector<TiledImage> &images, const QSize &size,
+                 ResampleFilter filter)
+        : images(images), size(size), filter(filter), progress(0) {}
+
+    void run() override
+    {
+        for(TiledImage &image : images)
+            if(!image.isNull())
+                image = image.scaled(size, filter, &progress);
+    }
+
+    QVector<TiledImage> images;
+    QSize size;
+    ResampleFilter filter;
+    QAtomicInt progress;
+};
+}
+
 /**
  * @brief Canvas::Canvas - constructor for our Draw Area.
  *                             Pointers to the MainWindow's
@@ -44,12 +77,64 @@
 Canvas::Canvas(QWidget *parent)
     : QWidget(parent)
 {
-    // initialize the undo stack
-    undoStack = new QUndoStack(this);
-    undoStack->setUndoLimit(UNDO_LIMIT);
-
-    // initialize image
-    image = new QPixmap();
+    // initialize the undo stack with the memory budget and the number
+    // of commands kept off the disk journal from the settings
+    QSettings settings;
+    if(!settings.contains("undo/budget_mb"))
+        settings.setValue("undo/budget_mb", DEFAULT_UNDO_BUDGET_MB);
+    if(!settings.contains("undo/resident_commands"))
+        settings.setValue("undo/resident_commands",
+                          DEFAULT_UNDO_RESIDENT_COMMANDS);
+    qint64 budget = settings.value("undo/budget_mb").toLongLong();
+    int resident = settings.value("undo/resident_commands").toInt();
+    undoStack = new UndoStack(budget * 1024 * 1024, resident);
+
+    // the project file saved to or opened last
+    project = new ProjectFile();
+
+    // checkpoint the tiles changed since the last one every so often, for
+    // recovery after a crash
+    if(!settings.contains("autosave/interval_s"))
+        settings.setValue("autosave/interval_s", DEFAULT_AUTOSAVE_INTERVAL);
+    autosave = new AutosaveJournal();
+    autosaveTimer = new QTimer(this);
+    connect(autosaveTimer, SIGNAL(timeout()), this, SLOT(OnAutosave()));
+    int interval = settings.value("autosave/interval_s").toInt();
+    if(interval > 0)
+        autosaveTimer->start(interval * 1000);
+
+    // images are read in on the loader's thread
+    loader = new ImageLoader();
+    loadingLayer = 0;
+    connect(loader, SIGNAL(started(QSize,QImage::Format)),
+            this, SLOT(OnLoadStarted(QSize,QImage::Format)));
+    connect(loader, SIGNAL(stripsLoaded()), this, SLOT(OnStripsLoaded()));
+    connect(loader, SIGNAL(loaded(QString)), this, SLOT(OnLoadEnded()));
+    connect(loader, SIGNAL(loadFailed(QString,QString)), this, SLOT(OnLoadEnded()));
+    connect(loader, SIGNAL(progress(int,int)),
+            this, SIGNAL(imageLoadProgress(int,int)));
+    connect(loader, SIGNAL(loaded(QString)), this, SIGNAL(imageLoaded(QString)));
+    connect(loader, SIGNAL(loadFailed(QString,QString)),
+            this, SIGNAL(imageLoadFailed(QString,QString)));
+
+    // images are written out on the saver's thread
+    saver = new ImageSaver();
+    connect(saver, SIGNAL(saved(QString)), this, SIGNAL(imageSaved(QString)));
+    connect(saver, SIGNAL(saveFailed(QString,QString)),
+            this, SIGNAL(imageSaveFailed(QString,QString)));
+
+    // initialize the layers, with a single empty one
+    layers = new LayerStack();
+    image = &layers->currentLayer()->image;
+
+    // initialize the view, unzoomed
+    pyramid = new MipPyramid(layers);
+    zoom = 1;
+    panning = false;
+
+    // nothing selected
+    selectedShape = -1;
+    movingShape = false;
 
     //create the pen, line, eraser, & rect tools
     createTools();
@@ -68,35 +153,236 @@ Canvas::Canvas(QWidget *parent)
     setAttribute(Qt::WA_OpaquePaintEvent);
     setAttribute(Qt::WA_StaticContents);
 
+    // mouse moves are queued and drawn once per frame, however
+    // many events the mouse or tablet sends
+    frameTimer = new QTimer(this);
+    frameTimer->setSingleShot(true);
+    frameTimer->setInterval(INPUT_FRAME_INTERVAL);
+    frameTimer->setTimerType(Qt::PreciseTimer);
+    connect(frameTimer, SIGNAL(timeout()), this, SLOT(flushInput()));
+
     widget = new QVTKOpenGLNativeWidget;
 }
 
 Canvas::~Canvas()
 {
-    delete image;
+    // finishes writing any image being saved
+    delete saver;
+    delete loader;
+    delete project;
+
+    // a clean exit, nothing to recover
+    autosave->discard();
+    delete autosave;
+    delete undoStack;
+    delete pyramid;
+    delete layers;
     delete penTool;
     delete lineTool;
     delete eraserTool;
     delete rectTool;
+    delete fillTool;
+    delete selectTool;
 }
 
 
 /**
- * @brief Canvas::paintEvent - redraw part of the image based
- *                               on what was modified
+ * @brief Canvas::paintEvent - redraw part of the flattened layers
+ *                               based on what was modified, with the
+ *                               preview of the shape being dragged
+ *                               on top. Unzoomed the tiles are blitted
+ *                               as they are, zoomed out they are drawn
+ *                               from the closest mip level.
  *
  */
 void Canvas::paintEvent(QPaintEvent *e)
 
 {
     QPainter painter(this);
-    QRect modifiedArea = e->rect(); // only need to redraw a small area
-    painter.drawPixmap(modifiedArea, *image, modifiedArea);
+    QRect imageArea = QRectF(origin, QSizeF(image->size()) * zoom).toRect();
+
+    // only need to redraw the small areas that were updated
+    for(const QRect &modifiedArea : e->region())
+    {
+        for(const QRect &outside : QRegion(modifiedArea).subtracted(imageArea))
+            painter.fillRect(outside, palette().dark());
+
+        painter.save();
+        painter.setClipRect(modifiedArea);
+        painter.translate(origin);
+
+        if(zoom == 1)
+        {
+            QRect area = modifiedArea.translated(-origin);
+            layers->draw(painter, area);
+
+            if(!preview.isNull() && previewRect.intersects(area))
+            {
+                area = previewRect.intersected(area);
+                painter.drawImage(area, preview,
+                                  area.translated(-previewRect.topLeft()));
+            }
+        }
+        else
+        {
+            painter.scale(zoom, zoom);
+            pyramid->draw(painter, toImage(modifiedArea), zoom);
+
+            if(!preview.isNull())
+                painter.drawImage(previewRect, preview);
+        }
+
+        // outline the selected shape, where it is being dragged to
+        QRect selection = selectionRect();
+        if(!selection.isEmpty())
+        {
+            QPen outline(Qt::black, 0, Qt::DashLine);
+            painter.setPen(outline);
+            painter.setBrush(Qt::NoBrush);
+            painter.drawRect(selection);
+        }
+
+        // outline the selected pixels
+        if(currentTool == selectTool && selectTool->hasSelection())
+        {
+            QPen outline(Qt::black, 0, Qt::DashLine);
+            painter.setPen(outline);
+            painter.setBrush(Qt::NoBrush);
+            painter.drawPolygon(selectTool->selection());
+        }
+        painter.restore();
+    }
+}
+
+/**
+ * @brief Canvas::updateArea - repaint an area of the image, in image
+ *                             coordinates
+ *
+ */
+void Canvas::updateArea(const QRect &area)
+{
+    update(toWidget(area));
+}
+
+/**
+ * @brief Canvas::toImage - the image pixel under a point of the widget
+ *
+ */
+QPoint Canvas::toImage(const QPoint &pos) const
+{
+    return QPoint(qFloor((pos.x() - origin.x()) / zoom),
+                  qFloor((pos.y() - origin.y()) / zoom));
+}
+
+/**
+ * @brief Canvas::toWidget - the widget pixels an area of the image is
+ *                           drawn on, with a pixel to spare for smoothing
+ *                           when zoomed
+ *
+ */
+QRect Canvas::toWidget(const QRect &area) const
+{
+    if(zoom == 1)
+        return area.translated(origin);
+
+    QRectF scaled(QPointF(area.topLeft()) * zoom, QSizeF(area.size()) * zoom);
+    return scaled.translated(origin).toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+/**
+ * @brief Canvas::toImage - the image pixels under an area of the widget
+ *
+ */
+QRect Canvas::toImage(const QRect &area) const
+{
+    if(zoom == 1)
+        return area.translated(-origin);
+
+    QRectF scaled(QPointF(area.topLeft() - origin) / zoom,
+                  QSizeF(area.size()) / zoom);
+    return scaled.toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+/**
+ * @brief Canvas::setZoom - zoom the view, keeping the image pixel under
+ *                          anchor in place
+ *
+ */
+void Canvas::setZoom(qreal value, const QPoint &anchor)
+{
+    value = qBound(MIN_ZOOM, value, MAX_ZOOM);
+    if(value == zoom)
+        return;
+
+    QPointF pixel = QPointF(anchor - origin) / zoom;
+    zoom = value;
+    origin = anchor - (pixel * zoom).toPoint();
+    update();
+}
+
+/**
+ * @brief Canvas::OnZoomIn - Zoom in on the middle of the view
+ *
+ */
+void Canvas::OnZoomIn()
+{
+    setZoom(zoom * 2, rect().center());
+}
+
+/**
+ * @brief Canvas::OnZoomOut - Zoom out from the middle of the view
+ *
+ */
+void Canvas::OnZoomOut()
+{
+    setZoom(zoom / 2, rect().center());
+}
+
+/**
+ * @brief Canvas::OnZoomReset - Show the image unzoomed in the top left
+ *
+ */
+void Canvas::OnZoomReset()
+{
+    zoom = 1;
+    origin = QPoint();
+    update();
+}
+
+/**
+ * @brief Canvas::wheelEvent - ctrl+wheel zooms around the cursor, the
+ *                             wheel alone pans
+ *
+ */
+void Canvas::wheelEvent(QWheelEvent *e)
+{
+    if(e->modifiers() & Qt::ControlModifier)
+    {
+        qreal steps = e->angleDelta().y() / 120.0;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+        setZoom(zoom * qPow(2, steps / 2), e->position().toPoint());
+#else
+        setZoom(zoom * qPow(2, steps / 2), e->pos());
+#endif
+    }
+    else
+    {
+        origin += e->angleDelta() / 2;
+        update();
+    }
 }
 
 /**
  * @brief Canvas::mousePressEvent - left-click initiates a draw
  *
+ *                                  - ctrl+left-click on a vector layer
+ *                                    selects the shape under the cursor
+ *                                    and starts dragging it
+ *
+ *                                  - with the select tool, left-click
+ *                                    inside the selection drags it,
+ *                                    elsewhere starts a new one
+ *
  *                                  - right-click opens a dialog
  *                                    menu for the current tool
  *
@@ -109,46 +395,138 @@ void Canvas::mousePressEvent(QMouseEvent *e)
         // open the dialog menu
         static_cast<MainWindow*>(parent())->mousePressEvent(e);
     }
+    else if(e->button() == Qt::MiddleButton)
+    {
+        // drag the view around
+        panning = true;
+        panFrom = e->pos();
+    }
     else if (e->button() == Qt::LeftButton)
     {
-        if(image->isNull())
+        // nothing is drawn on an image still being loaded
+        if(image->isNull() || loader->isLoading())
+            return;
+
+        VectorScene *scene = layers->currentLayer()->scene;
+        if(scene && e->modifiers() & Qt::ControlModifier)
+        {
+            QRect damage = selectionRect();
+            moveFrom = toImage(e->pos());
+            moveOffset = QPoint();
+            selectedShape = scene->shapeAt(moveFrom);
+            movingShape = selectedShape >= 0;
+            updateArea(damage | selectionRect());
+            return;
+        }
+
+        // pixels are selected and dragged on raster layers only
+        if(currentTool == selectTool)
+        {
+            if(scene)
+                return;
+
+            drawing = true;
+            pendingPoints.clear();
+            oldImage = *image;
+            QColor hole = layers->currentIndex() == 0 ? backgroundColor
+                                                      : QColor(Qt::transparent);
+            updateArea(selectTool->begin(toImage(e->pos()), e->modifiers(),
+                                         oldImage, hole));
             return;
+        }
 
         drawing = true;
 
         if(!drawingPoly) {
-            currentTool->setStartPoint(e->pos());
+            currentTool->setStartPoint(toImage(e->pos()));
         }
-
-        // save a copy of the old image
-        oldImage = image->copy(QRect());
+        dirtyRect = QRect();
+        pendingPoints.clear();
+
+        // start recording the stroke for undo/redo
+        stroke.points.clear();
+        currentTool->record(stroke);
+        stroke.points.append(currentTool->getStartPoint());
+
+        // keep a shallow copy of the old image, tiles are only
+        // copied once they are painted on
+        oldImage = *image;
+        currentTool->beginStroke(oldImage);
     }
 }
 
 /**
- * @brief Canvas::mouseMoveEvent - draw
+ * @brief Canvas::mouseMoveEvent - queue the point to draw to, drawing
+ *                                 happens on the next frame
  *
  */
 void Canvas::mouseMoveEvent(QMouseEvent *e)
 {
+    if(e->buttons() & Qt::MiddleButton && panning)
+    {
+        origin += e->pos() - panFrom;
+        panFrom = e->pos();
+        update();
+    }
+
+    if(e->buttons() & Qt::LeftButton && movingShape)
+    {
+        QRect damage = selectionRect();
+        moveOffset = toImage(e->pos()) - moveFrom;
+        updateArea(damage | selectionRect());
+    }
+
     if (e->buttons() & Qt::LeftButton && drawing)
     {
         if(image->isNull())
             return;
 
         ToolType type = currentTool->getType();
-        if(type == line || type == rect_tool)
+        if(type == render3d || type == fill_tool)
+            return;
+
+        if(type == line && currentLineMode == poly)
         {
-            *image = oldImage;
-            if(type == line && currentLineMode == poly)
-            {
-                drawingPoly = true;
-            }
-        }
-        if (type != render3d) {
-            currentTool->drawTo(e->pos(), this, image);
+            drawingPoly = true;
         }
+
+        pendingPoints.append(toImage(e->pos()));
+        if(!frameTimer->isActive())
+            frameTimer->start();
+    }
+}
+
+/**
+ * @brief Canvas::flushInput - draw the points queued since the last frame
+ *
+ */
+void Canvas::flushInput()
+{
+    frameTimer->stop();
+    if(pendingPoints.isEmpty())
+        return;
+
+    ToolType type = currentTool->getType();
+    if(type == select_tool)
+    {
+        // only the last position matters to an outline or a drag
+        updateArea(selectTool->dragTo(pendingPoints.last(), image));
+    }
+    else if(type == line || type == rect_tool)
+    {
+        // lines and shapes are only drawn into the preview until
+        // the mouse is released, and only keep their last end point
+        updatePreview(pendingPoints.last());
+        stroke.points.resize(1);
+        stroke.points.append(pendingPoints.last());
+    }
+    else
+    {
+        // a single polyline through every queued point
+        dirtyRect |= currentTool->drawTo(pendingPoints, this, image);
+        stroke.points += pendingPoints;
     }
+    pendingPoints.clear();
 }
 
 /**
@@ -157,31 +535,145 @@ void Canvas::mouseMoveEvent(QMouseEvent *e)
  */
 void Canvas::mouseReleaseEvent(QMouseEvent *e)
 {
+    if(e->button() == Qt::MiddleButton)
+        panning = false;
+
+    if(e->button() == Qt::LeftButton && movingShape)
+    {
+        movingShape = false;
+        if(moveOffset.isNull())
+            return;
+
+        // move the shape by taking it out and putting it back moved
+        VectorScene *scene = layers->currentLayer()->scene;
+        Stroke moved = scene->shape(selectedShape);
+        for(QPoint &point : moved.points)
+            point += moveOffset;
+
+        QMap<int, Stroke> removed;
+        QMap<int, Stroke> added;
+        removed.insert(selectedShape, scene->shape(selectedShape));
+        added.insert(selectedShape, moved);
+        updateArea(selectionRect());
+        moveOffset = QPoint();
+        changeShapes(removed, added);
+    }
+
     if (e->button() == Qt::LeftButton && drawing)
     {
+        QPoint pos = toImage(e->pos());
+
+        // draw what is still queued before finishing the stroke
+        flushInput();
         drawing = false;
 
         if(image->isNull())
             return;
 
-        if (drawing3d) {
-            oldImage=image->copy(QRect());
-            currentTool->drawTo(e->pos(), this, image);
+        // a dragged selection is drawn again smoothly, and undone
+        // as the pixels it changed
+        if(currentTool == selectTool)
+        {
+            QRect changed = selectTool->finish(image);
+            updateArea(changed | selectTool->selectionArea());
+            saveDrawCommand(oldImage, changed);
+            return;
         }
 
+        // the 3d render and the fill are only pixels, vector layers only
+        // keep shapes
+        VectorScene *scene = layers->currentLayer()->scene;
+        ToolType type = currentTool->getType();
+        const bool pixelsOnly = drawing3d || type == fill_tool;
+        if (pixelsOnly && !scene) {
+            oldImage = *image;
+            dirtyRect = currentTool->drawTo(pos, this, image);
+        }
+
+        // draw the previewed line or shape into the image once
+        if((type == line || type == rect_tool) && stroke.points.size() > 1)
+            dirtyRect = currentTool->drawTo(stroke.points.last(), this, image);
+        clearPreview();
+
         if(drawingPoly)
         {
-            currentTool->setStartPoint(e->pos());
+            currentTool->setStartPoint(pos);
             //return;
         }
         if(currentTool->getType() == pen)
-            currentTool->drawTo(e->pos(), this, image);
+        {
+            dirtyRect |= currentTool->drawTo(pos, this, image);
+            stroke.points.append(pos);
+        }
+        currentTool->endStroke();
+
+        // for undo/redo - the 3d render and the fill keep the tiles
+        // they changed, the other tools the stroke to replay, or on a
+        // vector layer the shape they drew. Only the area the tools
+        // reported as drawn is compared, nothing is saved if drawing
+        // began off-image
+        if(pixelsOnly)
+        {
+            if(!scene)
+                saveDrawCommand(oldImage, dirtyRect);
+        }
+        else if(!imagesEqual(oldImage, *image, dirtyRect))
+        {
+            if(scene)
+            {
+                // the tool already drew the new shape on top
+                QMap<int, Stroke> added;
+                added.insert(scene->add(stroke), stroke);
+                saveShapesCommand(QMap<int, Stroke>(), added);
+            }
+            else
+            {
+                saveStrokeCommand(oldImage);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Canvas::updatePreview - redraw the preview of the current tool
+ *                                drawing to endPoint, only the area of the
+ *                                old and new preview is repainted
+ *
+ */
+void Canvas::updatePreview(const QPoint &endPoint)
+{
+    QRect damage = previewRect;
+
+    previewRect = currentTool->bounds(endPoint).intersected(image->rect());
+    if(previewRect.isEmpty())
+    {
+        preview = QImage();
+    }
+    else
+    {
+        preview = QImage(previewRect.size(), QImage::Format_ARGB32_Premultiplied);
+        preview.fill(Qt::transparent);
 
-        // for undo/redo - make sure there was a change
-        // (in case drawing began off-image)
-        if(oldImage.toImage() != image->toImage())
-            saveDrawCommand(oldImage);
+        QPainter painter(&preview);
+        painter.translate(-previewRect.topLeft());
+        currentTool->paint(painter, endPoint);
     }
+
+    updateArea(damage | previewRect);
+}
+
+/**
+ * @brief Canvas::clearPreview - drop the preview
+ *
+ */
+void Canvas::clearPreview()
+{
+    if(preview.isNull())
+        return;
+
+    updateArea(previewRect);
+    preview = QImage();
+    previewRect = QRect();
 }
 
 /**
@@ -205,35 +697,14 @@ void Canvas::add_cube() {
 #endif
 
     widget->resize(100, 100);
-    vtkNew<vtkCubeSource> source;
-
-    vtkNew<vtkPolyDataMapper> mapper;
-    mapper->SetInputConnection(source->GetOutputPort());
-
-    vtkNew<vtkActor> actor;
-    actor->SetMapper(mapper);
-    //actor->GetProperty()->SetColor(colors->GetColor4d("Tomato").GetData());
-    actor->GetProperty()->SetColor(foregroundColor.red()/255.0,
-                                   foregroundColor.green()/255.0,
-                                   foregroundColor.blue()/255.0);
-
-    vtkNew<vtkRenderer> renderer;
-    renderer->AddActor(actor);
-    renderer->SetBackground(backgroundColor.red()/255.0,
-                            backgroundColor.green()/255.0,
-                            backgroundColor.blue()/255.0);
-#if VTK890
-    widget->renderWindow()->AddRenderer(renderer);
-    widget->renderWindow()->SetWindowName("RenderWindowNoUIFile");
-#else
-    widget->GetRenderWindow()->AddRenderer(renderer);
-    widget->GetRenderWindow()->SetWindowName("RenderWindowNoUIFile");
-
-#endif
+    RenderTool::addPrimitive(renderTool->renderWindow, cube_primitive,
+                             foregroundColor, backgroundColor);
     //
     grid->setVerticalSpacing(50);
     grid->setHorizontalSpacing(50);
 
+    primitives.append(RenderPrimitive{cube_primitive, foregroundColor, backgroundColor});
+
     grid->addWidget(widget,0,2);
     update();
 }
@@ -246,33 +717,14 @@ void Canvas::add_sphere(){
 #endif
 
     widget->resize(100, 100);
-    vtkNew<vtkSphereSource> sphereSource;
-
-    vtkNew<vtkPolyDataMapper> sphereMapper;
-    sphereMapper->SetInputConnection(sphereSource->GetOutputPort());
-
-    vtkNew<vtkActor> actor;
-    actor->SetMapper(sphereMapper);
-    actor->GetProperty()->SetColor(foregroundColor.red()/255.0,
-                                   foregroundColor.green()/255.0,
-                                   foregroundColor.blue()/255.0);
-
-    vtkNew<vtkRenderer> renderer;
-    renderer->AddActor(actor);
-    renderer->SetBackground(backgroundColor.red()/255.0,
-                            backgroundColor.green()/255.0,
-                            backgroundColor.blue()/255.0);
-#if VTK890
-    widget->renderWindow()->AddRenderer(renderer);
-    widget->renderWindow()->SetWindowName("RenderWindowNoUIFile");
-#else
-    widget->GetRenderWindow()->AddRenderer(renderer);
-    widget->GetRenderWindow()->SetWindowName("RenderWindowNoUIFile");
-#endif
+    RenderTool::addPrimitive(renderTool->renderWindow, sphere_primitive,
+                             foregroundColor, backgroundColor);
     //
     grid->setVerticalSpacing(50);
     grid->setHorizontalSpacing(50);
 
+    primitives.append(RenderPrimitive{sphere_primitive, foregroundColor, backgroundColor});
+
     grid->addWidget(widget,0,2);
     update();
 }
@@ -285,33 +737,14 @@ void Canvas::add_cylinder(){
 #endif
 
     widget->resize(100, 100);
-    vtkNew<vtkCylinderSource> source;
-    source->SetResolution(8);
-
-    vtkNew<vtkPolyDataMapper> mapper;
-    mapper->SetInputConnection(source->GetOutputPort());
-
-    vtkNew<vtkActor> actor;
-    actor->SetMapper(mapper);
-    actor->GetProperty()->SetColor(foregroundColor.red()/255.0,
-                                   foregroundColor.green()/255.0,
-                                   foregroundColor.blue()/255.0);
-    vtkNew<vtkRenderer> renderer;
-    renderer->AddActor(actor);
-    renderer->SetBackground(backgroundColor.red()/255.0,
-                            backgroundColor.green()/255.0,
-                            backgroundColor.blue()/255.0);
-#if VTK890
-    widget->renderWindow()->AddRenderer(renderer);
-    widget->renderWindow()->SetWindowName("RenderWindowNoUIFile");
-#else
-    widget->GetRenderWindow()->AddRenderer(renderer);
-    widget->GetRenderWindow()->SetWindowName("RenderWindowNoUIFile");
-#endif
+    RenderTool::addPrimitive(renderTool->renderWindow, cylinder_primitive,
+                             foregroundColor, backgroundColor);
     //
     grid->setVerticalSpacing(50);
     grid->setHorizontalSpacing(50);
 
+    primitives.append(RenderPrimitive{cylinder_primitive, foregroundColor, backgroundColor});
+
     grid->addWidget(widget,0,2);
     update();
 }
@@ -322,11 +755,12 @@ void Canvas::add_cylinder(){
  */
 void Canvas::OnUndo()
 {
+    stopLoading();
     if(!undoStack->canUndo())
         return;
 
-    undoStack->undo();
-    update();
+    markDirty(undoStack->undo());
+    currentLayerChanged();
 }
 
 /**
@@ -335,11 +769,12 @@ void Canvas::OnUndo()
  */
 void Canvas::OnRedo()
 {
+    stopLoading();
     if(!undoStack->canRedo())
         return;
 
-    undoStack->redo();
-    update();
+    markDirty(undoStack->redo());
+    currentLayerChanged();
 }
 
 /**
@@ -516,6 +951,39 @@ void Canvas::OnRectLineConfig(int value)
     rectTool->setWidth(value);
 }
 
+/**
+ * @brief Canvas::OnFillToleranceConfig - Update how far colors may be from
+ *                                        the clicked one to be filled
+ *
+ */
+void Canvas::OnFillToleranceConfig(int value)
+{
+    fillTool->setTolerance(qBound(MIN_FILL_TOLERANCE, value, MAX_FILL_TOLERANCE));
+}
+
+/**
+ * @brief Canvas::OnSelectModeConfig - Update whether a rectangle or a
+ *                                     freeform outline is selected
+ *
+ */
+void Canvas::OnSelectModeConfig(int mode)
+{
+    selectTool->setMode(mode == free_select ? free_select : rect_select);
+}
+
+/**
+ * @brief Canvas::OnDeselect - Drop the selection, leaving the pixels
+ *                             where they were moved to
+ *
+ */
+void Canvas::OnDeselect()
+{
+    if(drawing && currentTool == selectTool)
+        return;
+
+    updateArea(selectTool->clear());
+}
+
 /**
  * @brief Canvas::OnRectCurveConfig - Update rounded rectangle curve
  *
@@ -527,82 +995,638 @@ void Canvas::OnRectCurveConfig(int value)
 
 /**
  * @brief Canvas::createNewImage - creates a new image of
- *                                   user-specified dimensions
+ *                                   user-specified dimensions, with a
+ *                                   single layer
  *
  */
 void Canvas::createNewImage()
 {
-    // save a copy of the old image
-    oldImage = image->copy();
-    *image = QPixmap(this->size());
-    image->fill(backgroundColor);
-    update();
+    // save the old layers
+    LayerStack::State before = layers->state();
+    layers->reset(TiledImage(this->size(), backgroundColor));
+    currentLayerChanged();
+    project->close();
 
     // for undo/redo
-    if(!imagesEqual(oldImage, *image))
-        saveDrawCommand(oldImage);
+    saveLayersCommand(before);
 }
 
 /**
  * @brief Canvas::loadImage - Load an image from a user-specified file
+ *                              into a single layer. The file is read in
+ *                              the background and the layer fills in as
+ *                              it is, see OnLoadStarted.
  *
  */
 void Canvas::loadImage(const QString &fileName)
 {
-    // save a copy of the old image
-    oldImage = image->copy();
+    project->close();
+    loader->load(fileName, backgroundColor);
+}
 
-    image->load(fileName);
-    update();
+/**
+ * @brief Canvas::stopLoading - Cancel the image being loaded, what was
+ *                                loaded of it stays
+ *
+ */
+void Canvas::stopLoading()
+{
+    if(!loader->isLoading())
+        return;
+
+    loader->cancel();
+    loadingLayer = 0;
+    emit imageLoadCancelled();
+}
+
+/**
+ * @brief Canvas::OnLoadStarted - Replace the layers with a single empty
+ *                                  one the size of the image being loaded,
+ *                                  recorded for undo/redo right away so
+ *                                  the layer is owned by the undo stack
+ *                                  while it fills in
+ *
+ */
+void Canvas::OnLoadStarted(const QSize &size, QImage::Format format)
+{
+    // save the old layers
+    LayerStack::State before = layers->state();
+
+    TiledImage loading;
+    loading.reset(size, backgroundColor, format);
+    layers->reset(loading);
+    loadingLayer = layers->layer(0);
+    currentLayerChanged();
 
     // for undo/redo
-    if(!imagesEqual(oldImage, *image))
-        saveDrawCommand(oldImage);
+    undoStack->push(new LayersCommand(before, layers));
+    autosave->markAllDirty();
 }
 
 /**
- * @brief Canvas::saveImage - Save an image to user-specified file
+ * @brief Canvas::OnStripsLoaded - Put the strips read since the last time
+ *                                   into the layer being loaded
  *
  */
-void Canvas::saveImage(const QString &fileName)
+void Canvas::OnStripsLoaded()
 {
-    image->save(fileName, "BMP");
+    QVector<ImageLoader::Strip> strips = loader->takeStrips();
+    if(!loadingLayer)
+        return;
+
+    TiledImage &loading = loadingLayer->image;
+    for(const ImageLoader::Strip &strip : strips)
+    {
+        for(int column = 0; column < strip.tiles.size(); ++column)
+            loading.setTile(column, strip.row, strip.tiles.at(column));
+        updateArea(QRect(0, strip.row * TILE_SIZE, loading.width(), TILE_SIZE)
+                       .intersected(loading.rect()));
+    }
 }
 
 /**
- * @brief Canvas::resizeImage - Resize image to user-specified dimensions
+ * @brief Canvas::OnLoadEnded - The image is loaded or couldn't be
  *
  */
-void Canvas::resizeImage()
+void Canvas::OnLoadEnded()
 {
-    // save a copy of the old image
-    oldImage = image->copy();
+    loadingLayer = 0;
+    autosave->markAllDirty();
+}
 
+/**
+ * @brief Canvas::OnAutosave - Checkpoint the changes since the last time
+ *                               to the autosave journal, in the background
+ *
+ */
+void Canvas::OnAutosave()
+{
+    if(drawing || loader->isLoading())
+        return;
 
-    // else re-scale the image
-    *image = image->scaled(this->size(), Qt::IgnoreAspectRatio);
-    update();
+    autosave->checkpoint(*layers);
+}
+
+/**
+ * @brief Canvas::restoreAutosave - Replace the layers with the ones in the
+ *                                    autosave journal a crashed session
+ *                                    left behind
+ *
+ */
+bool Canvas::restoreAutosave(const QString &journal)
+{
+    // save the old layers
+    LayerStack::State before = layers->state();
+    if(!autosave->restore(journal, layers))
+        return false;
+    currentLayerChanged();
+
+    // for undo/redo
+    saveLayersCommand(before);
+    return true;
+}
+
+/**
+ * @brief Canvas::saveImage - Save the flattened layers to
+ *                              user-specified file in the background,
+ *                              imageSaved or imageSaveFailed tell once
+ *                              it's written
+ *
+ */
+void Canvas::saveImage(const QString &fileName, ImageFormat format,
+                       int compression)
+{
+    if(layers->isNull())
+        return;
+
+    // the composite tiles are shared with the layer caches, so the
+    // snapshot is cheap and later drawing copies the tiles it touches
+    const TiledImage &base = layers->layer(0)->image;
+    QVector<QImage> tiles = layers->compositeTiles(QRect(0, 0, base.columns(),
+                                                         base.rows()));
+    saver->save(tiles, base.size(), base.format() == QImage::Format_RGB32,
+                fileName, format, compression);
+}
+
+/**
+ * @brief Canvas::saveProject - Save the layers, the tool settings and the
+ *                                3D primitives to a project file, only
+ *                                what changed since the last save when it
+ *                                is the same file
+ *
+ */
+bool Canvas::saveProject(const QString &fileName, QString *error)
+{
+    if(layers->isNull())
+        return false;
+
+    // what's loaded of an image being loaded is saved
+    stopLoading();
+    return project->save(fileName, *layers, documentSettings(), error);
+}
+
+/**
+ * @brief Canvas::openProject - Replace the layers and settings with the
+ *                                ones of a project file
+ *
+ */
+bool Canvas::openProject(const QString &fileName, QString *error)
+{
+    stopLoading();
+
+    // save the old layers
+    LayerStack::State before = layers->state();
+
+    QByteArray settings;
+    if(!project->open(fileName, layers, &settings, error))
+        return false;
+    setDocumentSettings(settings);
+    currentLayerChanged();
+
+    // for undo/redo
+    saveLayersCommand(before);
+    return true;
+}
+
+/**
+ * @brief Canvas::documentSettings - The colors, tool settings and 3D
+ *                                     primitives saved with a project
+ *
+ */
+QByteArray Canvas::documentSettings() const
+{
+    QByteArray settings;
+    QDataStream out(&settings, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+
+    Stroke rect;
+    rectTool->record(rect);
+    out << foregroundColor << backgroundColor
+        << qint32(currentTool->getType()) << qint32(currentLineMode)
+        << QPen(*penTool) << QPen(*lineTool) << QPen(*eraserTool)
+        << QPen(*rectTool) << qint32(rect.shapeType) << rect.fillColor
+        << qint32(rect.fillMode) << qint32(rect.roundedCurve)
+        << qint32(fillTool->getTolerance()) << qint32(selectTool->getMode());
+
+    out << qint32(primitives.size());
+    for(const RenderPrimitive &primitive : primitives)
+        out << qint32(primitive.type) << primitive.color << primitive.background;
+    return settings;
+}
+
+/**
+ * @brief Canvas::setDocumentSettings - Go back to the colors, tool settings
+ *                                        and 3D primitives of a project,
+ *                                        settings it doesn't have are
+ *                                        left as they are
+ *
+ */
+void Canvas::setDocumentSettings(const QByteArray &settings)
+{
+    QDataStream in(settings);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    QColor foreground, background;
+    qint32 tool, lineMode, shapeType, fillMode, curve, tolerance, selectMode;
+    QPen pen, line, eraser, rect;
+    QColor rectFill;
+    in >> foreground >> background >> tool >> lineMode >> pen >> line >> eraser
+       >> rect >> shapeType >> rectFill >> fillMode >> curve >> tolerance
+       >> selectMode;
+    if(in.status() != QDataStream::Ok)
+        return;
+
+    static_cast<QPen&>(*penTool) = pen;
+    static_cast<QPen&>(*lineTool) = line;
+    static_cast<QPen&>(*eraserTool) = eraser;
+    static_cast<QPen&>(*rectTool) = rect;
+    rectTool->setShapeType(ShapeType(shapeType));
+    rectTool->setFillMode(FillColor(fillMode));
+    rectTool->setFillColor(rectFill);
+    rectTool->setCurve(curve);
+    fillTool->setTolerance(tolerance);
+    selectTool->setMode(SelectMode(selectMode));
+    setLineMode(DrawType(lineMode));
+
+    // the primitives are added again in their own colors
+    qint32 count = 0;
+    in >> count;
+    QVector<RenderPrimitive> saved;
+    for(int i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+    {
+        qint32 type;
+        RenderPrimitive primitive;
+        in >> type >> primitive.color >> primitive.background;
+        primitive.type = PrimitiveType(type);
+        saved.append(primitive);
+    }
+    if(in.status() == QDataStream::Ok)
+    {
+        clearPrimitives();
+        for(const RenderPrimitive &primitive : saved)
+        {
+            foregroundColor = primitive.color;
+            backgroundColor = primitive.background;
+            if(primitive.type == cube_primitive)
+                add_cube();
+            else if(primitive.type == sphere_primitive)
+                add_sphere();
+            else
+                add_cylinder();
+        }
+    }
+
+    foregroundColor = foreground;
+    backgroundColor = background;
+    setCurrentTool(tool);
+}
+
+/**
+ * @brief Canvas::clearPrimitives - Take every 3D primitive out of the
+ *                                    render window
+ *
+ */
+void Canvas::clearPrimitives()
+{
+    vtkRendererCollection *renderers = renderTool->renderWindow->GetRenderers();
+    while(renderers->GetNumberOfItems() > 0)
+        renderTool->renderWindow->RemoveRenderer(renderers->GetFirstRenderer());
+    primitives.clear();
+}
+
+/**
+ * @brief Canvas::resizeImage - Resize every layer to user-specified
+ *                                dimensions, the raster layers resampled
+ *                                with filter on another thread while a
+ *                                progress dialog is up
+ *
+ */
+void Canvas::resizeImage(const QSize &size, ResampleFilter filter)
+{
+    if(size == image->size())
+        return;
+
+    // strips still loading would land in the layer after it was copied
+    // and be lost when the scaled copies replace it
+    stopLoading();
+
+    QVector<TiledImage> images;
+    int steps = 0;
+    for(int i = 0; i < layers->count(); ++i)
+    {
+        const Layer *layer = layers->layer(i);
+        images.append(layer->isVector() ? TiledImage() : layer->image);
+        if(!layer->isVector())
+            steps += resampleSteps(layer->image.size(), size);
+    }
+
+    // the thread only reads shallow copies of the layers, the modal
+    // dialog keeps them from being drawn on meanwhile
+    ResizeThread thread(images, size, filter);
+    QProgressDialog progress(tr("Resizing the image..."), QString(), 0, steps, this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(0);
+    progress.setValue(0);
+
+    QEventLoop loop;
+    QTimer poll;
+    connect(&thread, SIGNAL(finished()), &loop, SLOT(quit()));
+    connect(&poll, &QTimer::timeout,
+            [&]() { progress.setValue(thread.progress.loadAcquire()); });
+    poll.start(INPUT_FRAME_INTERVAL);
+    thread.start();
+    loop.exec();
+    thread.wait();
+
+    // save the old layers
+    LayerStack::State before = layers->state();
+
+    // swap in the resampled layers
+    layers->scaled(size, thread.images);
+    currentLayerChanged();
 
     // for undo/redo
-    saveDrawCommand(oldImage);
+    saveLayersCommand(before);
 }
 
 /**
- * @brief Canvas::clearImage - clears an image by filling it with
- *                               the background color
+ * @brief Canvas::clearImage - clears the current layer by filling it with
+ *                               the background color, layers above the
+ *                               bottom one are cleared to transparent and
+ *                               vector layers lose their shapes
  *
  */
 void Canvas::clearImage()
 {
+    // a vector layer is cleared by removing its shapes
+    VectorScene *scene = layers->currentLayer()->scene;
+    if(scene)
+    {
+        QMap<int, Stroke> removed;
+        for(int id : scene->shapesIn(image->rect()))
+            removed.insert(id, scene->shape(id));
+        changeShapes(removed, QMap<int, Stroke>());
+        return;
+    }
+
+    // the cleared pixels can't be moved anymore
+    updateArea(selectTool->clear());
+
     // save a copy of the old image
-    oldImage = image->copy();
+    oldImage = *image;
 
-    image->fill(backgroundColor);
-    update(image->rect());
+    if(layers->currentIndex() == 0)
+        image->fill(backgroundColor);
+    else
+        image->fill(Qt::transparent);
+    updateArea(image->rect());
 
-    // for undo/redo
-    if(!imagesEqual(oldImage, *image))
-        saveDrawCommand(oldImage);
+    // for undo/redo, only saved if something changed
+    saveDrawCommand(oldImage, image->rect());
+}
+
+/**
+ * @brief Canvas::filterImage - run a filter over the current layer, undone
+ *                              as the tiles it changed. Vector layers are
+ *                              drawn from their shapes and aren't filtered.
+ *
+ */
+void Canvas::filterImage(const Filter &filter)
+{
+    if(image->isNull() || layers->currentLayer()->isVector())
+        return;
+
+    // the filtered pixels can't be moved anymore
+    updateArea(selectTool->clear());
+
+    oldImage = *image;
+    QRect changed = applyFilter(image, image->rect(), filter);
+    updateArea(changed);
+
+    // for undo/redo, only saved if something changed
+    saveDrawCommand(oldImage, changed);
+}
+
+/**
+ * @brief Canvas::OnAddLayer - Add a transparent layer above the current one
+ *
+ */
+void Canvas::OnAddLayer()
+{
+    if(image->isNull())
+        return;
+
+    LayerStack::State before = layers->state();
+    layers->insert(layers->currentIndex() + 1,
+                   QString("Layer %1").arg(layers->count()));
+    currentLayerChanged();
+    saveLayersCommand(before);
+}
+
+/**
+ * @brief Canvas::OnAddVectorLayer - Add a layer keeping the shapes drawn
+ *                                   on it above the current one
+ *
+ */
+void Canvas::OnAddVectorLayer()
+{
+    if(image->isNull())
+        return;
+
+    LayerStack::State before = layers->state();
+    layers->insert(layers->currentIndex() + 1,
+                   QString("Vector %1").arg(layers->count()), true);
+    currentLayerChanged();
+    saveLayersCommand(before);
+}
+
+/**
+ * @brief Canvas::OnRemoveLayer - Remove the current layer, unless it is
+ *                                the only one
+ *
+ */
+void Canvas::OnRemoveLayer()
+{
+    LayerStack::State before = layers->state();
+    if(!layers->take(layers->currentIndex()))
+        return;
+
+    currentLayerChanged();
+    saveLayersCommand(before);
+}
+
+/**
+ * @brief Canvas::OnRaiseLayer - Move the current layer up the stack
+ *
+ */
+void Canvas::OnRaiseLayer()
+{
+    int index = layers->currentIndex();
+    if(index == layers->count() - 1)
+        return;
+
+    LayerStack::State before = layers->state();
+    layers->move(index, index + 1);
+    update();
+    saveLayersCommand(before);
+}
+
+/**
+ * @brief Canvas::OnLowerLayer - Move the current layer down the stack
+ *
+ */
+void Canvas::OnLowerLayer()
+{
+    int index = layers->currentIndex();
+    if(index == 0)
+        return;
+
+    LayerStack::State before = layers->state();
+    layers->move(index, index - 1);
+    update();
+    saveLayersCommand(before);
+}
+
+/**
+ * @brief Canvas::OnLayerAbove - Draw on the layer above the current one
+ *
+ */
+void Canvas::OnLayerAbove()
+{
+    layers->setCurrentIndex(layers->currentIndex() + 1);
+    currentLayerChanged();
+}
+
+/**
+ * @brief Canvas::OnLayerBelow - Draw on the layer below the current one
+ *
+ */
+void Canvas::OnLayerBelow()
+{
+    layers->setCurrentIndex(layers->currentIndex() - 1);
+    currentLayerChanged();
+}
+
+/**
+ * @brief Canvas::OnToggleLayer - Show or hide the current layer
+ *
+ */
+void Canvas::OnToggleLayer()
+{
+    LayerStyle style = layers->currentLayer()->style;
+    style.visible = !style.visible;
+    setLayerStyle(style);
+}
+
+/**
+ * @brief Canvas::OnLayerOpacityConfig - Update the current layer's opacity,
+ *                                       in percent
+ *
+ */
+void Canvas::OnLayerOpacityConfig(int value)
+{
+    LayerStyle style = layers->currentLayer()->style;
+    style.opacity = qBound(0, value, 100) / 100.0;
+    setLayerStyle(style);
+}
+
+/**
+ * @brief Canvas::OnLayerBlendConfig - Update the current layer's blend mode
+ *
+ */
+void Canvas::OnLayerBlendConfig(int blendMode)
+{
+    LayerStyle style = layers->currentLayer()->style;
+    switch (blendMode)
+    {
+        case normal_blend: style.blend = QPainter::CompositionMode_SourceOver;     break;
+        case multiply_blend: style.blend = QPainter::CompositionMode_Multiply;     break;
+        case screen_blend: style.blend = QPainter::CompositionMode_Screen;         break;
+        case overlay_blend: style.blend = QPainter::CompositionMode_Overlay;       break;
+        case darken_blend: style.blend = QPainter::CompositionMode_Darken;         break;
+        case lighten_blend: style.blend = QPainter::CompositionMode_Lighten;       break;
+        case difference_blend: style.blend = QPainter::CompositionMode_Difference; break;
+        default:                                                                   break;
+    }
+    setLayerStyle(style);
+}
+
+/**
+ * @brief Canvas::setLayerStyle - change the current layer's style, undoably
+ *
+ */
+void Canvas::setLayerStyle(const LayerStyle &style)
+{
+    LayerStack::State before = layers->state();
+    layers->setStyle(layers->currentIndex(), style);
+    update();
+    saveLayersCommand(before);
+}
+
+/**
+ * @brief Canvas::currentLayerChanged - point the tools at the current
+ *                                      layer after the layers changed
+ *
+ */
+void Canvas::currentLayerChanged()
+{
+    image = &layers->currentLayer()->image;
+    selectedShape = -1;
+    movingShape = false;
+    selectTool->clear();
+    update();
+}
+
+/**
+ * @brief Canvas::OnDeleteShape - Remove the selected shape
+ *
+ */
+void Canvas::OnDeleteShape()
+{
+    if(selectionRect().isEmpty())
+        return;
+
+    QMap<int, Stroke> removed;
+    removed.insert(selectedShape,
+                   layers->currentLayer()->scene->shape(selectedShape));
+    changeShapes(removed, QMap<int, Stroke>());
+    selectedShape = -1;
+}
+
+/**
+ * @brief Canvas::changeShapes - take shapes out of the current vector layer
+ *                               and put others in, undoably. Only the area
+ *                               they cover is drawn again.
+ *
+ */
+void Canvas::changeShapes(const QMap<int, Stroke> &removed,
+                          const QMap<int, Stroke> &added)
+{
+    QRect damage = selectionRect();
+    for(const Stroke &shape : removed.values() + added.values())
+        damage |= strokeArea(shape);
+
+    ShapesCommand *command = new ShapesCommand(layers->currentLayer()->scene,
+                                               image, removed, added);
+    command->redo();
+    markDirty(command);
+    undoStack->push(command);
+    updateArea(damage | selectionRect());
+}
+
+/**
+ * @brief Canvas::selectionRect - the area of the selected shape, moved by
+ *                                how far it is dragged, empty if there is
+ *                                no selection
+ *
+ */
+QRect Canvas::selectionRect() const
+{
+    const VectorScene *scene = layers->currentLayer()->scene;
+    if(!scene || !scene->contains(selectedShape))
+        return QRect();
+
+    return scene->bounds(selectedShape).translated(moveOffset);
 }
 
 /**
@@ -618,6 +1642,7 @@ void Canvas::updateColorConfig(const QColor &color, int which)
          penTool->setColor(foregroundColor);
          lineTool->setColor(foregroundColor);
          rectTool->setColor(foregroundColor);
+         fillTool->setColor(foregroundColor);
 
          if(rectTool->getFillMode() == foreground)
              rectTool->setFillColor(foregroundColor);
@@ -648,6 +1673,8 @@ Tool* Canvas::setCurrentTool(int newType)
 
     if(currType == line)
         drawingPoly = false;
+    if(currType == select_tool)
+        updateArea(selectTool->clear());
 
     switch(newType)
     {
@@ -655,13 +1682,15 @@ Tool* Canvas::setCurrentTool(int newType)
     case line: currentTool = lineTool;      break;
     case eraser: currentTool = eraserTool;  break;
     case rect_tool: currentTool = rectTool; break;
+    case fill_tool: currentTool = fillTool; break;
+    case select_tool: currentTool = selectTool; break;
     case render3d: {
-        drawing3d=true;
         currentTool = renderTool; break;
 
     }
     default:                                break;
     }
+    drawing3d = currentTool->getType() == render3d;
     return currentTool;
 }
 
@@ -683,13 +1712,96 @@ void Canvas::setLineMode(const DrawType mode)
  *                                  and save it on the undo/redo stack.
  *
  */
-void Canvas::saveDrawCommand(const QPixmap &old_image)
+void Canvas::saveDrawCommand(const TiledImage &old_image, const QRect &area)
 {
-    // put the old and new image on the stack for undo/redo
-    QUndoCommand *drawCommand = new DrawCommand(old_image, image);
+    // any other change ends the load in progress
+    stopLoading();
+
+    // put the changed tiles of the old and new image on the stack
+    // for undo/redo
+    DrawCommand *drawCommand = new DrawCommand(old_image, image, area);
+    if(drawCommand->isEmpty())
+    {
+        delete drawCommand;
+        return;
+    }
+
+    // an image refilled or resized changes what the tiles are drawn over
+    // too, the command knows whether it was
+    markDirty(drawCommand);
     undoStack->push(drawCommand);
 }
 
+/**
+ * @brief Canvas::saveStrokeCommand - Put together a StrokeCommand from the
+ *                                    stroke recorded since the mouse was
+ *                                    pressed and save it on the undo/redo
+ *                                    stack.
+ *
+ */
+void Canvas::saveStrokeCommand(const TiledImage &old_image)
+{
+    stopLoading();
+    StrokeCommand *command = new StrokeCommand(old_image, stroke, image);
+    markDirty(command);
+    undoStack->push(command);
+}
+
+/**
+ * @brief Canvas::markDirty - note what a command done, undone or redone
+ *                            changed, for the next autosave checkpoint:
+ *                            the tiles it painted on, the layer records
+ *                            too if it changed shapes, everything if it
+ *                            changed the layers themselves
+ *
+ */
+void Canvas::markDirty(const CanvasCommand *command)
+{
+    TiledImage *changed = command ? command->changedImage() : 0;
+    for(int i = 0; changed && i < layers->count(); ++i)
+    {
+        if(&layers->layer(i)->image != changed)
+            continue;
+
+        if(command->changesShapes())
+            autosave->markDocumentDirty();
+        autosave->markDirty(i, changed->tilesIn(command->changedArea()));
+        return;
+    }
+    autosave->markAllDirty();
+}
+
+/**
+ * @brief Canvas::saveLayersCommand - Put together a LayersCommand from the
+ *                                    layers before a change and save it on
+ *                                    the undo/redo stack. The command owns
+ *                                    the layers taken out of the stack.
+ *
+ */
+void Canvas::saveLayersCommand(const LayerStack::State &before)
+{
+    stopLoading();
+    autosave->markAllDirty();
+    undoStack->push(new LayersCommand(before, layers));
+}
+
+/**
+ * @brief Canvas::saveShapesCommand - Put together a ShapesCommand from the
+ *                                    shapes taken out of and put into the
+ *                                    current vector layer and save it on
+ *                                    the undo/redo stack.
+ *
+ */
+void Canvas::saveShapesCommand(const QMap<int, Stroke> &removed,
+                               const QMap<int, Stroke> &added)
+{
+    stopLoading();
+    ShapesCommand *command = new ShapesCommand(layers->currentLayer()->scene,
+                                               image, removed, added);
+    markDirty(command);
+    undoStack->push(command);
+}
+
 /**
  * @brief Canvas::createTools - takes care of creating the tools
  *
@@ -702,16 +1814,28 @@ void Canvas::createTools()
     eraserTool = new EraserTool(QBrush(Qt::white), DEFAULT_ERASER_THICKNESS);
     rectTool = new RectTool(QBrush(Qt::black), DEFAULT_PEN_THICKNESS);
     renderTool = new RenderTool();
+    fillTool = new FillTool(QBrush(Qt::black));
+    selectTool = new SelectTool();
 
     // set default tool
     currentTool = static_cast<Tool*>(penTool);
 }
 
 /**
- * @brief imagesEqual - returns true if the two images are the same
+ * @brief imagesEqual - returns true if the two images are the same within
+ *                      area, tiles the images still share are not compared
  *
  */
-bool imagesEqual(const QPixmap &image1, const QPixmap &image2)
+bool imagesEqual(const TiledImage &image1, const TiledImage &image2,
+                 const QRect &area)
 {
-    return image1.toImage() == image2.toImage();
+    if(image1.size() != image2.size())
+        return false;
+
+    QRect tiles = image1.tilesIn(area);
+    for(int row = tiles.top(); row <= tiles.bottom(); ++row)
+        for(int column = tiles.left(); column <= tiles.right(); ++column)
+            if(!image1.tileEquals(image2, column, row))
+                return false;
+    return true;
 }
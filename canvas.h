@@ -1,12 +1,21 @@
 #ifndef CANVAS_H
 #define CANVAS_H
 
-#include <QUndoStack>
 #include <QSlider>
 #include <QGridLayout>
+#include <QTimer>
 
+#include "autosave_journal.h"
 #include "constants.h"
+#include "filters.h"
+#include "image_loader.h"
+#include "image_saver.h"
+#include "layer_stack.h"
+#include "mip_pyramid.h"
+#include "project_file.h"
+#include "tiled_image.h"
 #include "tool.h"
+#include "undo_stack.h"
 
 #include <vtkActor.h>
 #include <vtkGenericOpenGLRenderWindow.h>
@@ -23,6 +32,14 @@
 #include <QDebug>
 #include <vtkWindowToImageFilter.h>
 
+/** a 3D primitive added to the render window, kept to add it again */
+struct RenderPrimitive
+{
+    PrimitiveType type;
+    QColor color;
+    QColor background;
+};
+
 class Canvas : public QWidget
 {
     Q_OBJECT
@@ -40,7 +57,10 @@ public:
     LineTool* get_line() { return lineTool; }
     EraserTool* get_eraser() { return eraserTool; }
     RectTool* get_rect() { return rectTool; }
-    QPixmap* getImage() { return image; }
+    FillTool* get_fill() { return fillTool; }
+    SelectTool* get_select() { return selectTool; }
+    TiledImage* getImage() { return image; }
+    LayerStack* getLayers() { return layers; }
     Tool* getCurrentTool() const { return currentTool; }
     QColor getForegroundColor() { return foregroundColor; }
     QColor getBackgroundColor() { return backgroundColor; }
@@ -50,12 +70,34 @@ public:
 
     void createNewImage();
     void loadImage(const QString&);
-    void saveImage(const QString&);
-    void resizeImage();
+    void saveImage(const QString&, ImageFormat, int compression);
+    bool saveProject(const QString&, QString *error);
+    bool openProject(const QString&, QString *error);
+    QString projectFileName() const { return project->fileName(); }
+    bool restoreAutosave(const QString &journal);
+    void resizeImage(const QSize&, ResampleFilter);
     void clearImage();
+    void filterImage(const Filter&);
     void updateColorConfig(const QColor&, int);
 
-    void saveDrawCommand(const QPixmap&);
+    void saveDrawCommand(const TiledImage&, const QRect&);
+    void saveStrokeCommand(const TiledImage&);
+    void saveLayersCommand(const LayerStack::State&);
+    void saveShapesCommand(const QMap<int, Stroke> &removed,
+                           const QMap<int, Stroke> &added);
+
+    void updateArea(const QRect&);
+    QPoint toImage(const QPoint&) const;
+    QRect toWidget(const QRect&) const;
+    QRect toImage(const QRect&) const;
+
+signals:
+    void imageSaved(const QString &fileName);
+    void imageSaveFailed(const QString &fileName, const QString &error);
+    void imageLoadProgress(int done, int total);
+    void imageLoaded(const QString &fileName);
+    void imageLoadFailed(const QString &fileName, const QString &error);
+    void imageLoadCancelled();
 
 public slots:
 
@@ -75,6 +117,23 @@ public slots:
     void OnRectBTypeConfig(int);
     void OnRectLineConfig(int);
     void OnRectCurveConfig(int);
+    void OnFillToleranceConfig(int);
+    void OnSelectModeConfig(int);
+    void OnDeselect();
+    void OnAddLayer();
+    void OnAddVectorLayer();
+    void OnRemoveLayer();
+    void OnRaiseLayer();
+    void OnLowerLayer();
+    void OnLayerAbove();
+    void OnLayerBelow();
+    void OnToggleLayer();
+    void OnLayerOpacityConfig(int);
+    void OnLayerBlendConfig(int);
+    void OnDeleteShape();
+    void OnZoomIn();
+    void OnZoomOut();
+    void OnZoomReset();
     void add_cube();
     void add_sphere();
     void add_cylinder();
@@ -84,18 +143,74 @@ protected:
     void virtual mouseMoveEvent(QMouseEvent *event) override;
     void virtual mouseReleaseEvent(QMouseEvent *event) override;
     void virtual mouseDoubleClickEvent(QMouseEvent *event) override;
+    void virtual wheelEvent(QWheelEvent *event) override;
 
     void virtual paintEvent(QPaintEvent *event) override;
 
+private slots:
+    void flushInput();
+    void OnLoadStarted(const QSize&, QImage::Format);
+    void OnStripsLoaded();
+    void OnLoadEnded();
+    void OnAutosave();
+
 private:
     void createTools();
-    QUndoStack* undoStack;
+    void updatePreview(const QPoint&);
+    void clearPreview();
+    void setLayerStyle(const LayerStyle&);
+    void currentLayerChanged();
+    void setZoom(qreal, const QPoint&);
+    void stopLoading();
+    void markDirty(const CanvasCommand*);
+    QByteArray documentSettings() const;
+    void setDocumentSettings(const QByteArray&);
+    void clearPrimitives();
+    void changeShapes(const QMap<int, Stroke> &removed,
+                      const QMap<int, Stroke> &added);
+    QRect selectionRect() const;
+    UndoStack* undoStack;
+    ImageSaver* saver;
+    ImageLoader* loader;
+    ProjectFile* project;
+    AutosaveJournal* autosave;
+    QTimer* autosaveTimer;
+
+    /** the layer the image being loaded fills in, 0 if none is */
+    Layer* loadingLayer;
 
     Tool* currentTool;
     DrawType currentLineMode;
 
-    QPixmap* image;
-    QPixmap oldImage;
+    /** the layers, image is the current layer's image the tools draw on */
+    LayerStack* layers;
+    TiledImage* image;
+    TiledImage oldImage;
+
+    /** the view: image pixels are zoom widget pixels wide and the
+        image's top left corner is at origin */
+    MipPyramid* pyramid;
+    qreal zoom;
+    QPoint origin;
+    bool panning;
+    QPoint panFrom;
+    Stroke stroke;
+    QRect dirtyRect;
+
+    /** mouse positions queued since the last frame, drawn at once */
+    QVector<QPoint> pendingPoints;
+    QTimer* frameTimer;
+
+    /** line and shape being dragged, drawn on top of the image */
+    QImage preview;
+    QRect previewRect;
+
+    /** the shape of the current vector layer picked with ctrl+click, -1
+        if none, and how far it has been dragged */
+    int selectedShape;
+    bool movingShape;
+    QPoint moveFrom;
+    QPoint moveOffset;
 
     QColor foregroundColor;
     QColor backgroundColor;
@@ -105,6 +220,11 @@ private:
     EraserTool* eraserTool;
     RectTool* rectTool;
     RenderTool* renderTool;
+    FillTool* fillTool;
+    SelectTool* selectTool;
+
+    /** the 3D primitives in the render window, oldest first */
+    QVector<RenderPrimitive> primitives;
 
     bool drawing;
     bool drawingPoly;
@@ -114,6 +234,7 @@ private:
     Canvas& operator=(const Canvas&);
 };
 
-extern bool imagesEqual(const QPixmap& image1, const QPixmap& image2);
+extern bool imagesEqual(const TiledImage& image1, const TiledImage& image2,
+                        const QRect& area);
 
 #endif // CANVAS_H
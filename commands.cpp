@@ -1,18 +1,123 @@
 #include "commands.h"
-#include "qrect.h"
+#include "constants.h"
 
 
 /**
- * @brief DrawCommand::DrawCommand - A command that keeps a copy of the image
- *                                   before and after something is drawn
+ * @brief DrawCommand::DrawCommand - A command that keeps a compressed copy
+ *                                   of the tiles within area that changed
+ *                                   while something was drawn. If the image
+ *                                   was resized, refilled or changed format
+ *                                   the whole image is kept instead.
  */
-DrawCommand::DrawCommand(const QPixmap &oldImage, QPixmap *image,
-                               QUndoCommand *parent)
-    : QUndoCommand(parent)
+DrawCommand::DrawCommand(const TiledImage &oldImage, TiledImage *image,
+                         const QRect &area, QUndoCommand *parent)
+    : CanvasCommand(parent)
 {
     this->image = image;
-    this->oldImage = oldImage;
-    newImage = image->copy(QRect());
+    this->area = area.intersected(image->rect());
+    journal = 0;
+    spilled = false;
+    replaced = oldImage.size() != image->size()
+               || oldImage.fillColor() != image->fillColor()
+               || oldImage.format() != image->format();
+
+    if(replaced)
+    {
+        this->oldImage = StoredTiles(oldImage);
+        newImage = StoredTiles(*image);
+        return;
+    }
+
+    diffTiles(oldImage, area);
+}
+
+/**
+ * @brief DrawCommand::~DrawCommand - give the journal space of the tiles
+ *                                    that were spilled back
+ */
+DrawCommand::~DrawCommand()
+{
+    if(!journal)
+        return;
+
+    oldImage.release(journal);
+    newImage.release(journal);
+    for(int i = 0; i < tiles.size(); ++i)
+    {
+        tiles[i].before.release(journal);
+        tiles[i].after.release(journal);
+    }
+}
+
+/**
+ * @brief DrawCommand::diffTiles - walk both images tile by tile and keep
+ *                                 only the tiles whose pixels differ, tiles
+ *                                 still shared with the old image are
+ *                                 skipped without comparing pixels
+ */
+void DrawCommand::diffTiles(const TiledImage &before, const QRect &area)
+{
+    QRect range = image->tilesIn(area);
+    for(int row = range.top(); row <= range.bottom(); ++row)
+    {
+        for(int column = range.left(); column <= range.right(); ++column)
+        {
+            if(image->tileEquals(before, column, row))
+                continue;
+
+            Tile tile;
+            tile.column = column;
+            tile.row = row;
+            tile.before = StoredImage(before.tile(column, row));
+            tile.after = StoredImage(image->tile(column, row));
+            tiles.append(tile);
+        }
+    }
+}
+
+/**
+ * @brief DrawCommand::restoreTiles - put the recorded tiles back into
+ *                                    the image, unallocated tiles are
+ *                                    stored as null images
+ */
+void DrawCommand::restoreTiles(bool before)
+{
+    for(const Tile &tile : tiles)
+        image->setTile(tile.column, tile.row,
+                       before ? tile.before.image(journal)
+                              : tile.after.image(journal));
+}
+
+/**
+ * @brief DrawCommand::byteSize - memory taken up by the stored tiles,
+ *                                spilled tiles only count their bookkeeping
+ */
+qint64 DrawCommand::byteSize() const
+{
+    qint64 size = sizeof(*this) + oldImage.byteSize() + newImage.byteSize();
+    for(const Tile &tile : tiles)
+        size += sizeof(tile) + tile.before.byteSize() + tile.after.byteSize();
+    return size;
+}
+
+/**
+ * @brief DrawCommand::spill - move the stored tiles out of memory and into
+ *                             the journal, they are read back on undo/redo
+ */
+bool DrawCommand::spill(UndoJournal *target)
+{
+    if(spilled)
+        return true;
+
+    bool ok = oldImage.spill(target) && newImage.spill(target);
+    for(int i = 0; ok && i < tiles.size(); ++i)
+        ok = tiles[i].before.spill(target) && tiles[i].after.spill(target);
+
+    // tiles that did make it to the journal stay there, the rest
+    // is picked up on the next attempt
+    journal = target;
+    spilled = ok;
+    return ok;
 }
 
 /**
@@ -20,7 +125,10 @@ DrawCommand::DrawCommand(const QPixmap &oldImage, QPixmap *image,
  */
 void DrawCommand::undo()
 {
-    *image = oldImage.copy(QRect());
+    if(replaced)
+        *image = oldImage.image(journal);
+    else
+        restoreTiles(true);
 }
 
 /**
@@ -28,5 +136,273 @@ void DrawCommand::undo()
  */
 void DrawCommand::redo()
 {
-    *image = newImage.copy(QRect());
+    if(replaced)
+        *image = newImage.image(journal);
+    else
+        restoreTiles(false);
+}
+
+/**
+ * @brief StrokeCommand::StrokeCommand - A command that keeps the stroke a
+ *                                       tool drew. The old image is only
+ *                                       held until the command is pushed
+ *                                       and either becomes a keyframe or
+ *                                       is dropped.
+ */
+StrokeCommand::StrokeCommand(const TiledImage &oldImage, const Stroke &stroke,
+                             TiledImage *image, QUndoCommand *parent)
+    : CanvasCommand(parent)
+{
+    this->stroke = stroke;
+    this->image = image;
+    snapshot = oldImage;
+    previous = 0;
+    runLength = 0;
+    journal = 0;
+    spilled = false;
+}
+
+/**
+ * @brief StrokeCommand::~StrokeCommand - give the journal space of a
+ *                                        spilled keyframe back
+ */
+StrokeCommand::~StrokeCommand()
+{
+    if(journal)
+        keyframe.release(journal);
+}
+
+/**
+ * @brief StrokeCommand::byteSize - memory taken up by the stroke points
+ *                                  and the keyframe, if any
+ */
+qint64 StrokeCommand::byteSize() const
+{
+    return sizeof(*this)
+           + stroke.points.size() * qint64(sizeof(QPoint))
+           + keyframe.byteSize();
+}
+
+/**
+ * @brief StrokeCommand::spill - move the keyframe into the journal,
+ *                               the points are small enough to stay
+ */
+bool StrokeCommand::spill(UndoJournal *target)
+{
+    if(spilled)
+        return true;
+
+    journal = target;
+    spilled = keyframe.spill(target);
+    return spilled;
+}
+
+/**
+ * @brief StrokeCommand::follow - chain onto the stroke below, or turn the
+ *                                old image into a keyframe if there is no
+ *                                such stroke on the same layer or the run
+ *                                got too long
+ */
+void StrokeCommand::follow(CanvasCommand *command)
+{
+    StrokeCommand *below = dynamic_cast<StrokeCommand*>(command);
+    if(below && below->image == image
+       && below->runLength < STROKE_KEYFRAME_INTERVAL)
+    {
+        previous = below;
+        runLength = below->runLength + 1;
+    }
+    else
+    {
+        keyframe = StoredTiles(snapshot);
+        runLength = 1;
+    }
+    snapshot = TiledImage();
+}
+
+/**
+ * @brief StrokeCommand::forget - the stroke below is about to be dropped,
+ *                                take over its keyframe
+ */
+void StrokeCommand::forget(CanvasCommand *command)
+{
+    if(command != previous)
+        return;
+
+    keyframe = StoredTiles(render());
+    spilled = false;
+    previous = 0;
+}
+
+/**
+ * @brief StrokeCommand::render - rebuild the image as it was before this
+ *                                stroke, from the nearest keyframe below
+ */
+TiledImage StrokeCommand::render() const
+{
+    QVector<const StrokeCommand*> chain;
+    const StrokeCommand *command = this;
+    while(command->previous)
+    {
+        command = command->previous;
+        chain.prepend(command);
+    }
+
+    TiledImage result = command->keyframe.image(command->journal);
+    for(const StrokeCommand *replayed : chain)
+        replayStroke(replayed->stroke, &result);
+    return result;
+}
+
+/**
+ * @brief StrokeCommand::undo - restore the image from before the stroke
+ */
+void StrokeCommand::undo()
+{
+    *image = render();
+}
+
+/**
+ * @brief StrokeCommand::redo - draw the stroke again
+ */
+void StrokeCommand::redo()
+{
+    replayStroke(stroke, image);
+}
+
+/**
+ * @brief LayersCommand::LayersCommand - A command that keeps the layers
+ *                                       before and after a change to the
+ *                                       layer stack. Layers only on one
+ *                                       side are kept alive uncompressed,
+ *                                       they can't be spilled.
+ */
+LayersCommand::LayersCommand(const LayerStack::State &before,
+                             LayerStack *layers, QUndoCommand *parent)
+    : CanvasCommand(parent)
+{
+    this->layers = layers;
+    this->before = before;
+    after = layers->state();
+    done = true;
+
+    bytes = sizeof(*this);
+    for(Layer *layer : before.layers + after.layers)
+    {
+        if(before.layers.contains(layer) && after.layers.contains(layer))
+            continue;
+
+        const TiledImage &image = layer->image;
+        for(int row = 0; row < image.rows(); ++row)
+            for(int column = 0; column < image.columns(); ++column)
+                bytes += image.tile(column, row).sizeInBytes();
+    }
+}
+
+/**
+ * @brief LayersCommand::~LayersCommand - delete the layers that are not
+ *                                        in the stack
+ */
+LayersCommand::~LayersCommand()
+{
+    const LayerStack::State &gone = done ? before : after;
+    const LayerStack::State &kept = done ? after : before;
+    for(Layer *layer : gone.layers)
+        if(!kept.layers.contains(layer))
+            delete layer;
+}
+
+/**
+ * @brief LayersCommand::undo - put the old layers back
+ */
+void LayersCommand::undo()
+{
+    layers->restore(before);
+    done = false;
+}
+
+/**
+ * @brief LayersCommand::redo - put the new layers back
+ */
+void LayersCommand::redo()
+{
+    layers->restore(after);
+    done = true;
+}
+
+/**
+ * @brief ShapesCommand::ShapesCommand - A command that keeps the shapes
+ *                                       taken out of and put into a
+ *                                       scene. The change is expected to
+ *                                       be applied already.
+ */
+ShapesCommand::ShapesCommand(VectorScene *scene, TiledImage *image,
+                             const QMap<int, Stroke> &removed,
+                             const QMap<int, Stroke> &added,
+                             QUndoCommand *parent)
+    : CanvasCommand(parent)
+{
+    this->scene = scene;
+    this->image = image;
+    this->removed = removed;
+    this->added = added;
+}
+
+qint64 ShapesCommand::byteSize() const
+{
+    qint64 bytes = sizeof(*this);
+    for(const Stroke &stroke : removed.values() + added.values())
+        bytes += sizeof(stroke) + stroke.points.size() * sizeof(QPoint);
+    return bytes;
+}
+
+/**
+ * @brief ShapesCommand::changedArea - the area the shapes taken out and put
+ *                                     in cover
+ */
+QRect ShapesCommand::changedArea() const
+{
+    QRect area;
+    for(const Stroke &stroke : removed.values() + added.values())
+        area |= strokeArea(stroke);
+    return area;
+}
+
+/**
+ * @brief ShapesCommand::undo - put the removed shapes back
+ */
+void ShapesCommand::undo()
+{
+    swap(added, removed);
+}
+
+/**
+ * @brief ShapesCommand::redo - put the added shapes back
+ */
+void ShapesCommand::redo()
+{
+    swap(removed, added);
+}
+
+/**
+ * @brief ShapesCommand::swap - take shapes out, put others in and draw the
+ *                              area they cover again
+ */
+void ShapesCommand::swap(const QMap<int, Stroke> &out,
+                         const QMap<int, Stroke> &in)
+{
+    QRect damaged;
+    for(QMap<int, Stroke>::const_iterator shape = out.constBegin();
+        shape != out.constEnd(); ++shape)
+    {
+        damaged |= strokeArea(shape.value());
+        scene->take(shape.key());
+    }
+    for(QMap<int, Stroke>::const_iterator shape = in.constBegin();
+        shape != in.constEnd(); ++shape)
+    {
+        damaged |= strokeArea(shape.value());
+        scene->insert(shape.key(), shape.value());
+    }
+    scene->render(image, damaged);
 }
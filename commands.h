@@ -1,21 +1,183 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
-#include <QPixmap>
+#include <QImage>
+#include <QMap>
+#include <QVector>
 #include <QUndoCommand>
 
+#include "layer_stack.h"
+#include "tiled_image.h"
+#include "tool.h"
+#include "undo_journal.h"
+#include "vector_scene.h"
 
-class DrawCommand : public QUndoCommand
+
+/**
+ * a command on the canvas' UndoStack, applied before it is pushed
+ */
+class CanvasCommand : public QUndoCommand
+{
+public:
+    CanvasCommand(QUndoCommand *parent = 0) : QUndoCommand(parent) {}
+
+    virtual qint64 byteSize() const = 0;
+    virtual bool isSpilled() const = 0;
+    virtual bool spill(UndoJournal*) = 0;
+
+    /** the image whose pixels the command changes and where, 0 if it
+        changes the layers or an image's size, fill or format */
+    virtual TiledImage* changedImage() const { return 0; }
+    virtual QRect changedArea() const { return QRect(); }
+    /** whether the shapes of a vector layer change as well */
+    virtual bool changesShapes() const { return false; }
+
+    /** called once when pushed on top of 'previous' (may be 0) */
+    virtual void follow(CanvasCommand*) {}
+    /** called when the command below this one is dropped */
+    virtual void forget(CanvasCommand*) {}
+};
+
+class DrawCommand : public CanvasCommand
+{
+public:
+    DrawCommand(const TiledImage &oldImage, TiledImage *image,
+                const QRect &area, QUndoCommand *parent = 0);
+    ~DrawCommand();
+
+    bool isEmpty() const { return tiles.isEmpty() && !replaced; }
+    qint64 byteSize() const override;
+    bool isSpilled() const override { return spilled; }
+    bool spill(UndoJournal*) override;
+
+    TiledImage* changedImage() const override { return replaced ? 0 : image; }
+    QRect changedArea() const override { return area; }
+
+    void undo() override;
+    void redo() override;
+private:
+    /** a single tile that differs between the old and the new image,
+        both stored compressed */
+    struct Tile
+    {
+        int column;
+        int row;
+        StoredImage before;
+        StoredImage after;
+    };
+
+    void diffTiles(const TiledImage&, const QRect&);
+    void restoreTiles(bool before);
+
+    TiledImage* image;
+    QRect area;
+    QVector<Tile> tiles;
+    UndoJournal* journal;
+    bool spilled;
+
+    /** only used when the image dimensions or fill color changed */
+    bool replaced;
+    StoredTiles oldImage;
+    StoredTiles newImage;
+};
+
+/**
+ * a command that only records the stroke drawn by a tool. Redo replays the
+ * stroke, undo restores the nearest keyframe below it and replays the
+ * strokes in between. A keyframe is kept every STROKE_KEYFRAME_INTERVAL
+ * strokes and whenever a stroke doesn't follow another stroke.
+ */
+class StrokeCommand : public CanvasCommand
 {
 public:
-    DrawCommand(const QPixmap &oldImage, QPixmap *image, QUndoCommand *parent = 0);
+    StrokeCommand(const TiledImage &oldImage, const Stroke &stroke,
+                  TiledImage *image, QUndoCommand *parent = 0);
+    ~StrokeCommand();
+
+    qint64 byteSize() const override;
+    bool isSpilled() const override { return spilled; }
+    bool spill(UndoJournal*) override;
+
+    TiledImage* changedImage() const override { return image; }
+    QRect changedArea() const override { return strokeArea(stroke); }
+
+    void follow(CanvasCommand*) override;
+    void forget(CanvasCommand*) override;
 
     void undo() override;
     void redo() override;
 private:
-    QPixmap* image;
-    QPixmap oldImage;
-    QPixmap newImage;
+    TiledImage render() const;
+
+    Stroke stroke;
+    TiledImage* image;
+
+    /** the image before the stroke, only until the command is pushed */
+    TiledImage snapshot;
+
+    StrokeCommand* previous;
+    int runLength;
+    StoredTiles keyframe;
+    UndoJournal* journal;
+    bool spilled;
+};
+
+/**
+ * a command that changes which layers there are, their order or their
+ * styles. Layers that are out of the stack while the command is done or
+ * undone belong to the command and are deleted with it.
+ */
+class LayersCommand : public CanvasCommand
+{
+public:
+    LayersCommand(const LayerStack::State &before, LayerStack *layers,
+                  QUndoCommand *parent = 0);
+    ~LayersCommand();
+
+    qint64 byteSize() const override { return bytes; }
+    bool isSpilled() const override { return false; }
+    bool spill(UndoJournal*) override { return false; }
+
+    void undo() override;
+    void redo() override;
+private:
+    LayerStack* layers;
+    LayerStack::State before;
+    LayerStack::State after;
+    bool done;
+    qint64 bytes;
+};
+
+/**
+ * a command that takes shapes out of a vector layer and puts others in,
+ * by id so undone shapes go back to their place in the stack. Only the
+ * area the shapes cover is drawn again.
+ */
+class ShapesCommand : public CanvasCommand
+{
+public:
+    ShapesCommand(VectorScene *scene, TiledImage *image,
+                  const QMap<int, Stroke> &removed,
+                  const QMap<int, Stroke> &added,
+                  QUndoCommand *parent = 0);
+
+    qint64 byteSize() const override;
+    bool isSpilled() const override { return false; }
+    bool spill(UndoJournal*) override { return false; }
+
+    TiledImage* changedImage() const override { return image; }
+    QRect changedArea() const override;
+    bool changesShapes() const override { return true; }
+
+    void undo() override;
+    void redo() override;
+private:
+    void swap(const QMap<int, Stroke> &out, const QMap<int, Stroke> &in);
+
+    VectorScene* scene;
+    TiledImage* image;
+    QMap<int, Stroke> removed;
+    QMap<int, Stroke> added;
 };
 
 #endif // COMMANDS_H
@@ -0,0 +1,226 @@
+#include <QVector>
+#include <cstring>
+
+#include "compression.h"
+#include "constants.h"
+
+
+/**
+ * The stream is a small header (width, height, format) followed by
+ * packets, each introduced by a 16-bit control word:
+ *
+ *   - high bit set:   a run, the low 15 bits repeat the next pixel
+ *   - high bit clear: a literal, the low 15 bits count the raw pixels
+ *                     that follow
+ */
+namespace
+{
+const quint16 RUN_FLAG = 0x8000;
+const int MAX_PACKET = 0x7fff;
+const int MIN_RUN = 3;
+
+struct Header
+{
+    quint32 width;
+    quint32 height;
+    quint32 format;
+};
+
+class Encoder
+{
+public:
+    explicit Encoder(QByteArray &out) : out(out), runPixel(0), runLength(0) {}
+
+    void put(quint32 pixel)
+    {
+        if(runLength > 0 && pixel == runPixel && runLength < MAX_PACKET)
+        {
+            ++runLength;
+            return;
+        }
+        endRun();
+        runPixel = pixel;
+        runLength = 1;
+    }
+
+    void finish()
+    {
+        endRun();
+        flushLiterals();
+    }
+
+private:
+    void endRun()
+    {
+        if(runLength >= MIN_RUN)
+        {
+            flushLiterals();
+            quint16 control = RUN_FLAG | quint16(runLength);
+            out.append(reinterpret_cast<const char*>(&control), sizeof(control));
+            out.append(reinterpret_cast<const char*>(&runPixel), sizeof(runPixel));
+        }
+        else
+        {
+            for(int i = 0; i < runLength; ++i)
+            {
+                if(literals.size() == MAX_PACKET)
+                    flushLiterals();
+                literals.append(runPixel);
+            }
+        }
+        runLength = 0;
+    }
+
+    void flushLiterals()
+    {
+        if(literals.isEmpty())
+            return;
+        quint16 control = quint16(literals.size());
+        out.append(reinterpret_cast<const char*>(&control), sizeof(control));
+        out.append(reinterpret_cast<const char*>(literals.constData()),
+                   literals.size() * int(sizeof(quint32)));
+        literals.clear();
+    }
+
+    QByteArray &out;
+    QVector<quint32> literals;
+    quint32 runPixel;
+    int runLength;
+};
+}
+
+/**
+ * @brief compressImage - run-length encode an image, converting it to
+ *                        a 32-bit format first if necessary
+ *
+ */
+QByteArray compressImage(const QImage &source)
+{
+    QImage image = source;
+    if(!image.isNull() && image.depth() != 32)
+        image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    Header header = { quint32(image.width()),
+                      quint32(image.height()),
+                      quint32(image.format()) };
+
+    QByteArray out;
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    Encoder encoder(out);
+    for(int y = 0; y < image.height(); ++y)
+    {
+        const quint32 *line = reinterpret_cast<const quint32*>(image.constScanLine(y));
+        for(int x = 0; x < image.width(); ++x)
+            encoder.put(line[x]);
+    }
+    encoder.finish();
+
+    out.squeeze();
+    return out;
+}
+
+/**
+ * @brief decompressImage - rebuild an image from compressImage() output,
+ *                          returns a null image if the data is truncated,
+ *                          larger than a tile or not of a 32-bit format
+ *
+ */
+QImage decompressImage(const QByteArray &data)
+{
+    if(data.size() < int(sizeof(Header)))
+        return QImage();
+
+    Header header;
+    memcpy(&header, data.constData(), sizeof(header));
+    if(header.width == 0 || header.height == 0
+       || header.width > quint32(TILE_SIZE) || header.height > quint32(TILE_SIZE))
+        return QImage();
+
+    // the pixels are written 32 bits at a time, the data may come from a
+    // file and can't be trusted to name such a format
+    if(header.format == QImage::Format_Invalid
+       || header.format >= QImage::NImageFormats
+       || QImage::toPixelFormat(QImage::Format(header.format)).bitsPerPixel() != 32)
+        return QImage();
+
+    QImage image(int(header.width), int(header.height),
+                 QImage::Format(header.format));
+    if(image.isNull())
+        return QImage();
+
+    const char *in = data.constData() + sizeof(header);
+    const char *end = data.constData() + data.size();
+
+    const int width = image.width();
+    const qint64 total = qint64(width) * image.height();
+    qint64 written = 0;
+    quint32 *line = reinterpret_cast<quint32*>(image.scanLine(0));
+
+    auto put = [&](quint32 pixel)
+    {
+        const int x = int(written % width);
+        if(x == 0 && written > 0)
+            line = reinterpret_cast<quint32*>(image.scanLine(int(written / width)));
+        line[x] = pixel;
+        ++written;
+    };
+
+    while(in + sizeof(quint16) <= end && written < total)
+    {
+        quint16 control;
+        memcpy(&control, in, sizeof(control));
+        in += sizeof(control);
+
+        const int count = control & MAX_PACKET;
+        const bool run = control & RUN_FLAG;
+        const qint64 needed = run ? sizeof(quint32) : qint64(count) * sizeof(quint32);
+        if(end - in < needed || written + count > total)
+            return QImage();
+
+        if(run)
+        {
+            quint32 pixel;
+            memcpy(&pixel, in, sizeof(pixel));
+            in += sizeof(pixel);
+            for(int i = 0; i < count; ++i)
+                put(pixel);
+        }
+        else
+        {
+            for(int i = 0; i < count; ++i)
+            {
+                quint32 pixel;
+                memcpy(&pixel, in, sizeof(pixel));
+                in += sizeof(pixel);
+                put(pixel);
+            }
+        }
+    }
+
+    if(written != total)
+        return QImage();
+    return image;
+}
+
+/**
+ * @brief decompressImage - rebuild a tile that has to be of size and
+ *                          format, anything else is rejected before the
+ *                          image is allocated
+ *
+ */
+QImage decompressImage(const QByteArray &data, const QSize &size,
+                       QImage::Format format)
+{
+    if(data.size() < int(sizeof(Header)))
+        return QImage();
+
+    Header header;
+    memcpy(&header, data.constData(), sizeof(header));
+    if(header.width != quint32(size.width())
+       || header.height != quint32(size.height())
+       || header.format != quint32(format))
+        return QImage();
+
+    return decompressImage(data);
+}
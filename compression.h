@@ -0,0 +1,16 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <QByteArray>
+#include <QImage>
+
+
+/**
+ * run-length encoding of 32-bit tiles, flat colour paint compresses
+ * to a few bytes per run. Only images up to TILE_SIZE square decompress.
+ */
+QByteArray compressImage(const QImage&);
+QImage decompressImage(const QByteArray&);
+QImage decompressImage(const QByteArray&, const QSize&, QImage::Format);
+
+#endif // COMPRESSION_H
@@ -8,28 +8,86 @@ const int DEFAULT_IMG_HEIGHT = 480;
 const int DEFAULT_PEN_THICKNESS = 1;
 const int DEFAULT_ERASER_THICKNESS = 10;
 const int DEFAULT_RECT_CURVE = 10;
+const int DEFAULT_FILL_TOLERANCE = 16;
+const int DEFAULT_BLUR_RADIUS = 2;
+const int DEFAULT_SHARPEN_AMOUNT = 100;
+
+/** zlib level PNGs are saved at, see the "save/png_compression" setting */
+const int DEFAULT_PNG_COMPRESSION = 6;
 
 /** slider ranges */
 const int MIN_PEN_SIZE = 1;
 const int MAX_PEN_SIZE = 50;
 const int MIN_RECT_CURVE = 0;
 const int MAX_RECT_CURVE = 100;
+const int MIN_FILL_TOLERANCE = 0;
+const int MAX_FILL_TOLERANCE = 255;
+const int MIN_BLUR_RADIUS = 1;
+const int MAX_BLUR_RADIUS = 100;
+const int MIN_SHARPEN_AMOUNT = 0;
+const int MAX_SHARPEN_AMOUNT = 500;
+const int MIN_BRIGHTNESS = -100;
+const int MAX_BRIGHTNESS = 100;
+const int MIN_CONTRAST = -100;
+const int MAX_CONTRAST = 100;
+const int MIN_PNG_COMPRESSION = 0;
+const int MAX_PNG_COMPRESSION = 9;
 
 /** spinbox ranges */
 const int MIN_IMG_WIDTH = 1;
-const int MAX_IMG_WIDTH = 2560; // 2560x1440 limit due to undo/redo limitations
+const int MAX_IMG_WIDTH = 16384;
 const int MIN_IMG_HEIGHT = 1;
-const int MAX_IMG_HEIGHT = 1440;
+const int MAX_IMG_HEIGHT = 16384;
+
+/** default memory budget of the undo history, see the
+    "undo/budget_mb" setting */
+const int DEFAULT_UNDO_BUDGET_MB = 256;
+
+/** number of recent undo commands never spilled to the journal on disk,
+    see the "undo/resident_commands" setting */
+const int DEFAULT_UNDO_RESIDENT_COMMANDS = 20;
+
+/** seconds between two autosave checkpoints, see the
+    "autosave/interval_s" setting, 0 turns autosaving off */
+const int DEFAULT_AUTOSAVE_INTERVAL = 30;
+
+/** number of strokes replayed at most between two undo keyframes */
+const int STROKE_KEYFRAME_INTERVAL = 32;
+
+/** milliseconds between two flushes of queued mouse input, one frame at 60 Hz */
+const int INPUT_FRAME_INTERVAL = 16;
+
+/** how far the view zooms out and in */
+const qreal MIN_ZOOM = 1.0 / 64;
+const qreal MAX_ZOOM = 32;
+
+/** edge length of the square tiles images are stored and undone in */
+const int TILE_SIZE = 128;
+
+/** how many pixels off a shape a click still selects it */
+const int HIT_TOLERANCE = 3;
+
+/** longest side of the downscaled copy filters are previewed on */
+const int FILTER_PREVIEW_SIZE = 256;
 
-/** max number of undo commands */
-const int UNDO_LIMIT = 100;
+/** how small a selection can be scaled in one drag */
+const qreal MIN_SELECTION_SCALE = 1.0 / 64;
 
-enum ToolType {pen, line, eraser, rect_tool, render3d};
+enum ToolType {pen, line, eraser, rect_tool, render3d, fill_tool,
+               select_tool};
 enum LineStyle {solid, dashed, dotted, dash_dotted, dash_dot_dotted};
 enum CapStyle {flat, square, round_cap};
 enum DrawType {single, poly};
+enum SelectMode {rect_select, free_select};
+enum FilterType {blur_filter, sharpen_filter, brightness_contrast_filter,
+                 invert_filter};
+enum ResampleFilter {box_filter, bilinear_filter, lanczos_filter};
+enum ImageFormat {png_format, qoi_format, bmp_format};
+enum PrimitiveType {cube_primitive, sphere_primitive, cylinder_primitive};
 enum ShapeType {rectangle, rounded_rectangle, ellipse};
 enum FillColor {foreground, background, no_fill};
 enum BoundaryType {miter_join, bevel_join, round_join};
+enum BlendMode {normal_blend, multiply_blend, screen_blend, overlay_blend,
+                darken_blend, lighten_blend, difference_blend};
 
 #endif // CONSTANTS_H
@@ -4,26 +4,96 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QLabel>
+#include <QPixmap>
+#include <cstring>
 
 #include "dialog_windows.h"
 #include "main_window.h"
 #include "canvas.h"
+#include "parallel.h"
+#include "resample.h"
+
+
+namespace
+{
+/**
+ * @brief shrinkTiles - the image shrunk by factor, a power of two no larger
+ *                      than a tile, each tile shrunk on its own across the
+ *                      thread pool. Tiles never set are filled with the
+ *                      image's color without being made.
+ *
+ */
+QImage shrinkTiles(const TiledImage &image, int factor)
+{
+    QImage mosaic((image.width() + factor - 1) / factor,
+                  (image.height() + factor - 1) / factor, image.format());
+    mosaic.fill(image.fillColor());
+    uchar *bits = mosaic.bits();
+    const int stride = mosaic.bytesPerLine();
+
+    parallelFor(image.columns() * image.rows(), [&](int i)
+    {
+        const int column = i % image.columns();
+        const int row = i / image.columns();
+        const QImage tile = image.tile(column, row);
+        if(tile.isNull())
+            return;
+
+        const QRect rect = image.tileRect(column, row);
+        const QImage small = factor == 1 ? tile
+            : resample(tile, QSize((rect.width() + factor - 1) / factor,
+                                   (rect.height() + factor - 1) / factor),
+                       box_filter);
+        const QPoint at = rect.topLeft() / factor;
+        for(int y = 0; y < small.height(); ++y)
+            memcpy(bits + (at.y() + y) * stride + at.x() * 4,
+                   small.constScanLine(y), small.width() * 4);
+    });
+    return mosaic;
+}
+}
 
 
 /**
  * @brief CanvasSizeDialog::CanvasSizeDialog - Dialogue for creating a new
- *                                             canvas
+ *                                             canvas, or for resizing it
+ *                                             with a choice of filter
  */
-CanvasSizeDialog::CanvasSizeDialog(QWidget* parent, const char* name, int width, int height)
-    :QDialog(parent)
+CanvasSizeDialog::CanvasSizeDialog(QWidget* parent, const char* name, int width, int height,
+                                   bool resampling, ResampleFilter filter)
+    :QDialog(parent), filterBox(0)
 {
     QVBoxLayout *layout = new QVBoxLayout(this);
-    layout->addWidget(createSpinBoxes(width,height));
+    QGroupBox *sizeGroup = createSpinBoxes(width,height);
+    layout->addWidget(sizeGroup);
     setLayout(layout);
 
+    if(resampling)
+    {
+        filterBox = new QComboBox(this);
+        filterBox->addItem(tr("Box"), box_filter);
+        filterBox->addItem(tr("Bilinear"), bilinear_filter);
+        filterBox->addItem(tr("Lanczos-3"), lanczos_filter);
+        filterBox->setCurrentIndex(filterBox->findData(filter));
+
+        QFormLayout *form = static_cast<QFormLayout*>(sizeGroup->layout());
+        form->insertRow(2, tr("Filter: "), filterBox);
+    }
+
     setWindowTitle(tr(name));
 }
 
+/**
+ * @brief CanvasSizeDialog::getFilter - the filter picked to resize with,
+ *                                      bilinear when not resizing
+ */
+ResampleFilter CanvasSizeDialog::getFilter() const
+{
+    if(!filterBox)
+        return bilinear_filter;
+    return ResampleFilter(filterBox->currentData().toInt());
+}
+
 /**
  * @brief NewCanvasDialog::createSpinBoxes - Create the QSpinBoxes for the dialog
  *                                           box as well as the buttons
@@ -477,3 +547,119 @@ QGroupBox* RectDialog::createBoundaryType(BoundaryType boundaryType)
 
     return boundaryTypes;
 }
+
+/**
+ * @brief FilterDialog::FilterDialog - Dialogue for the settings of a filter,
+ *                                     previewed live on a shrunk copy of
+ *                                     the image
+ *
+ */
+FilterDialog::FilterDialog(QWidget* parent, const TiledImage &image, FilterType type)
+    :QDialog(parent)
+{
+    const char *titles[] = {"Blur", "Sharpen", "Brightness/Contrast", "Invert"};
+    setWindowTitle(tr(titles[type]));
+    filter.type = type;
+
+    // the preview is filtered at its own scale, radii shrink with it
+    proxyScale = qMin<qreal>(1, qreal(FILTER_PREVIEW_SIZE)
+                                / qMax(image.width(), image.height()));
+    QSize size = (QSizeF(image.size()) * proxyScale).toSize().expandedTo(QSize(1, 1));
+
+    // shrunk tile by tile as far as a power of two allows, so the layer is
+    // never copied whole, then the small mosaic to the exact size
+    int factor = 1;
+    while(factor < TILE_SIZE && size.width() * factor * 2 <= image.width()
+          && size.height() * factor * 2 <= image.height())
+        factor *= 2;
+    proxy.load(resample(shrinkTiles(image, factor), size, box_filter),
+               image.fillColor());
+
+    preview = new QLabel(this);
+    preview->setAlignment(Qt::AlignCenter);
+    preview->setMinimumSize(FILTER_PREVIEW_SIZE, FILTER_PREVIEW_SIZE);
+
+    QGridLayout *grid = new QGridLayout(this);
+    grid->addWidget(preview, 0, 0, 1, 2);
+
+    if(type == blur_filter || type == sharpen_filter)
+        addSlider(grid, tr("Radius"), MIN_BLUR_RADIUS, MAX_BLUR_RADIUS,
+                  qRound(filter.radius), SLOT(OnRadiusConfig(int)));
+    if(type == sharpen_filter)
+        addSlider(grid, tr("Amount"), MIN_SHARPEN_AMOUNT, MAX_SHARPEN_AMOUNT,
+                  filter.amount, SLOT(OnAmountConfig(int)));
+    if(type == brightness_contrast_filter)
+    {
+        addSlider(grid, tr("Brightness"), MIN_BRIGHTNESS, MAX_BRIGHTNESS,
+                  filter.brightness, SLOT(OnBrightnessConfig(int)));
+        addSlider(grid, tr("Contrast"), MIN_CONTRAST, MAX_CONTRAST,
+                  filter.contrast, SLOT(OnContrastConfig(int)));
+    }
+
+    // the buttons
+    QPushButton *okButton = new QPushButton(tr("OK"), this);
+    QPushButton *cancelButton = new QPushButton(tr("Cancel"), this);
+    connect(okButton, SIGNAL(clicked()), this, SLOT(accept()));
+    connect(cancelButton, SIGNAL(clicked()), this, SLOT(reject()));
+    grid->addWidget(okButton, grid->rowCount(), 0);
+    grid->addWidget(cancelButton, grid->rowCount() - 1, 1);
+    setLayout(grid);
+
+    updatePreview();
+}
+
+/**
+ * @brief FilterDialog::addSlider - Add a labelled slider below the others,
+ *                                  previewing as it moves
+ *
+ */
+void FilterDialog::addSlider(QGridLayout *grid, const QString &name,
+                             int min, int max, int value, const char *slot)
+{
+    QSlider *slider = new QSlider(Qt::Horizontal, this);
+    slider->setMinimum(min);
+    slider->setMaximum(max);
+    slider->setSliderPosition(value);
+
+    connect(slider, SIGNAL(valueChanged(int)), this, slot);
+
+    int row = grid->rowCount();
+    grid->addWidget(new QLabel(name, this), row, 0);
+    grid->addWidget(slider, row, 1);
+}
+
+/**
+ * @brief FilterDialog::updatePreview - Filter a shallow copy of the shrunk
+ *                                      image and show it
+ *
+ */
+void FilterDialog::updatePreview()
+{
+    TiledImage filtered = proxy;
+    applyFilter(&filtered, filtered.rect(), filter.scaled(proxyScale));
+    preview->setPixmap(QPixmap::fromImage(filtered.toImage()));
+}
+
+void FilterDialog::OnRadiusConfig(int value)
+{
+    filter.radius = value;
+    updatePreview();
+}
+
+void FilterDialog::OnAmountConfig(int value)
+{
+    filter.amount = value;
+    updatePreview();
+}
+
+void FilterDialog::OnBrightnessConfig(int value)
+{
+    filter.brightness = value;
+    updatePreview();
+}
+
+void FilterDialog::OnContrastConfig(int value)
+{
+    filter.contrast = value;
+    updatePreview();
+}
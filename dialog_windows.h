@@ -1,13 +1,18 @@
 #ifndef DIALOG_WINDOWS_H
 #define DIALOG_WINDOWS_H
 
+#include <QComboBox>
 #include <QSpinBox>
 #include <QGroupBox>
 #include <QDialog>
 #include <QSlider>
 #include <QButtonGroup>
+#include <QGridLayout>
+#include <QLabel>
 
 #include "constants.h"
+#include "filters.h"
+#include "tiled_image.h"
 #include "tool.h"
 
 
@@ -20,16 +25,20 @@ class CanvasSizeDialog : public QDialog
 public:
     CanvasSizeDialog(QWidget*, const char* name = 0,
                      int width = DEFAULT_IMG_WIDTH,
-                     int height = DEFAULT_IMG_HEIGHT);
+                     int height = DEFAULT_IMG_HEIGHT,
+                     bool resampling = false,
+                     ResampleFilter = bilinear_filter);
 
     int getWidthValue() const { return widthSpinBox->value(); }
     int getHeightValue() const { return heightSpinBox->value(); }
+    ResampleFilter getFilter() const;
 
 private:
     QGroupBox* createSpinBoxes(int,int);
 
     QSpinBox *widthSpinBox;
     QSpinBox *heightSpinBox;
+    QComboBox *filterBox;
     QGroupBox *spinBoxesGroup;
 };
 
@@ -111,4 +120,32 @@ private:
     QSlider* rRectCurveSlider;
 };
 
+class FilterDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    FilterDialog(QWidget* parent, const TiledImage &image, FilterType);
+
+    Filter getFilter() const { return filter; }
+
+private slots:
+    void OnRadiusConfig(int);
+    void OnAmountConfig(int);
+    void OnBrightnessConfig(int);
+    void OnContrastConfig(int);
+
+private:
+    void addSlider(QGridLayout*, const QString&, int min, int max, int value,
+                   const char *slot);
+    void updatePreview();
+
+    Filter filter;
+
+    /** the image shrunk to at most FILTER_PREVIEW_SIZE, and how much */
+    TiledImage proxy;
+    qreal proxyScale;
+    QLabel* preview;
+};
+
 #endif // DIALOGS_H
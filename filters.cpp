@@ -0,0 +1,462 @@
+#include <QPainter>
+#include <QVector>
+#include <QtMath>
+#include <cmath>
+#include <cstring>
+
+#include "filters.h"
+#include "parallel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FILTERS_X86 1
+#include <immintrin.h>
+#endif
+
+
+/**
+ * The kernels work on premultiplied pixels, the channels of a pixel side
+ * by side in one register, and round their float results to nearest even
+ * the same way, so the scalar and vector kernels give the same pixels:
+ *
+ *   - box:       the average of the 2 * radius + 1 pixels around each one
+ *                along a line, edges repeated, kept as a running sum
+ *   - sharpen:   c = o + (o - b) * amount, o the pixel, b it blurred
+ *   - levels:    c = (o - a / 2) * contrast + a / 2 + a * brightness,
+ *                brightness and contrast scaled by alpha to stay
+ *                premultiplied
+ *   - invert:    c = a - o
+ *
+ * Colors are kept within alpha, alpha is only changed by blur and sharpen.
+ */
+namespace
+{
+typedef void (*BoxKernel)(quint32*, const quint32*, int, int, int);
+typedef void (*SharpenKernel)(quint32*, const quint32*, int, float);
+typedef void (*LevelsKernel)(quint32*, int, float, float);
+typedef void (*InvertKernel)(quint32*, int);
+
+inline int channel(quint32 pixel, int index)
+{
+    return int((pixel >> (8 * index)) & 0xff);
+}
+
+inline quint32 clampColors(quint32 pixel)
+{
+    const quint32 alpha = pixel >> 24;
+    quint32 out = pixel & 0xff000000;
+    for(int c = 0; c < 3; ++c)
+        out |= quint32(qMin<quint32>(channel(pixel, c), alpha)) << (8 * c);
+    return out;
+}
+
+void boxScalar(quint32 *dst, const quint32 *src, int length, int stride, int radius)
+{
+    const float scale = 1.0f / (2 * radius + 1);
+    const int last = length - 1;
+
+    // the window starts centered on the first pixel
+    int sums[4];
+    for(int c = 0; c < 4; ++c)
+    {
+        sums[c] = (radius + 1) * channel(src[0], c);
+        for(int i = 1; i <= radius; ++i)
+            sums[c] += channel(src[qMin(i, last) * stride], c);
+    }
+
+    for(int x = 0; x < length; ++x)
+    {
+        quint32 out = 0;
+        for(int c = 0; c < 4; ++c)
+            out |= quint32(qBound(0, int(lrintf(float(sums[c]) * scale)), 255)) << (8 * c);
+        dst[x * stride] = out;
+
+        const quint32 entering = src[qMin(x + radius + 1, last) * stride];
+        const quint32 leaving = src[qMax(x - radius, 0) * stride];
+        for(int c = 0; c < 4; ++c)
+            sums[c] += channel(entering, c) - channel(leaving, c);
+    }
+}
+
+void sharpenScalar(quint32 *pixels, const quint32 *blurred, int length, float amount)
+{
+    for(int i = 0; i < length; ++i)
+    {
+        quint32 out = 0;
+        for(int c = 0; c < 4; ++c)
+        {
+            const float original = float(channel(pixels[i], c));
+            const float value = original + (original - float(channel(blurred[i], c))) * amount;
+            out |= quint32(qBound(0, int(lrintf(value)), 255)) << (8 * c);
+        }
+        pixels[i] = clampColors(out);
+    }
+}
+
+void levelsScalar(quint32 *pixels, int length, float contrast, float brightness)
+{
+    const float half = 128.0f / 255;
+
+    for(int i = 0; i < length; ++i)
+    {
+        const float alpha = float(pixels[i] >> 24);
+        const float middle = alpha * half;
+
+        quint32 out = pixels[i] & 0xff000000;
+        for(int c = 0; c < 3; ++c)
+        {
+            float value = (float(channel(pixels[i], c)) - middle) * contrast + middle
+                          + alpha * brightness;
+            value = qMin(qMax(value, 0.0f), alpha);
+            out |= quint32(lrintf(value)) << (8 * c);
+        }
+        pixels[i] = out;
+    }
+}
+
+void invertScalar(quint32 *pixels, int length)
+{
+    for(int i = 0; i < length; ++i)
+    {
+        const quint32 alpha = pixels[i] >> 24;
+        quint32 out = pixels[i] & 0xff000000;
+        for(int c = 0; c < 3; ++c)
+            out |= (alpha - channel(pixels[i], c)) << (8 * c);
+        pixels[i] = out;
+    }
+}
+
+#ifdef FILTERS_X86
+
+///////////////////////////////////////////////////////////
+// SSE2, the four channels of a pixel as 32-bit lanes or, //
+// for invert, four pixels per register                  //
+///////////////////////////////////////////////////////////
+
+__attribute__((target("sse2")))
+inline __m128i widenSse2(quint32 pixel)
+{
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(int(pixel)), zero),
+                              zero);
+}
+
+__attribute__((target("sse2")))
+inline quint32 narrowSse2(__m128 channels)
+{
+    __m128i rounded = _mm_cvtps_epi32(channels);
+    rounded = _mm_packs_epi32(rounded, rounded);
+    return quint32(_mm_cvtsi128_si32(_mm_packus_epi16(rounded, rounded)));
+}
+
+/** every byte of each pixel set to its alpha */
+__attribute__((target("sse2")))
+inline __m128i alphasSse2(__m128i pixels)
+{
+    __m128i alpha = _mm_srli_epi32(pixels, 24);
+    alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 8));
+    return _mm_or_si128(alpha, _mm_slli_epi32(alpha, 16));
+}
+
+__attribute__((target("sse2")))
+void boxSse2(quint32 *dst, const quint32 *src, int length, int stride, int radius)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / (2 * radius + 1));
+    const int last = length - 1;
+
+    // the 16-bit lanes above each channel are zero, so madd multiplies
+    __m128i sums = _mm_madd_epi16(widenSse2(src[0]), _mm_set1_epi32(radius + 1));
+    for(int i = 1; i <= radius; ++i)
+        sums = _mm_add_epi32(sums, widenSse2(src[qMin(i, last) * stride]));
+
+    for(int x = 0; x < length; ++x)
+    {
+        dst[x * stride] = narrowSse2(_mm_mul_ps(_mm_cvtepi32_ps(sums), scale));
+
+        const __m128i entering = widenSse2(src[qMin(x + radius + 1, last) * stride]);
+        const __m128i leaving = widenSse2(src[qMax(x - radius, 0) * stride]);
+        sums = _mm_add_epi32(sums, _mm_sub_epi32(entering, leaving));
+    }
+}
+
+__attribute__((target("sse2")))
+void sharpenSse2(quint32 *pixels, const quint32 *blurred, int length, float amount)
+{
+    const __m128 factor = _mm_set1_ps(amount);
+
+    for(int i = 0; i < length; ++i)
+    {
+        const __m128 original = _mm_cvtepi32_ps(widenSse2(pixels[i]));
+        const __m128 blur = _mm_cvtepi32_ps(widenSse2(blurred[i]));
+        const __m128 value = _mm_add_ps(original,
+                                        _mm_mul_ps(_mm_sub_ps(original, blur), factor));
+
+        const __m128i out = _mm_cvtsi32_si128(int(narrowSse2(value)));
+        pixels[i] = quint32(_mm_cvtsi128_si32(_mm_min_epu8(out, alphasSse2(out))));
+    }
+}
+
+__attribute__((target("sse2")))
+void levelsSse2(quint32 *pixels, int length, float contrast, float brightness)
+{
+    const __m128 half = _mm_set1_ps(128.0f / 255);
+    const __m128 factor = _mm_set1_ps(contrast);
+    const __m128 shift = _mm_set1_ps(brightness);
+
+    for(int i = 0; i < length; ++i)
+    {
+        const __m128 original = _mm_cvtepi32_ps(widenSse2(pixels[i]));
+        const __m128 alpha = _mm_shuffle_ps(original, original, _MM_SHUFFLE(3, 3, 3, 3));
+        const __m128 middle = _mm_mul_ps(alpha, half);
+
+        __m128 value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(original, middle),
+                                                        factor),
+                                             middle),
+                                  _mm_mul_ps(alpha, shift));
+        value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), alpha);
+
+        pixels[i] = (narrowSse2(value) & 0x00ffffff) | (pixels[i] & 0xff000000);
+    }
+}
+
+__attribute__((target("sse2")))
+void invertSse2(quint32 *pixels, int length)
+{
+    const __m128i alphaMask = _mm_set1_epi32(int(0xff000000));
+
+    int i = 0;
+    for(; i + 4 <= length; i += 4)
+    {
+        __m128i *at = reinterpret_cast<__m128i*>(pixels + i);
+        const __m128i four = _mm_loadu_si128(at);
+        const __m128i inverted = _mm_sub_epi8(alphasSse2(four), four);
+        _mm_storeu_si128(at, _mm_or_si128(_mm_andnot_si128(alphaMask, inverted),
+                                          _mm_and_si128(alphaMask, four)));
+    }
+    invertScalar(pixels + i, length - i);
+}
+
+#endif // FILTERS_X86
+
+struct Kernels
+{
+    BoxKernel box;
+    SharpenKernel sharpen;
+    LevelsKernel levels;
+    InvertKernel invert;
+};
+
+Kernels detectKernels()
+{
+#ifdef FILTERS_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2"))
+        return Kernels{boxSse2, sharpenSse2, levelsSse2, invertSse2};
+#endif
+    return Kernels{boxScalar, sharpenScalar, levelsScalar, invertScalar};
+}
+
+const Kernels& kernels()
+{
+    static const Kernels detected = detectKernels();
+    return detected;
+}
+
+/** box blurs in a row that come close to a gaussian */
+const int BOX_PASSES = 3;
+
+/**
+ * @brief boxRadii - the radii of the box blurs whose variances add up to
+ *                   a gaussian's of sigma
+ *
+ */
+QVector<int> boxRadii(qreal sigma)
+{
+    const qreal variance = 12 * sigma * sigma;
+    int lower = qFloor(qSqrt(variance / BOX_PASSES + 1));
+    if(lower % 2 == 0)
+        --lower;
+    const int lowerPasses = qRound((variance - BOX_PASSES * lower * lower
+                                    - 4 * BOX_PASSES * lower - 3 * BOX_PASSES)
+                                   / (-4 * lower - 4));
+
+    QVector<int> radii;
+    for(int i = 0; i < BOX_PASSES; ++i)
+        radii.append(((i < lowerPasses ? lower : lower + 2) - 1) / 2);
+    return radii;
+}
+
+/** a tile of the image being filtered, its part in the area and its bits */
+struct Target
+{
+    QRect part;
+    uchar *bits;
+    int stride;
+};
+
+/**
+ * @brief blur - blur pixels in place with the box blurs, across then
+ *               down, through a scratch image of the same size
+ *
+ */
+void blur(QImage &pixels, const QVector<int> &radii)
+{
+    QImage scratch(pixels.size(), pixels.format());
+    const int stride = pixels.bytesPerLine() / 4;
+    quint32 *from = reinterpret_cast<quint32*>(pixels.bits());
+    quint32 *to = reinterpret_cast<quint32*>(scratch.bits());
+
+    for(int radius : radii)
+    {
+        for(int y = 0; y < pixels.height(); ++y)
+            kernels().box(to + y * stride, from + y * stride, pixels.width(), 1, radius);
+        qSwap(from, to);
+    }
+    for(int radius : radii)
+    {
+        for(int x = 0; x < pixels.width(); ++x)
+            kernels().box(to + x, from + x, pixels.height(), stride, radius);
+        qSwap(from, to);
+    }
+
+    // an even number of passes ends up back in pixels
+    if(from != reinterpret_cast<quint32*>(pixels.bits()))
+        pixels = scratch;
+}
+}
+
+/**
+ * @brief Filter::scaled - the filter for an image scaled by factor, to
+ *                         preview it on a smaller copy
+ *
+ */
+Filter Filter::scaled(qreal factor) const
+{
+    Filter filter = *this;
+    filter.radius *= factor;
+    return filter;
+}
+
+/**
+ * @brief applyFilter - filter the tiles under area in blocks, one block
+ *                      per thread. Blocks are read with a margin of the
+ *                      blur's reach from a shallow copy of the image as it
+ *                      was, and are large enough that the margin doesn't
+ *                      outweigh them.
+ *
+ */
+QRect applyFilter(TiledImage *image, const QRect &area, const Filter &filter)
+{
+    const QRect changed = area.intersected(image->rect());
+    if(changed.isEmpty())
+        return QRect();
+
+    QVector<int> radii;
+    int margin = 0;
+    if(filter.type == blur_filter || filter.type == sharpen_filter)
+    {
+        radii = boxRadii(filter.radius);
+        for(int radius : radii)
+            margin += radius;
+    }
+
+    // take the pixels as they were, then make the tiles writable here,
+    // the workers only write to their bits
+    const TiledImage source = *image;
+    const QRect tiles = image->tilesIn(changed);
+    QVector<Target> targets(tiles.width() * tiles.height());
+    image->process(changed, [&](QImage &tile, const QRect &part, int column, int row)
+    {
+        Target &target = targets[(row - tiles.top()) * tiles.width()
+                                 + column - tiles.left()];
+        target.part = part.translated(image->tileRect(column, row).topLeft());
+        target.bits = tile.bits();
+        target.stride = tile.bytesPerLine() / 4;
+    });
+
+    const int span = qMax(1, (2 * margin + TILE_SIZE - 1) / TILE_SIZE);
+    const int blockColumns = (tiles.width() + span - 1) / span;
+    const int blockRows = (tiles.height() + span - 1) / span;
+
+    parallelFor(blockColumns * blockRows, [&](int index)
+    {
+        const int left = (index % blockColumns) * span;
+        const int top = (index / blockColumns) * span;
+        const int right = qMin(left + span, tiles.width());
+        const int bottom = qMin(top + span, tiles.height());
+
+        QRect block;
+        for(int row = top; row < bottom; ++row)
+            for(int column = left; column < right; ++column)
+                block |= targets.at(row * tiles.width() + column).part;
+
+        // blur and sharpen read the block and what the blur reaches
+        // around it, the other filters only the pixels they change
+        const QRect region = block.adjusted(-margin, -margin, margin, margin)
+                                 .intersected(source.rect());
+        QImage pixels;
+        QImage blurred;
+        if(!radii.isEmpty())
+        {
+            pixels = QImage(region.size(), QImage::Format_ARGB32_Premultiplied);
+            QPainter painter(&pixels);
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            painter.translate(-region.topLeft());
+            source.draw(painter, region);
+            painter.end();
+
+            blurred = pixels.copy();
+            blur(blurred, radii);
+        }
+
+        const float contrast = filter.contrast < 0
+            ? (100 + filter.contrast) / 100.0f
+            : 100.0f / qMax(1, 100 - filter.contrast);
+        const float brightness = filter.brightness / 100.0f;
+        const float amount = filter.amount / 100.0f;
+
+        for(int row = top; row < bottom; ++row)
+        {
+            for(int column = left; column < right; ++column)
+            {
+                const Target &target = targets.at(row * tiles.width() + column);
+                const QRect tile = image->tileRect(column + tiles.left(),
+                                                   row + tiles.top());
+                const QRect &part = target.part;
+
+                for(int y = part.top(); y <= part.bottom(); ++y)
+                {
+                    quint32 *line = reinterpret_cast<quint32*>(target.bits)
+                        + (y - tile.top()) * target.stride + part.left() - tile.left();
+                    const int offset = part.left() - region.left();
+                    const int length = part.width();
+
+                    switch(filter.type)
+                    {
+                    case blur_filter:
+                        memcpy(line, reinterpret_cast<const quint32*>(
+                                   blurred.constScanLine(y - region.top())) + offset,
+                               length * 4);
+                        break;
+                    case sharpen_filter:
+                        memcpy(line, reinterpret_cast<const quint32*>(
+                                   pixels.constScanLine(y - region.top())) + offset,
+                               length * 4);
+                        kernels().sharpen(line, reinterpret_cast<const quint32*>(
+                                              blurred.constScanLine(y - region.top()))
+                                              + offset,
+                                          length, amount);
+                        break;
+                    case brightness_contrast_filter:
+                        kernels().levels(line, length, contrast, brightness);
+                        break;
+                    case invert_filter:
+                        kernels().invert(line, length);
+                        break;
+                    }
+                }
+            }
+        }
+    });
+
+    return changed;
+}
@@ -0,0 +1,45 @@
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include <QRect>
+
+#include "constants.h"
+#include "tiled_image.h"
+
+
+/**
+ * a filter of the Filters menu and its settings:
+ *
+ *   - blur: gaussian blur of radius (its standard deviation), made of
+ *     three running-sum box blurs across then down
+ *   - sharpen: unsharp mask, the difference from the same blur added
+ *     back amount percent
+ *   - brightness/contrast: brightness -100 to 100 shifts the channels by
+ *     up to their whole range, contrast -100 to 100 flattens them to grey
+ *     or stretches them away from it
+ *   - invert: the negative
+ */
+struct Filter
+{
+    Filter()
+        : type(blur_filter), radius(DEFAULT_BLUR_RADIUS),
+          amount(DEFAULT_SHARPEN_AMOUNT), brightness(0), contrast(0) {}
+
+    Filter scaled(qreal factor) const;
+
+    FilterType type;
+    qreal radius;
+    int amount;
+    int brightness;
+    int contrast;
+};
+
+/**
+ * run a filter over area of a premultiplied ARGB32 or RGB32 tiled image,
+ * in blocks of tiles spread across threads by parallelFor. Every block is
+ * filtered from the pixels around it as they were before, inner loops use
+ * SSE2 when the CPU has it. Returns the area changed.
+ */
+QRect applyFilter(TiledImage*, const QRect &area, const Filter&);
+
+#endif // FILTERS_H
@@ -0,0 +1,201 @@
+#include <QBitArray>
+#include <QVector>
+#include <cstring>
+
+#include "blend.h"
+#include "flood_fill.h"
+#include "parallel.h"
+
+
+namespace
+{
+/** a row of full coverage, to paint spans with paintCoverage */
+struct FullCoverage
+{
+    FullCoverage() { memset(bytes, 255, sizeof(bytes)); }
+    uchar bytes[TILE_SIZE];
+};
+
+/** a run of filled pixels on a row, ends included */
+struct Span
+{
+    int y;
+    int left;
+    int right;
+};
+
+/**
+ * read only access to the pixels of a tiled image, unallocated tiles read
+ * as the fill color
+ */
+class Pixels
+{
+public:
+    explicit Pixels(const TiledImage &image)
+        : columns(image.columns()), fill(0)
+    {
+        const int count = image.columns() * image.rows();
+        tiles.resize(count);
+        bits.resize(count);
+        strides.resize(count);
+        for(int row = 0; row < image.rows(); ++row)
+        {
+            for(int column = 0; column < image.columns(); ++column)
+            {
+                const int index = row * columns + column;
+                tiles[index] = image.tile(column, row);
+                if(tiles.at(index).isNull())
+                    continue;
+                bits[index] = reinterpret_cast<const quint32*>(tiles.at(index).constBits());
+                strides[index] = tiles.at(index).bytesPerLine() / 4;
+            }
+        }
+
+        QImage pixel(1, 1, image.format());
+        pixel.fill(image.fillColor());
+        fill = reinterpret_cast<const quint32*>(pixel.constBits())[0];
+    }
+
+    quint32 at(int x, int y) const
+    {
+        const int index = (y / TILE_SIZE) * columns + x / TILE_SIZE;
+        const quint32 *tile = bits.at(index);
+        if(!tile)
+            return fill;
+        return tile[(y % TILE_SIZE) * strides.at(index) + x % TILE_SIZE];
+    }
+
+private:
+    int columns;
+    quint32 fill;
+    QVector<QImage> tiles;
+    QVector<const quint32*> bits;
+    QVector<int> strides;
+};
+
+/** true if every channel of pixel is within tolerance of target's */
+inline bool matches(quint32 pixel, quint32 target, int tolerance)
+{
+    if(pixel == target)
+        return true;
+
+    for(int shift = 0; shift < 32; shift += 8)
+    {
+        int difference = int((pixel >> shift) & 0xff) - int((target >> shift) & 0xff);
+        if(difference > tolerance || difference < -tolerance)
+            return false;
+    }
+    return true;
+}
+}
+
+/**
+ * @brief floodFill - scanline fill with a stack of seeds. Every seed is
+ *                    grown into the widest span of matching, unvisited
+ *                    pixels on its row, and the rows above and below the
+ *                    span are searched for new seeds. Spans are collected
+ *                    per row of tiles and painted once the region is
+ *                    known, so a fill color within tolerance of the
+ *                    target can't be filled twice.
+ *
+ */
+QRect floodFill(TiledImage *image, const QPoint &seed, const QColor &color,
+                int tolerance)
+{
+    if(!image->rect().contains(seed))
+        return QRect();
+
+    const int width = image->width();
+    const int height = image->height();
+    const Pixels pixels(*image);
+    const quint32 target = pixels.at(seed.x(), seed.y());
+
+    QBitArray visited(width * height);
+    QVector<QVector<Span> > bands(image->rows());
+    QVector<bool> touched(image->columns() * image->rows());
+    QRect filled;
+
+    auto open = [&](int x, int y)
+    {
+        return !visited.testBit(y * width + x)
+            && matches(pixels.at(x, y), target, tolerance);
+    };
+
+    QVector<QPoint> seeds;
+    seeds.append(seed);
+    while(!seeds.isEmpty())
+    {
+        const QPoint point = seeds.takeLast();
+        const int y = point.y();
+        if(!open(point.x(), y))
+            continue;
+
+        int left = point.x();
+        int right = point.x();
+        while(left > 0 && open(left - 1, y))
+            --left;
+        while(right < width - 1 && open(right + 1, y))
+            ++right;
+
+        visited.fill(true, y * width + left, y * width + right + 1);
+        bands[y / TILE_SIZE].append(Span{y, left, right});
+        for(int column = left / TILE_SIZE; column <= right / TILE_SIZE; ++column)
+            touched[(y / TILE_SIZE) * image->columns() + column] = true;
+        filled |= QRect(left, y, right - left + 1, 1);
+
+        // one seed per run of open pixels next to the span
+        for(int next = y - 1; next <= y + 1; next += 2)
+        {
+            if(next < 0 || next >= height)
+                continue;
+
+            bool run = false;
+            for(int x = left; x <= right; ++x)
+            {
+                bool isOpen = open(x, next);
+                if(isOpen && !run)
+                    seeds.append(QPoint(x, next));
+                run = isOpen;
+            }
+        }
+    }
+
+    // make the touched tiles writable here, the workers only paint them
+    QVector<uchar*> bits(touched.size());
+    QVector<int> strides(touched.size());
+    for(int index = 0; index < touched.size(); ++index)
+    {
+        if(!touched.at(index))
+            continue;
+
+        QRect tile = image->tileRect(index % image->columns(),
+                                     index / image->columns());
+        image->process(tile, [&](QImage &writable, const QRect&, int, int)
+        {
+            bits[index] = writable.bits();
+            strides[index] = writable.bytesPerLine() / 4;
+        });
+    }
+
+    static const FullCoverage full;
+    const quint32 premultiplied = qPremultiply(color.rgba());
+    parallelFor(bands.size(), [&](int band)
+    {
+        for(const Span &span : bands.at(band))
+        {
+            // paint the span a tile at a time
+            for(int x = span.left; x <= span.right;)
+            {
+                const int index = band * image->columns() + x / TILE_SIZE;
+                const int length = qMin(span.right + 1 - x,
+                                        TILE_SIZE - x % TILE_SIZE);
+                quint32 *line = reinterpret_cast<quint32*>(bits.at(index))
+                    + (span.y % TILE_SIZE) * strides.at(index) + x % TILE_SIZE;
+                paintCoverage(line, line, full.bytes, premultiplied, length);
+                x += length;
+            }
+        }
+    });
+
+    return filled;
+}
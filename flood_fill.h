@@ -0,0 +1,19 @@
+#ifndef FLOOD_FILL_H
+#define FLOOD_FILL_H
+
+#include <QColor>
+#include <QPoint>
+#include <QRect>
+
+#include "tiled_image.h"
+
+
+/**
+ * fill the region of pixels connected to seed whose channels are all
+ * within tolerance (0-255) of the seed's, drawing color over them. The
+ * region is found span by span on the raw tile bits, then its spans are
+ * painted a row of tiles per thread. Returns the area filled.
+ */
+QRect floodFill(TiledImage*, const QPoint &seed, const QColor&, int tolerance);
+
+#endif // FLOOD_FILL_H
@@ -0,0 +1,368 @@
+#include <climits>
+#include <cstring>
+
+#include <QFile>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QtEndian>
+
+#include "image_loader.h"
+#include "qoi.h"
+#include "tiled_image.h"
+
+
+namespace
+{
+const int BMP_FILE_HEADER_SIZE = 14;
+const int BMP_INFO_HEADER_SIZE = 40;
+const quint32 BMP_UNCOMPRESSED = 0;
+
+/** where the pixels of an uncompressed 24 or 32 bit BMP are */
+struct BmpLayout
+{
+    QSize size;
+    int bytesPerPixel;
+    qint64 offset;
+    qint64 stride;
+    bool topDown;
+};
+
+/**
+ * @brief parseBmp - the layout of the BMP in the size bytes at data, false
+ *                   unless it is one the lines can be read straight out of
+ *
+ */
+bool parseBmp(const uchar *data, qint64 size, BmpLayout *layout)
+{
+    if(size < BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE
+       || data[0] != 'B' || data[1] != 'M')
+        return false;
+
+    const uchar *info = data + BMP_FILE_HEADER_SIZE;
+    const qint32 width = qFromLittleEndian<qint32>(info + 4);
+    const qint32 height = qFromLittleEndian<qint32>(info + 8);
+    const quint16 bits = qFromLittleEndian<quint16>(info + 14);
+    if(qFromLittleEndian<quint32>(info) < quint32(BMP_INFO_HEADER_SIZE)
+       || qFromLittleEndian<quint32>(info + 16) != BMP_UNCOMPRESSED
+       || (bits != 24 && bits != 32)
+       || width <= 0 || height == 0 || height == INT_MIN
+       || width > 32768 || qAbs(height) > 32768)
+        return false;
+
+    layout->size = QSize(width, qAbs(height));
+    layout->bytesPerPixel = bits / 8;
+    layout->offset = qFromLittleEndian<quint32>(data + 10);
+    layout->stride = (qint64(width) * bits + 31) / 32 * 4;
+    layout->topDown = height < 0;
+    return layout->offset + layout->stride * layout->size.height() <= size;
+}
+}
+
+/** reads a file and hands it to the loader a strip at a time */
+class ImageLoader::Job : public QRunnable
+{
+public:
+    Job(ImageLoader *loader, int load, const QString &fileName,
+        const QColor &fill)
+        : loader(loader), load(load), fileName(fileName), fill(fill) {}
+
+    void run() override
+    {
+        QString error = read();
+        loader->postEnd(load, error);
+    }
+
+private:
+    bool cancelled() const { return loader->generation.loadAcquire() != load; }
+
+    QString read()
+    {
+        QFile file(fileName);
+        if(!file.open(QIODevice::ReadOnly))
+            return file.errorString();
+
+        // the formats we decode ourselves are read in place, the others
+        // go through Qt
+        const qint64 size = file.size();
+        const uchar *data = size > 0 ? file.map(0, size) : 0;
+        if(data)
+        {
+            BmpLayout bmp;
+            if(parseBmp(data, size, &bmp))
+            {
+                return readLines(bmp.size, false, [&](int y, QRgb *line)
+                {
+                    const int row = bmp.topDown ? y : bmp.size.height() - 1 - y;
+                    const uchar *in = data + bmp.offset + row * bmp.stride;
+                    for(int x = 0; x < bmp.size.width(); ++x)
+                    {
+                        line[x] = qRgb(in[2], in[1], in[0]);
+                        in += bmp.bytesPerPixel;
+                    }
+                    return true;
+                });
+            }
+
+            QoiDecoder qoi(data, size);
+            if(qoi.isValid())
+            {
+                return readLines(qoi.size(), qoi.hasAlphaChannel(),
+                                 [&](int, QRgb *line)
+                {
+                    return qoi.readLine(line);
+                });
+            }
+        }
+
+        QImageReader reader(&file);
+        QImage image = reader.read();
+        if(image.isNull())
+            return reader.errorString();
+
+        // converted a strip at a time, not as a second whole image
+        const QImage::Format format = TiledImage::formatFor(fill,
+                                                            image.hasAlphaChannel());
+        QImage strip;
+        int top = 0;
+        return readLines(image.size(), image.hasAlphaChannel(),
+                         [&](int y, QRgb *line)
+        {
+            if(strip.isNull() || y >= top + strip.height())
+            {
+                top = y;
+                strip = image.copy(0, top, image.width(), TILE_SIZE)
+                             .convertToFormat(format);
+            }
+            memcpy(line, strip.constScanLine(y - top), image.width() * 4);
+            return true;
+        });
+    }
+
+    /**
+     * cut the lines readLine(y, line) reads, as premultiplied ARGB32, into
+     * strips of tiles
+     */
+    template<typename ReadLine>
+    QString readLines(const QSize &size, bool alpha, ReadLine readLine)
+    {
+        const QImage::Format format = TiledImage::formatFor(fill, alpha);
+        const int columns = (size.width() + TILE_SIZE - 1) / TILE_SIZE;
+        const int rows = (size.height() + TILE_SIZE - 1) / TILE_SIZE;
+        loader->postStart(load, size, format);
+
+        QVector<QRgb> line(size.width());
+        for(int row = 0; row < rows; ++row)
+        {
+            if(cancelled())
+                return QString();
+
+            Strip strip;
+            strip.row = row;
+            const int height = qMin(TILE_SIZE, size.height() - row * TILE_SIZE);
+            for(int column = 0; column < columns; ++column)
+                strip.tiles.append(QImage(qMin(TILE_SIZE,
+                                               size.width() - column * TILE_SIZE),
+                                          height, format));
+
+            for(int y = 0; y < height; ++y)
+            {
+                if(!readLine(row * TILE_SIZE + y, line.data()))
+                    return QObject::tr("The file ends before the image does.");
+
+                for(int column = 0; column < columns; ++column)
+                {
+                    QImage &tile = strip.tiles[column];
+                    memcpy(tile.scanLine(y), line.constData() + column * TILE_SIZE,
+                           tile.width() * 4);
+                }
+            }
+            loader->postStrip(load, strip, rows);
+        }
+        return QString();
+    }
+
+    ImageLoader *loader;
+    int load;
+    QString fileName;
+    QColor fill;
+};
+
+ImageLoader::ImageLoader(QObject *parent)
+    : QObject(parent), loading(false), posted(false), starting(false),
+      format(QImage::Format_RGB32), done(0), total(0), ended(false)
+{
+    // one thread, a cancelled load is over before the next one starts
+    pool.setMaxThreadCount(1);
+}
+
+ImageLoader::~ImageLoader()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+/**
+ * @brief ImageLoader::load - start reading fileName, cancelling the load
+ *                            in progress. Opaque images are tiled like
+ *                            a TiledImage filled with fill.
+ *
+ */
+void ImageLoader::load(const QString &fileName, const QColor &fill)
+{
+    cancel();
+    this->fileName = fileName;
+    loading = true;
+    pool.start(new Job(this, generation.loadAcquire(), fileName, fill));
+}
+
+/**
+ * @brief ImageLoader::cancel - stop the load in progress, whatever it read
+ *                              and wasn't delivered yet is dropped
+ *
+ */
+void ImageLoader::cancel()
+{
+    generation.ref();
+
+    QMutexLocker locker(&mutex);
+    starting = false;
+    strips.clear();
+    done = total = 0;
+    ended = false;
+    error.clear();
+
+    ready.clear();
+    loading = false;
+}
+
+/**
+ * @brief ImageLoader::takeStrips - the strips loaded since the last call
+ *
+ */
+QVector<ImageLoader::Strip> ImageLoader::takeStrips()
+{
+    QVector<Strip> taken;
+    taken.swap(ready);
+    return taken;
+}
+
+/**
+ * @brief ImageLoader::deliver - emit what the thread handed over since the
+ *                               last delivery, stopping if a slot cancels
+ *                               the load
+ *
+ */
+void ImageLoader::deliver()
+{
+    const int current = generation.loadAcquire();
+
+    QMutexLocker locker(&mutex);
+    posted = false;
+    const bool start = starting;
+    const QSize startSize = size;
+    const QImage::Format startFormat = format;
+    starting = false;
+    QVector<Strip> arrived;
+    arrived.swap(strips);
+    const bool end = ended;
+    ended = false;
+    const int stripsDone = done;
+    const int stripsTotal = total;
+    const QString failure = error;
+    locker.unlock();
+
+    if(!loading)
+        return;
+
+    if(start)
+    {
+        emit started(startSize, startFormat);
+        if(generation.loadAcquire() != current)
+            return;
+    }
+
+    if(!arrived.isEmpty())
+    {
+        ready += arrived;
+        emit stripsLoaded();
+        if(generation.loadAcquire() != current)
+            return;
+        emit progress(stripsDone, stripsTotal);
+        if(generation.loadAcquire() != current)
+            return;
+    }
+
+    if(end)
+    {
+        loading = false;
+        if(failure.isEmpty())
+            emit loaded(fileName);
+        else
+            emit loadFailed(fileName, failure);
+    }
+}
+
+/**
+ * @brief ImageLoader::postStart - called by the thread once it knows the
+ *                                 size of the image
+ *
+ */
+void ImageLoader::postStart(int load, const QSize &size, QImage::Format format)
+{
+    QMutexLocker locker(&mutex);
+    if(load != generation.loadAcquire())
+        return;
+
+    starting = true;
+    this->size = size;
+    this->format = format;
+    post();
+}
+
+/**
+ * @brief ImageLoader::postStrip - called by the thread for every strip it
+ *                                 read, total is the number of strips
+ *
+ */
+void ImageLoader::postStrip(int load, const Strip &strip, int total)
+{
+    QMutexLocker locker(&mutex);
+    if(load != generation.loadAcquire())
+        return;
+
+    strips.append(strip);
+    ++done;
+    this->total = total;
+    post();
+}
+
+/**
+ * @brief ImageLoader::postEnd - called by the thread once it is done, with
+ *                               an empty error if it read the whole image
+ *
+ */
+void ImageLoader::postEnd(int load, const QString &error)
+{
+    QMutexLocker locker(&mutex);
+    if(load != generation.loadAcquire())
+        return;
+
+    ended = true;
+    this->error = error;
+    post();
+}
+
+/**
+ * @brief ImageLoader::post - have deliver() run on the loader's thread,
+ *                            called with the mutex held
+ *
+ */
+void ImageLoader::post()
+{
+    if(posted)
+        return;
+
+    posted = true;
+    QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
+}
@@ -0,0 +1,87 @@
+#ifndef IMAGE_LOADER_H
+#define IMAGE_LOADER_H
+
+#include <QAtomicInt>
+#include <QColor>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+
+
+/**
+ * reads images from files on a thread of its own and hands them over a
+ * strip of tiles at a time, so the canvas fills in while the rest is
+ * still being read. Uncompressed BMP and QOI files are memory mapped and
+ * decoded a line at a time straight into the tiles, the other formats are
+ * decoded by Qt on the thread and then cut into strips. Starting another
+ * load cancels the one in progress, nothing of it is handed over after.
+ *
+ * The signals are only emitted on the thread the loader lives on, in the
+ * order started, stripsLoaded and progress any number of times, then
+ * loaded or loadFailed.
+ */
+class ImageLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    /** a row of tiles of the image, left to right */
+    struct Strip
+    {
+        int row;
+        QVector<QImage> tiles;
+    };
+
+    ImageLoader(QObject *parent = 0);
+    ~ImageLoader();
+
+    void load(const QString &fileName, const QColor &fill);
+    void cancel();
+    bool isLoading() const { return loading; }
+    QVector<Strip> takeStrips();
+
+signals:
+    void started(const QSize&, QImage::Format);
+    void stripsLoaded();
+    void progress(int done, int total);
+    void loaded(const QString &fileName);
+    void loadFailed(const QString &fileName, const QString &error);
+
+private slots:
+    void deliver();
+
+private:
+    class Job;
+    friend class Job;
+
+    void postStart(int load, const QSize&, QImage::Format);
+    void postStrip(int load, const Strip&, int total);
+    void postEnd(int load, const QString &error);
+    void post();
+
+    QThreadPool pool;
+    QAtomicInt generation;
+    bool loading;
+    QString fileName;
+    QVector<Strip> ready;
+
+    /** handed over by the thread, not delivered yet */
+    QMutex mutex;
+    bool posted;
+    bool starting;
+    QSize size;
+    QImage::Format format;
+    QVector<Strip> strips;
+    int done;
+    int total;
+    bool ended;
+    QString error;
+
+    ImageLoader(const ImageLoader&);
+    ImageLoader& operator=(const ImageLoader&);
+};
+
+#endif // IMAGE_LOADER_H
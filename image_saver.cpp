@@ -0,0 +1,168 @@
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QPainter>
+#include <QRunnable>
+#include <QSaveFile>
+
+#include "image_saver.h"
+#include "qoi.h"
+
+
+namespace
+{
+/** puts the tiles together, encodes the image and writes it out */
+class SaveJob : public QRunnable
+{
+public:
+    SaveJob(ImageSaver *saver, const QVector<QImage> &tiles, const QSize &size,
+            bool opaque, const QString &fileName, ImageFormat format,
+            int compression)
+        : saver(saver), tiles(tiles), size(size), opaque(opaque),
+          fileName(fileName), format(format), compression(compression) {}
+
+    void run() override
+    {
+        QString error;
+        if(write(&error))
+            emit saver->saved(fileName);
+        else
+            emit saver->saveFailed(fileName, error);
+    }
+
+private:
+    QImage assemble()
+    {
+        QImage image(size, opaque ? QImage::Format_RGB32
+                                  : QImage::Format_ARGB32_Premultiplied);
+        if(image.isNull())
+            return image;
+
+        // the last tiles of a row or column may stick out of the image
+        const int columns = (size.width() + TILE_SIZE - 1) / TILE_SIZE;
+        QPainter painter(&image);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        for(int i = 0; i < tiles.size(); ++i)
+            painter.drawImage(QPoint(i % columns, i / columns) * TILE_SIZE,
+                              tiles.at(i));
+        painter.end();
+
+        // the worker holds the only reference to the tiles left
+        tiles.clear();
+        return image;
+    }
+
+    bool write(QString *error)
+    {
+        const QImage image = assemble();
+        if(image.isNull())
+        {
+            *error = QObject::tr("Not enough memory for the image.");
+            return false;
+        }
+        return ImageSaver::write(image, fileName, format, compression, error);
+    }
+
+    ImageSaver *saver;
+    QVector<QImage> tiles;
+    QSize size;
+    bool opaque;
+    QString fileName;
+    ImageFormat format;
+    int compression;
+};
+}
+
+ImageSaver::ImageSaver(QObject *parent)
+    : QObject(parent)
+{
+    // one thread, so files are written in the order they were saved
+    pool.setMaxThreadCount(1);
+}
+
+ImageSaver::~ImageSaver()
+{
+    // don't lose a file being written when the window closes
+    pool.waitForDone();
+}
+
+/**
+ * @brief ImageSaver::save - write the image made of tiles, row by row, to
+ *                           fileName in format. compression is the zlib
+ *                           level of PNGs. Returns at once, saved or
+ *                           saveFailed is emitted once done.
+ *
+ */
+void ImageSaver::save(const QVector<QImage> &tiles, const QSize &size,
+                      bool opaque, const QString &fileName,
+                      ImageFormat format, int compression)
+{
+    compression = qBound(MIN_PNG_COMPRESSION, compression, MAX_PNG_COMPRESSION);
+    pool.start(new SaveJob(this, tiles, size, opaque, fileName, format,
+                           compression));
+}
+
+/**
+ * @brief ImageSaver::write - encode image as format and write it to
+ *                            fileName on the calling thread, through a
+ *                            temporary file. compression is the zlib level
+ *                            of PNGs.
+ *
+ */
+bool ImageSaver::write(const QImage &image, const QString &fileName,
+                       ImageFormat format, int compression, QString *error)
+{
+    QSaveFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        *error = file.errorString();
+        return false;
+    }
+
+    if(format == qoi_format)
+    {
+        const QByteArray data = encodeQoi(image);
+        if(file.write(data) != data.size())
+        {
+            *error = file.errorString();
+            return false;
+        }
+    }
+    else
+    {
+        QImageWriter writer(&file, format == png_format ? "PNG" : "BMP");
+        if(format == png_format)
+        {
+            // the PNG writer maps quality 100..0 onto zlib level 0..9
+            compression = qBound(MIN_PNG_COMPRESSION, compression,
+                                 MAX_PNG_COMPRESSION);
+            writer.setQuality(100 - (compression * 91 + 8) / 9);
+        }
+        if(!writer.write(image))
+        {
+            *error = writer.errorString();
+            return false;
+        }
+    }
+
+    if(!file.commit())
+    {
+        *error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief ImageSaver::formatOf - the format a file name's suffix asks for,
+ *                               PNG when there is none we know
+ *
+ */
+ImageFormat ImageSaver::formatOf(const QString &fileName)
+{
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    if(suffix == "qoi")
+        return qoi_format;
+    if(suffix == "bmp")
+        return bmp_format;
+    return png_format;
+}
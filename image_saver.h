@@ -0,0 +1,47 @@
+#ifndef IMAGE_SAVER_H
+#define IMAGE_SAVER_H
+
+#include <QImage>
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+
+#include "constants.h"
+
+
+/**
+ * writes images to files on a thread of its own, one file after the
+ * other in the order they were asked for. It is handed the tiles of the
+ * image, which are shared copy-on-write with the canvas, so asking takes
+ * no copy and drawing can go on while the file is written. Files are
+ * written to a temporary file first and only replace the old file once
+ * complete.
+ */
+class ImageSaver : public QObject
+{
+    Q_OBJECT
+
+public:
+    ImageSaver(QObject *parent = 0);
+    ~ImageSaver();
+
+    void save(const QVector<QImage> &tiles, const QSize&, bool opaque,
+              const QString &fileName, ImageFormat, int compression);
+
+    static bool write(const QImage&, const QString &fileName, ImageFormat,
+                      int compression, QString *error);
+    static ImageFormat formatOf(const QString &fileName);
+
+signals:
+    void saved(const QString &fileName);
+    void saveFailed(const QString &fileName, const QString &error);
+
+private:
+    QThreadPool pool;
+
+    ImageSaver(const ImageSaver&);
+    ImageSaver& operator=(const ImageSaver&);
+};
+
+#endif // IMAGE_SAVER_H
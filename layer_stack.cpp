@@ -0,0 +1,456 @@
+#include "blend.h"
+#include "layer_stack.h"
+#include "parallel.h"
+
+
+/**
+ * @brief LayerStack::LayerStack - a stack with a single, empty
+ *                                 background layer
+ *
+ */
+LayerStack::LayerStack()
+    : current(0), generation(0)
+{
+    reset(TiledImage());
+}
+
+LayerStack::~LayerStack()
+{
+    qDeleteAll(layers);
+}
+
+/**
+ * @brief LayerStack::setCurrentIndex - choose the layer the tools draw on
+ *
+ */
+void LayerStack::setCurrentIndex(int index)
+{
+    current = qBound(0, index, count() - 1);
+}
+
+/**
+ * @brief LayerStack::reset - replace every layer with a single background
+ *                            layer holding image, a vector layer with an
+ *                            empty scene if vector
+ *
+ */
+void LayerStack::reset(const TiledImage &image, bool vector)
+{
+    Layer *background = new Layer;
+    background->image = image;
+    background->style.name = QString("Background");
+    if(vector)
+        background->scene = new VectorScene;
+
+    layers.clear();
+    layers.append(background);
+    current = 0;
+    changed();
+}
+
+/**
+ * @brief LayerStack::scaled - replace every layer with a copy scaled to
+ *                            size. The pixels of raster layers are given
+ *                            already scaled, bottom first, as resampling
+ *                            them takes a while, see TiledImage::scaled.
+ *
+ */
+void LayerStack::scaled(const QSize &size, const QVector<TiledImage> &images)
+{
+    for(int i = 0; i < count(); ++i)
+    {
+        const Layer *old = layers.at(i);
+        Layer *layer = new Layer;
+        layer->style = old->style;
+        if(old->isVector())
+        {
+            // shapes are scaled rather than their pixels
+            qreal sx = qreal(size.width()) / old->image.width();
+            qreal sy = qreal(size.height()) / old->image.height();
+            layer->scene = old->scene->scaled(sx, sy);
+            layer->image = TiledImage(size, Qt::transparent);
+            layer->scene->render(&layer->image, layer->image.rect());
+        }
+        else
+        {
+            layer->image = images.at(i);
+        }
+        layers[i] = layer;
+    }
+    changed();
+}
+
+/**
+ * @brief LayerStack::insert - add a transparent layer at index and make it
+ *                             the current one, a vector layer keeps the
+ *                             shapes drawn on it
+ *
+ */
+Layer* LayerStack::insert(int index, const QString &name, bool vector)
+{
+    Layer *layer = new Layer;
+    layer->image = TiledImage(size(), Qt::transparent);
+    layer->style.name = name;
+    if(vector)
+        layer->scene = new VectorScene;
+
+    current = qBound(0, index, count());
+    layers.insert(current, layer);
+    changed();
+    return layer;
+}
+
+/**
+ * @brief LayerStack::take - remove the layer at index, the last layer
+ *                           can't be removed
+ *
+ */
+Layer* LayerStack::take(int index)
+{
+    if(count() == 1 || index < 0 || index >= count())
+        return 0;
+
+    Layer *layer = layers.takeAt(index);
+    if(current > index || current == count())
+        --current;
+    changed();
+    return layer;
+}
+
+/**
+ * @brief LayerStack::move - move a layer up or down the stack, the current
+ *                           layer stays current
+ *
+ */
+void LayerStack::move(int from, int to)
+{
+    if(from < 0 || from >= count() || to < 0 || to >= count() || from == to)
+        return;
+
+    Layer *layer = currentLayer();
+    layers.move(from, to);
+    current = layers.indexOf(layer);
+    changed();
+}
+
+/**
+ * @brief LayerStack::setStyle - change how a layer is blended
+ *
+ */
+void LayerStack::setStyle(int index, const LayerStyle &style)
+{
+    layers.at(index)->style = style;
+    changed();
+}
+
+/**
+ * @brief LayerStack::state - the current order and styles of the layers
+ *
+ */
+LayerStack::State LayerStack::state() const
+{
+    State state;
+    state.layers = layers;
+    for(const Layer *layer : layers)
+        state.styles.append(layer->style);
+    state.current = current;
+    return state;
+}
+
+/**
+ * @brief LayerStack::restore - go back to an earlier state
+ *
+ */
+void LayerStack::restore(const State &state)
+{
+    layers = state.layers;
+    for(int i = 0; i < layers.size(); ++i)
+        layers.at(i)->style = state.styles.at(i);
+    current = state.current;
+    changed();
+}
+
+/**
+ * @brief LayerStack::draw - draw part of the flattened layers at the same
+ *                           coordinates, over white where they are not
+ *                           opaque. Only the tiles that changed since they
+ *                           were last drawn are blended again.
+ *
+ */
+void LayerStack::draw(QPainter &painter, const QRect &area)
+{
+    QRect visible = area.intersected(rect());
+    if(visible.isEmpty())
+        return;
+
+    const TiledImage &base = layers.first()->image;
+    QRect range = base.tilesIn(visible);
+    QVector<QImage> tiles = compositeTiles(range);
+
+    for(int row = range.top(); row <= range.bottom(); ++row)
+    {
+        for(int column = range.left(); column <= range.right(); ++column)
+        {
+            QRect bounds = base.tileRect(column, row);
+            QRect target = bounds.intersected(visible);
+            const QImage &tile = tiles.at((row - range.top()) * range.width()
+                                          + column - range.left());
+
+            if(tile.hasAlphaChannel())
+                painter.fillRect(target, Qt::white);
+            painter.drawImage(target, tile,
+                              target.translated(-bounds.topLeft()));
+        }
+    }
+}
+
+/**
+ * @brief LayerStack::toImage - flatten the layers into a single image
+ *
+ */
+QImage LayerStack::toImage()
+{
+    if(isNull())
+        return QImage();
+
+    const TiledImage &base = layers.first()->image;
+    QRect range(0, 0, base.columns(), base.rows());
+    QVector<QImage> tiles = compositeTiles(range);
+
+    QImage image(size(), QImage::Format_ARGB32_Premultiplied);
+    QPainter painter(&image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for(int row = 0; row < base.rows(); ++row)
+        for(int column = 0; column < base.columns(); ++column)
+            painter.drawImage(base.tileRect(column, row).topLeft(),
+                              tiles.at(row * base.columns() + column));
+    return image;
+}
+
+/**
+ * @brief LayerStack::compositeTiles - the flattened tiles in range (in
+ *                                     tile columns and rows), row by
+ *                                     row. The tiles are independent, so
+ *                                     the stale ones are blended on the
+ *                                     thread pool.
+ *
+ */
+QVector<QImage> LayerStack::compositeTiles(const QRect &range)
+{
+    prepareCache();
+
+    // the caches must not be shared, or the workers would each detach them
+    composite.detach();
+    below.detach();
+    above.detach();
+
+    QVector<QImage> tiles(range.width() * range.height());
+    parallelFor(tiles.size(), [&](int i)
+    {
+        tiles[i] = compositeTile(range.left() + i % range.width(),
+                                 range.top() + i / range.width());
+    });
+    return tiles;
+}
+
+void LayerStack::changed()
+{
+    ++generation;
+}
+
+/**
+ * @brief LayerStack::prepareCache - start over with empty caches when the
+ *                                   size of the layers changed
+ *
+ */
+void LayerStack::prepareCache()
+{
+    if(cacheSize == size())
+        return;
+
+    const TiledImage &base = layers.first()->image;
+    cacheSize = size();
+    composite = QVector<CachedTile>(base.columns() * base.rows());
+    below = QVector<CachedTile>(base.columns() * base.rows());
+    above = QVector<CachedTile>(base.columns() * base.rows());
+}
+
+/**
+ * @brief LayerStack::aboveIsSourceOver - true if every visible layer above
+ *                                        the current one is blended
+ *                                        normally, those can be flattened
+ *                                        on their own first
+ *
+ */
+bool LayerStack::aboveIsSourceOver() const
+{
+    for(int i = current + 1; i < count(); ++i)
+        if(layers.at(i)->style.visible
+           && layers.at(i)->style.blend != QPainter::CompositionMode_SourceOver)
+            return false;
+    return true;
+}
+
+/**
+ * @brief LayerStack::tileKeys - what a tile flattened from the visible
+ *                               layers first to last (excluded) is made of
+ *
+ */
+QVector<qint64> LayerStack::tileKeys(int first, int last,
+                                     int column, int row) const
+{
+    QVector<qint64> keys;
+    keys << generation << first << last;
+    for(int i = first; i < last; ++i)
+    {
+        const Layer *layer = layers.at(i);
+        if(!layer->style.visible)
+            continue;
+
+        // unallocated tiles are told apart by their fill color
+        QImage tile = layer->image.tile(column, row);
+        if(tile.isNull())
+            keys << -1 - qint64(layer->image.fillColor().rgba());
+        else
+            keys << tile.cacheKey();
+    }
+    return keys;
+}
+
+/**
+ * @brief LayerStack::flatten - blend the visible layers first to last
+ *                              (excluded) of a tile onto a transparent
+ *                              tile, null if none of them is visible
+ *
+ */
+QImage LayerStack::flatten(int first, int last, int column, int row) const
+{
+    QImage result;
+    for(int i = first; i < last; ++i)
+    {
+        if(!layers.at(i)->style.visible)
+            continue;
+
+        if(result.isNull())
+        {
+            result = QImage(layers.at(i)->image.tileRect(column, row).size(),
+                            QImage::Format_ARGB32_Premultiplied);
+            result.fill(Qt::transparent);
+        }
+        blend(result, layers.at(i), column, row);
+    }
+    return result;
+}
+
+/**
+ * @brief LayerStack::blend - draw a layer's tile onto target with the
+ *                            layer's opacity and blend mode, with the
+ *                            vectorised kernels when there is one for
+ *                            the mode
+ *
+ */
+void LayerStack::blend(QImage &target, const Layer *layer,
+                       int column, int row) const
+{
+    if(!layer->style.visible)
+        return;
+
+    // a transparent source leaves the tile alone in every mode we offer
+    QImage tile = layer->image.tile(column, row);
+    if(tile.isNull() && layer->image.fillColor().alpha() == 0)
+        return;
+
+    if(!tile.isNull() && blendImage(target, tile, layer->style.blend,
+                                    qRound(layer->style.opacity * 255)))
+        return;
+
+    QPainter painter(&target);
+    painter.setOpacity(layer->style.opacity);
+    painter.setCompositionMode(layer->style.blend);
+    if(tile.isNull())
+        painter.fillRect(QRect(QPoint(0, 0),
+                               layer->image.tileRect(column, row).size()),
+                         layer->image.fillColor());
+    else
+        painter.drawImage(0, 0, tile);
+}
+
+/**
+ * @brief LayerStack::cachedTile - a tile flattened from the layers first to
+ *                                 last (excluded), blended again only if
+ *                                 one of them changed
+ *
+ */
+const QImage& LayerStack::cachedTile(QVector<CachedTile> &cache,
+                                     int first, int last,
+                                     int column, int row)
+{
+    CachedTile &cached = cache[row * layers.first()->image.columns() + column];
+    QVector<qint64> keys = tileKeys(first, last, column, row);
+    if(cached.keys != keys)
+    {
+        cached.image = flatten(first, last, column, row);
+        cached.keys = keys;
+    }
+    return cached.image;
+}
+
+/**
+ * @brief LayerStack::compositeTile - the flattened tile, made from the
+ *                                    cached layers below the current one,
+ *                                    the current layer, and the cached
+ *                                    layers above it
+ *
+ */
+QImage LayerStack::compositeTile(int column, int row)
+{
+    CachedTile &cached = composite[row * layers.first()->image.columns() + column];
+    QVector<qint64> keys = tileKeys(0, count(), column, row);
+    if(cached.keys == keys)
+        return cached.image;
+
+    const Layer *layer = currentLayer();
+    const bool flatAbove = aboveIsSourceOver();
+    QImage under = cachedTile(below, 0, current, column, row);
+    QImage over;
+    if(flatAbove)
+        over = cachedTile(above, current + 1, count(), column, row);
+
+    QImage result;
+    if(under.isNull() && flatAbove && over.isNull()
+       && layer->style.visible && layer->style.opacity == 1
+       && layer->style.blend == QPainter::CompositionMode_SourceOver)
+    {
+        // a single visible layer is its own composite
+        result = layer->image.tileImage(column, row);
+    }
+    else
+    {
+        if(under.isNull())
+        {
+            result = QImage(layer->image.tileRect(column, row).size(),
+                            QImage::Format_ARGB32_Premultiplied);
+            result.fill(Qt::transparent);
+        }
+        else
+        {
+            result = under;
+        }
+
+        blend(result, layer, column, row);
+
+        if(!flatAbove)
+        {
+            for(int i = current + 1; i < count(); ++i)
+                blend(result, layers.at(i), column, row);
+        }
+        else if(!over.isNull())
+        {
+            blendImage(result, over, QPainter::CompositionMode_SourceOver, 255);
+        }
+    }
+
+    cached.image = result;
+    cached.keys = keys;
+    return result;
+}
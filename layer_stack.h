@@ -0,0 +1,129 @@
+#ifndef LAYER_STACK_H
+#define LAYER_STACK_H
+
+#include <QList>
+#include <QPainter>
+#include <QString>
+#include <QVector>
+
+#include "tiled_image.h"
+#include "vector_scene.h"
+
+
+/** how a layer is blended onto the layers below it */
+struct LayerStyle
+{
+    LayerStyle()
+        : visible(true), opacity(1),
+          blend(QPainter::CompositionMode_SourceOver) {}
+
+    QString name;
+    bool visible;
+    qreal opacity;
+    QPainter::CompositionMode blend;
+};
+
+/**
+ * a single layer, the tools draw straight into its image. A vector layer
+ * also keeps the shapes drawn on it in a scene, its image is then only
+ * the scene drawn out, see VectorScene::render.
+ */
+struct Layer
+{
+    Layer() : scene(0) {}
+    ~Layer() { delete scene; }
+
+    bool isVector() const { return scene != 0; }
+
+    TiledImage image;
+    LayerStyle style;
+    VectorScene* scene;
+
+private:
+    Layer(const Layer&);
+    Layer& operator=(const Layer&);
+};
+
+/**
+ * the layers of the image, bottom first. The flattened image is cached tile
+ * by tile, together with the flattened layers below and above the current
+ * one, so a tile painted on the current layer is blended again with only
+ * those two caches however many layers there are. Tiles are known to have
+ * changed by their QImage::cacheKey(), which changes whenever they are
+ * painted on or replaced. Stale tiles are blended in parallel.
+ *
+ * Layers taken out of the stack by reset(), scaled() and take() are not
+ * deleted, they belong to whoever took them out, normally a LayersCommand.
+ */
+class LayerStack
+{
+public:
+    /** the order and styles of the layers, to undo changes to them */
+    struct State
+    {
+        QList<Layer*> layers;
+        QVector<LayerStyle> styles;
+        int current;
+    };
+
+    LayerStack();
+    ~LayerStack();
+
+    int count() const { return layers.size(); }
+    Layer* layer(int index) const { return layers.at(index); }
+    int currentIndex() const { return current; }
+    Layer* currentLayer() const { return layers.at(current); }
+    void setCurrentIndex(int);
+
+    QSize size() const { return layers.first()->image.size(); }
+    QRect rect() const { return layers.first()->image.rect(); }
+    bool isNull() const { return layers.first()->image.isNull(); }
+
+    void reset(const TiledImage&, bool vector = false);
+    void scaled(const QSize&, const QVector<TiledImage>&);
+    Layer* insert(int index, const QString&, bool vector = false);
+    Layer* take(int index);
+    void move(int from, int to);
+    void setStyle(int index, const LayerStyle&);
+
+    State state() const;
+    void restore(const State&);
+
+    void draw(QPainter&, const QRect&);
+    QImage toImage();
+    QVector<QImage> compositeTiles(const QRect&);
+
+private:
+    /** a flattened tile and the keys of the tiles it was made from */
+    struct CachedTile
+    {
+        QImage image;
+        QVector<qint64> keys;
+    };
+
+    void changed();
+    void prepareCache();
+    bool aboveIsSourceOver() const;
+    QVector<qint64> tileKeys(int first, int last, int column, int row) const;
+    QImage flatten(int first, int last, int column, int row) const;
+    void blend(QImage&, const Layer*, int column, int row) const;
+    QImage compositeTile(int column, int row);
+    const QImage& cachedTile(QVector<CachedTile>&, int first, int last,
+                             int column, int row);
+
+    QList<Layer*> layers;
+    int current;
+
+    /** bumped whenever the order or styles of the layers change */
+    qint64 generation;
+
+    QSize cacheSize;
+    QVector<CachedTile> composite;
+    QVector<CachedTile> below;
+    QVector<CachedTile> above;
+
+    LayerStack(const LayerStack&);
+    LayerStack& operator=(const LayerStack&);
+};
+
+#endif // LAYER_STACK_H
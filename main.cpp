@@ -1,4 +1,8 @@
 #include <qapplication.h>
+#include <QFile>
+#include <QLockFile>
+#include <QMessageBox>
+#include "autosave_journal.h"
 #include "main_window.h"
 
 #include <vtkActor.h>
@@ -20,8 +24,30 @@ int main(int argc, char* argv[])
     QSurfaceFormat::setDefaultFormat(QVTKOpenGLNativeWidget::defaultFormat());
 
     QApplication a(argc, argv);
-    QWidget* w = new MainWindow(0, "Canvas");
+    a.setOrganizationName("canvas");
+    a.setApplicationName("canvas");
+    MainWindow* w = new MainWindow(0, "Canvas");
     w->show();
+
+    // a session didn't end cleanly, offer what it autosaved. Its journal
+    // is locked meanwhile so no other session starting offers it too
+    const QString orphan = AutosaveJournal::orphan();
+    QLockFile claim(orphan + ".lock");
+    claim.setStaleLockTime(0);
+    if(!orphan.isEmpty() && claim.tryLock(0))
+    {
+        QMessageBox::StandardButton answer = QMessageBox::question(
+            w, QObject::tr("Restore"),
+            QObject::tr("Canvas didn't close properly last time. "
+                        "Restore the autosaved image?"));
+        if(answer == QMessageBox::Yes)
+            w->restoreAutosave(orphan);
+
+        // restored it is in this session's journal already
+        QFile::remove(orphan);
+        claim.unlock();
+    }
+
     int exitCode = a.exec();
     delete w;
     return exitCode;
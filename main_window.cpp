@@ -4,11 +4,17 @@ using namespace std;
 #include <QDesktopWidget>
 #include <QMouseEvent>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QColorDialog>
 #include <QSignalMapper>
 #include <QMenuBar>
 #include <QMenu>
 #include <QGridLayout>
+#include <QInputDialog>
+#include <QMessageBox>
+#include <QProgressBar>
+#include <QSettings>
+#include <QStatusBar>
 
 #include "main_window.h"
 #include "commands.h"
@@ -38,6 +44,23 @@ MainWindow::MainWindow(QWidget* parent, const char* name)
 
     canvas->setStyleSheet("background-color:transparent");
 
+    // saving finishes in the background
+    connect(canvas, SIGNAL(imageSaved(QString)), this, SLOT(OnImageSaved(QString)));
+    connect(canvas, SIGNAL(imageSaveFailed(QString,QString)),
+            this, SLOT(OnImageSaveFailed(QString,QString)));
+
+    // and so does loading, with its progress in the status bar
+    loadProgress = new QProgressBar();
+    loadProgress->setMaximumWidth(200);
+    loadProgress->hide();
+    statusBar()->addPermanentWidget(loadProgress);
+    connect(canvas, SIGNAL(imageLoadProgress(int,int)),
+            this, SLOT(OnImageLoadProgress(int,int)));
+    connect(canvas, SIGNAL(imageLoaded(QString)), this, SLOT(OnImageLoaded(QString)));
+    connect(canvas, SIGNAL(imageLoadFailed(QString,QString)),
+            this, SLOT(OnImageLoadFailed(QString,QString)));
+    connect(canvas, SIGNAL(imageLoadCancelled()), this, SLOT(OnImageLoadCancelled()));
+
     // get default tool
     currentTool = canvas->getCurrentTool();
 
@@ -86,28 +109,48 @@ void MainWindow::OnLoadImage()
 {
     QString s = QFileDialog::getOpenFileName(this, tr("Open File"),
                                                     ".",
-                                                    tr("BMP image (*.bmp)"));
+                                                    tr("Images (*.png *.qoi *.bmp *.jpg *.jpeg)"));
     if (! s.isNull())
     {
         canvas->loadImage(s);
+        loadProgress->setValue(0);
+        loadProgress->show();
+        statusBar()->showMessage(tr("Loading %1...").arg(s));
     }
 }
 
 /**
  * @brief MainWindow::OnSaveImage - Open a QFileDialogue prompting user to
  *                                  enter a filename and save location.
+ *                                  The file is written in the background.
  */
 void MainWindow::OnSaveImage()
 {
     if(canvas->getImage()->isNull())
         return;
 
+    // one filter a format, in the order of ImageFormat
+    QStringList filters;
+    filters << tr("PNG image (*.png)")
+            << tr("QOI image (*.qoi)")
+            << tr("BMP image (*.bmp)");
+    const char* suffixes[] = {"png", "qoi", "bmp"};
+
+    QSettings settings;
+    int format = qBound(0, settings.value("save/format", png_format).toInt(),
+                        filters.size() - 1);
+
     // use custom dialog settings for appending suffixes
     QFileDialog *fileDialog = new QFileDialog(this);
     fileDialog->setAcceptMode(QFileDialog::AcceptSave);
     fileDialog->setDirectory(".");
-    fileDialog->setNameFilter("BMP image (*.bmp)");
-    fileDialog->setDefaultSuffix("bmp");
+    fileDialog->setNameFilters(filters);
+    fileDialog->selectNameFilter(filters.at(format));
+    fileDialog->setDefaultSuffix(suffixes[format]);
+    connect(fileDialog, &QFileDialog::filterSelected, [=](const QString &filter)
+    {
+        fileDialog->setDefaultSuffix(suffixes[qMax(0, filters.indexOf(filter))]);
+    });
     fileDialog->exec();
 
     // if user hit 'OK' button, save file
@@ -117,37 +160,206 @@ void MainWindow::OnSaveImage()
 
         if (! s.isNull())
         {
-            canvas->saveImage(s);
+            // a suffix typed in wins over the filter
+            format = QFileInfo(s).suffix().isEmpty()
+                         ? qMax(0, filters.indexOf(fileDialog->selectedNameFilter()))
+                         : ImageSaver::formatOf(s);
+            settings.setValue("save/format", format);
+
+            int compression = settings.value("save/png_compression",
+                                             DEFAULT_PNG_COMPRESSION).toInt();
+            canvas->saveImage(s, ImageFormat(format), compression);
+            statusBar()->showMessage(tr("Saving %1...").arg(s));
         }
     }
     // done with the dialog, free it
     delete fileDialog;
 }
 
+/**
+ * @brief MainWindow::OnOpenProject - Open a QFileDialogue prompting user to
+ *                                    browse for a project to open.
+ */
+void MainWindow::OnOpenProject()
+{
+    QString s = QFileDialog::getOpenFileName(this, tr("Open Project"), ".",
+                                             tr("Canvas project (*.cnvs)"));
+    if (s.isNull())
+        return;
+
+    QString error;
+    if(!canvas->openProject(s, &error))
+    {
+        QMessageBox::warning(this, tr("Open failed"),
+                             tr("Couldn't open %1:\n%2").arg(s, error));
+        return;
+    }
+    currentTool = canvas->getCurrentTool();
+    statusBar()->showMessage(tr("Opened %1").arg(s), 5000);
+}
+
+/**
+ * @brief MainWindow::OnSaveProject - Save to the project last saved or
+ *                                    opened, only what changed is written.
+ */
+void MainWindow::OnSaveProject()
+{
+    if(canvas->projectFileName().isEmpty())
+    {
+        OnSaveProjectAs();
+        return;
+    }
+    saveProject(canvas->projectFileName());
+}
+
+/**
+ * @brief MainWindow::OnSaveProjectAs - Open a QFileDialogue prompting user
+ *                                      to enter a project filename.
+ */
+void MainWindow::OnSaveProjectAs()
+{
+    if(canvas->getImage()->isNull())
+        return;
+
+    QFileDialog *fileDialog = new QFileDialog(this);
+    fileDialog->setAcceptMode(QFileDialog::AcceptSave);
+    fileDialog->setDirectory(".");
+    fileDialog->setNameFilter(tr("Canvas project (*.cnvs)"));
+    fileDialog->setDefaultSuffix("cnvs");
+    fileDialog->exec();
+
+    if (fileDialog->result())
+    {
+        QString s = fileDialog->selectedFiles().first();
+        if (! s.isNull())
+            saveProject(s);
+    }
+    delete fileDialog;
+}
+
+/**
+ * @brief MainWindow::saveProject - Save the project and tell the user how
+ *                                  it went.
+ */
+void MainWindow::saveProject(const QString &fileName)
+{
+    QString error;
+    if(canvas->saveProject(fileName, &error))
+        statusBar()->showMessage(tr("Saved %1").arg(fileName), 5000);
+    else
+        QMessageBox::warning(this, tr("Save failed"),
+                             tr("Couldn't save %1:\n%2").arg(fileName, error));
+}
+
+/**
+ * @brief MainWindow::OnPngCompression - Prompt for the zlib level PNG
+ *                                       images are saved at, 0 stores the
+ *                                       pixels and 9 is the smallest file.
+ */
+void MainWindow::OnPngCompression()
+{
+    QSettings settings;
+    bool ok;
+    int level = QInputDialog::getInt(this, tr("PNG compression"),
+                                     tr("Compression level (0-9):"),
+                                     settings.value("save/png_compression",
+                                                    DEFAULT_PNG_COMPRESSION).toInt(),
+                                     MIN_PNG_COMPRESSION, MAX_PNG_COMPRESSION,
+                                     1, &ok);
+    if(ok)
+        settings.setValue("save/png_compression", level);
+}
+
+/**
+ * @brief MainWindow::OnImageLoadProgress - Show how much of the image being
+ *                                          loaded is in.
+ */
+void MainWindow::OnImageLoadProgress(int done, int total)
+{
+    loadProgress->setMaximum(total);
+    loadProgress->setValue(done);
+}
+
+/**
+ * @brief MainWindow::OnImageLoaded - Tell the user a file was read.
+ */
+void MainWindow::OnImageLoaded(const QString &fileName)
+{
+    loadProgress->hide();
+    statusBar()->showMessage(tr("Loaded %1").arg(fileName), 5000);
+}
+
+/**
+ * @brief MainWindow::OnImageLoadFailed - Tell the user a file couldn't be
+ *                                        read, and why.
+ */
+void MainWindow::OnImageLoadFailed(const QString &fileName, const QString &error)
+{
+    loadProgress->hide();
+    statusBar()->clearMessage();
+    QMessageBox::warning(this, tr("Load failed"),
+                         tr("Couldn't load %1:\n%2").arg(fileName, error));
+}
+
+/**
+ * @brief MainWindow::OnImageLoadCancelled - The load was stopped by another
+ *                                           change to the image.
+ */
+void MainWindow::OnImageLoadCancelled()
+{
+    loadProgress->hide();
+    statusBar()->showMessage(tr("Loading stopped"), 5000);
+}
+
+/**
+ * @brief MainWindow::OnImageSaved - Tell the user a file was written.
+ */
+void MainWindow::OnImageSaved(const QString &fileName)
+{
+    statusBar()->showMessage(tr("Saved %1").arg(fileName), 5000);
+}
+
+/**
+ * @brief MainWindow::OnImageSaveFailed - Tell the user a file couldn't be
+ *                                        written, and why.
+ */
+void MainWindow::OnImageSaveFailed(const QString &fileName, const QString &error)
+{
+    statusBar()->clearMessage();
+    QMessageBox::warning(this, tr("Save failed"),
+                         tr("Couldn't save %1:\n%2").arg(fileName, error));
+}
+
 /**
  * @brief MainWindow::OnResizeImage - Change the dimensions of the image.
  *
  */
 void MainWindow::OnResizeImage()
 {
-    QPixmap *image = canvas->getImage();
+    TiledImage *image = canvas->getImage();
     if(image->isNull())
         return;
-    canvas->resizeImage();
-    /*
+
+    // the filter last resized with is offered again
+    QSettings settings;
+    ResampleFilter filter = ResampleFilter(
+        settings.value("resize/filter", bilinear_filter).toInt());
+
     CanvasSizeDialog* newCanvas = new CanvasSizeDialog(this, "Resize Image",
                                                        image->width(),
-                                                       image->height());
+                                                       image->height(),
+                                                       true, filter);
     newCanvas->exec();
-    // if user hit 'OK' button, create new image
+    // if user hit 'OK' button, resize the image
     if (newCanvas->result())
     {
+         settings.setValue("resize/filter", newCanvas->getFilter());
          canvas->resizeImage(QSize(newCanvas->getWidthValue(),
-                                     newCanvas->getHeightValue()));
+                                   newCanvas->getHeightValue()),
+                             newCanvas->getFilter());
     }
     // done with the dialog, free it
     delete newCanvas;
-    */
 }
 
 /**
@@ -260,6 +472,8 @@ void MainWindow::openToolDialog()
     case eraser: OnEraserDialog();       break;
     case rect_tool: OnRectangleDialog(); break;
     case render3d: break;
+    case fill_tool: OnFillDialog();      break;
+    case select_tool: OnSelectDialog();  break;
     }
 }
 
@@ -270,6 +484,91 @@ void MainWindow::OnPenSize(int s) {
     canvas->get_rect()->setWidth(s);
 }
 
+/**
+ * @brief MainWindow::OnFillDialog - Prompt the user for the fill tool's
+ *                                   color tolerance.
+ *
+ */
+void MainWindow::OnFillDialog()
+{
+    bool ok = false;
+    int value = QInputDialog::getInt(this, "Fill Properties", "Tolerance",
+                                     canvas->get_fill()->getTolerance(),
+                                     MIN_FILL_TOLERANCE, MAX_FILL_TOLERANCE,
+                                     1, &ok);
+    if(ok)
+        canvas->OnFillToleranceConfig(value);
+}
+
+/**
+ * @brief MainWindow::OnSelectDialog - Prompt the user for whether the
+ *                                     select tool selects rectangles or
+ *                                     freeform outlines.
+ *
+ */
+void MainWindow::OnSelectDialog()
+{
+    QStringList modes;
+    modes << "Rectangle" << "Freeform";
+
+    bool ok = false;
+    QString mode = QInputDialog::getItem(this, "Select Properties", "Shape",
+                                         modes, canvas->get_select()->getMode(),
+                                         false, &ok);
+    if(ok)
+        canvas->OnSelectModeConfig(modes.indexOf(mode));
+}
+
+/**
+ * @brief MainWindow::OnFilterDialog - Prompt the user for a filter's
+ *                                     settings, previewed on a small copy
+ *                                     of the current layer, and run it on
+ *                                     the whole layer. Invert has no
+ *                                     settings and runs straight away.
+ *
+ */
+void MainWindow::OnFilterDialog(int type)
+{
+    LayerStack *layers = canvas->getLayers();
+    if(layers->isNull() || layers->currentLayer()->isVector())
+        return;
+
+    if(type == invert_filter)
+    {
+        Filter invert;
+        invert.type = invert_filter;
+        canvas->filterImage(invert);
+        return;
+    }
+
+    FilterDialog* dialog = new FilterDialog(this, *canvas->getImage(),
+                                            FilterType(type));
+    dialog->exec();
+    // if user hit 'OK' button, filter the image
+    if (dialog->result())
+        canvas->filterImage(dialog->getFilter());
+    // done with the dialog, free it
+    delete dialog;
+}
+
+/**
+ * @brief MainWindow::OnLayerOpacity - Prompt the user for the current
+ *                                     layer's opacity.
+ *
+ */
+void MainWindow::OnLayerOpacity()
+{
+    LayerStack *layers = canvas->getLayers();
+    int opacity = qRound(layers->currentLayer()->style.opacity * 100);
+
+    bool ok = false;
+    int value = QInputDialog::getInt(this, "Layer Opacity",
+                                     layers->currentLayer()->style.name,
+                                     opacity, 0, 100, 1, &ok);
+    if(ok)
+        canvas->OnLayerOpacityConfig(value);
+}
+
 /**
  * @brief ToolBar::createMenuAndToolBar() - ensure that everything gets
  *                                          created in the correct order
@@ -341,6 +640,28 @@ void MainWindow::createMenuActions()
     file->addAction(save_action);
     imageActions.append(save_action);
 
+    QAction *open_project_action = new QAction();
+    open_project_action->setText(QString("open project"));
+    open_project_action->setShortcut(QKeySequence("Ctrl+O"));
+    connect(open_project_action, SIGNAL(triggered()), this, SLOT(OnOpenProject()));
+    file->addAction(open_project_action);
+
+    QAction *save_project_action = new QAction();
+    save_project_action->setText(QString("save project"));
+    save_project_action->setShortcut(QKeySequence("Ctrl+Shift+S"));
+    connect(save_project_action, SIGNAL(triggered()), this, SLOT(OnSaveProject()));
+    file->addAction(save_project_action);
+
+    QAction *save_project_as_action = new QAction();
+    save_project_as_action->setText(QString("save project as"));
+    connect(save_project_as_action, SIGNAL(triggered()), this, SLOT(OnSaveProjectAs()));
+    file->addAction(save_project_as_action);
+
+    QAction *png_action = new QAction();
+    png_action->setText(QString("png compression"));
+    connect(png_action, SIGNAL(triggered()), this, SLOT(OnPngCompression()));
+    file->addAction(png_action);
+
     QAction *quit_action = new QAction();
     quit_action->setText("quit");
     quit_action->setShortcut(QKeySequence("Ctrl+Q"));
@@ -383,6 +704,18 @@ void MainWindow::createMenuActions()
     edit->addAction(clear_action);
     imageActions.append(clear_action);
 
+    QAction *delete_shape_action  = new QAction();
+    delete_shape_action->setText(QString("delete shape"));
+    delete_shape_action->setShortcut(QKeySequence::Delete);
+    connect(delete_shape_action, SIGNAL(triggered()), canvas, SLOT(OnDeleteShape()));
+    edit->addAction(delete_shape_action);
+
+    QAction *deselect_action  = new QAction();
+    deselect_action->setText(QString("deselect"));
+    deselect_action->setShortcut(QKeySequence("Ctrl+Shift+A"));
+    connect(deselect_action, SIGNAL(triggered()), canvas, SLOT(OnDeselect()));
+    edit->addAction(deselect_action);
+
     QSignalMapper *color_qsm = new QSignalMapper(this);
 
     QAction* fcolor_action = new QAction(fColor_icon, QString("palette"), this);
@@ -424,6 +757,16 @@ void MainWindow::createMenuActions()
     connect(rect_action, SIGNAL(triggered()), tool_qsm, SLOT(map()));
     tools->addAction(rect_action);
 
+    QAction* fill_action = new QAction(QString("Fill"), this);
+    connect(fill_action, SIGNAL(triggered()), tool_qsm, SLOT(map()));
+    tools->addAction(fill_action);
+    toolActions.append(fill_action);
+
+    QAction* select_action = new QAction(QString("Select"), this);
+    connect(select_action, SIGNAL(triggered()), tool_qsm, SLOT(map()));
+    tools->addAction(select_action);
+    toolActions.append(select_action);
+
     QAction *cube_action = new QAction(cube_icon, QString("Cube"), this);
     connect(cube_action, SIGNAL(triggered()), canvas, SLOT(add_cube()));
     tools->addAction(cube_action);
@@ -453,6 +796,8 @@ void MainWindow::createMenuActions()
     tool_qsm->setMapping(eraser_action, eraser);
     tool_qsm->setMapping(rect_action, rect_tool);
     tool_qsm->setMapping(render_action, render3d);
+    tool_qsm->setMapping(fill_action, fill_tool);
+    tool_qsm->setMapping(select_action, select_tool);
     connect(tool_qsm, SIGNAL(mapped(int)), this, SLOT(OnChangeTool(int)));
     toolActions.append(rect_action);
 
@@ -460,10 +805,87 @@ void MainWindow::createMenuActions()
     tools->addAction(QString("Eraser Properties"), this, SLOT(OnEraserDialog()));
     tools->addAction(QString("Line Properties"), this, SLOT(OnLineDialog()));
     tools->addAction(QString("Rectangle Properties"), this, SLOT(OnRectangleDialog()));
+    tools->addAction(QString("Fill Properties"), this, SLOT(OnFillDialog()));
+    tools->addAction(QString("Select Properties"), this, SLOT(OnSelectDialog()));
+    //////////
+    // View //
+    //////////
+    QMenu* view = new QMenu(tr("View"), this);
+    view->addAction(QString("zoom in"), canvas, SLOT(OnZoomIn()),
+                    QKeySequence::ZoomIn);
+    view->addAction(QString("zoom out"), canvas, SLOT(OnZoomOut()),
+                    QKeySequence::ZoomOut);
+    view->addAction(QString("actual size"), canvas, SLOT(OnZoomReset()),
+                    QKeySequence("Ctrl+0"));
+
+    ////////////
+    // Layers //
+    ////////////
+    QMenu* layers = new QMenu(tr("Layers"), this);
+
+    QAction *add_layer_action = new QAction();
+    add_layer_action->setText(QString("add layer"));
+    add_layer_action->setShortcut(QKeySequence("Ctrl+Shift+N"));
+    connect(add_layer_action, SIGNAL(triggered()), canvas, SLOT(OnAddLayer()));
+    layers->addAction(add_layer_action);
+
+    QAction *add_vector_layer_action = new QAction();
+    add_vector_layer_action->setText(QString("add vector layer"));
+    connect(add_vector_layer_action, SIGNAL(triggered()), canvas, SLOT(OnAddVectorLayer()));
+    layers->addAction(add_vector_layer_action);
+
+    QAction *remove_layer_action = new QAction();
+    remove_layer_action->setText(QString("remove layer"));
+    connect(remove_layer_action, SIGNAL(triggered()), canvas, SLOT(OnRemoveLayer()));
+    layers->addAction(remove_layer_action);
+
+    layers->addSeparator();
+    layers->addAction(QString("raise layer"), canvas, SLOT(OnRaiseLayer()));
+    layers->addAction(QString("lower layer"), canvas, SLOT(OnLowerLayer()));
+    layers->addAction(QString("layer above"), canvas, SLOT(OnLayerAbove()),
+                      QKeySequence("Ctrl+PgUp"));
+    layers->addAction(QString("layer below"), canvas, SLOT(OnLayerBelow()),
+                      QKeySequence("Ctrl+PgDown"));
+
+    layers->addSeparator();
+    layers->addAction(QString("show/hide layer"), canvas, SLOT(OnToggleLayer()));
+    layers->addAction(QString("layer opacity"), this, SLOT(OnLayerOpacity()));
+
+    QMenu* blend = layers->addMenu(QString("blend mode"));
+    QSignalMapper *blend_qsm = new QSignalMapper(this);
+    const char *blend_names[] = {"Normal", "Multiply", "Screen", "Overlay",
+                                 "Darken", "Lighten", "Difference"};
+    for(int mode = normal_blend; mode <= difference_blend; ++mode)
+    {
+        QAction *blend_action = blend->addAction(QString(blend_names[mode]));
+        connect(blend_action, SIGNAL(triggered()), blend_qsm, SLOT(map()));
+        blend_qsm->setMapping(blend_action, mode);
+    }
+    connect(blend_qsm, SIGNAL(mapped(int)), canvas, SLOT(OnLayerBlendConfig(int)));
+
+    /////////////
+    // Filters //
+    /////////////
+    QMenu* filters = new QMenu(tr("Filters"), this);
+
+    QSignalMapper *filter_qsm = new QSignalMapper(this);
+    const char *filter_names[] = {"Gaussian blur...", "Sharpen...",
+                                  "Brightness/Contrast...", "Invert"};
+    for(int type = blur_filter; type <= invert_filter; ++type)
+    {
+        QAction *filter_action = filters->addAction(QString(filter_names[type]));
+        connect(filter_action, SIGNAL(triggered()), filter_qsm, SLOT(map()));
+        filter_qsm->setMapping(filter_action, type);
+    }
+    connect(filter_qsm, SIGNAL(mapped(int)), this, SLOT(OnFilterDialog(int)));
+
     ///////////////////////
     // populate menu-bar //
     ///////////////////////
     menuBar()->addMenu(file);
     menuBar()->addMenu(edit);
     menuBar()->addMenu(tools);
+    menuBar()->addMenu(view);
+    menuBar()->addMenu(layers);
+    menuBar()->addMenu(filters);
 }
@@ -4,6 +4,7 @@
 #include <QMainWindow>
 #include <QList>
 #include <QAction>
+#include <QProgressBar>
 #include <QWidget>
 #include <memory>
 #include <iostream>
@@ -25,11 +26,25 @@ public:
     ~MainWindow();
 
     void virtual mousePressEvent (QMouseEvent*) override;
+    bool restoreAutosave(const QString &journal)
+    {
+        return canvas->restoreAutosave(journal);
+    }
 
 public slots:
     void OnNewImage();
     void OnLoadImage();
     void OnSaveImage();
+    void OnOpenProject();
+    void OnSaveProject();
+    void OnSaveProjectAs();
+    void OnPngCompression();
+    void OnImageSaved(const QString&);
+    void OnImageSaveFailed(const QString&, const QString&);
+    void OnImageLoadProgress(int, int);
+    void OnImageLoaded(const QString&);
+    void OnImageLoadFailed(const QString&, const QString&);
+    void OnImageLoadCancelled();
     void OnResizeImage();
     void OnPickColor(int);
     void OnChangeTool(int);
@@ -38,12 +53,17 @@ public slots:
     void OnLineDialog();
     void OnEraserDialog();
     void OnRectangleDialog();
+    void OnFillDialog();
+    void OnSelectDialog();
+    void OnFilterDialog(int);
     void OnPenSize(int);
+    void OnLayerOpacity();
 private:
     void createMenuActions();
     void createMenuAndToolBar();
 
     void openToolDialog();
+    void saveProject(const QString&);
 
     Canvas* canvas;
 
@@ -51,6 +71,7 @@ private:
     QList<QAction*> toolActions;
 
     ToolBar* toolbar;
+    QProgressBar* loadProgress;
 
     Tool* currentTool;
 
@@ -0,0 +1,227 @@
+#include "mip_pyramid.h"
+#include "parallel.h"
+
+
+namespace
+{
+/**
+ * @brief halve - average every 2x2 block of a premultiplied or opaque
+ *                image, two channels at a time. Odd edges repeat their
+ *                last row or column.
+ *
+ */
+QImage halve(const QImage &source)
+{
+    QImage image = source;
+    if(image.format() != QImage::Format_ARGB32_Premultiplied
+       && image.format() != QImage::Format_RGB32)
+        image = source.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    QImage result((image.width() + 1) / 2, (image.height() + 1) / 2,
+                  QImage::Format_ARGB32_Premultiplied);
+    for(int y = 0; y < result.height(); ++y)
+    {
+        const quint32 *top
+            = reinterpret_cast<const quint32*>(image.constScanLine(2 * y));
+        const quint32 *bottom = reinterpret_cast<const quint32*>(
+            image.constScanLine(qMin(2 * y + 1, image.height() - 1)));
+        quint32 *out = reinterpret_cast<quint32*>(result.scanLine(y));
+
+        for(int x = 0; x < result.width(); ++x)
+        {
+            const int left = 2 * x;
+            const int right = qMin(2 * x + 1, image.width() - 1);
+            const quint32 a = top[left];
+            const quint32 b = top[right];
+            const quint32 c = bottom[left];
+            const quint32 d = bottom[right];
+
+            quint32 rb = ((a & 0xff00ff) + (b & 0xff00ff) + (c & 0xff00ff)
+                          + (d & 0xff00ff) + 0x20002) >> 2;
+            quint32 ag = (((a >> 8) & 0xff00ff) + ((b >> 8) & 0xff00ff)
+                          + ((c >> 8) & 0xff00ff) + ((d >> 8) & 0xff00ff)
+                          + 0x20002) >> 2;
+            out[x] = (rb & 0xff00ff) | ((ag & 0xff00ff) << 8);
+        }
+    }
+    return result;
+}
+}
+
+/**
+ * @brief MipPyramid::MipPyramid - an empty pyramid over the given layers,
+ *                                 mips are made when first drawn
+ *
+ */
+MipPyramid::MipPyramid(LayerStack *layers)
+    : layers(layers)
+{
+}
+
+/**
+ * @brief MipPyramid::levels - the number of levels, the last one fits
+ *                             in a single tile
+ *
+ */
+int MipPyramid::levels() const
+{
+    int level = 0;
+    while(columns(level) > 1 || rows(level) > 1)
+        ++level;
+    return level + 1;
+}
+
+/**
+ * @brief MipPyramid::levelFor - the smallest level still drawn at half
+ *                               its size or more at the given zoom
+ *
+ */
+int MipPyramid::levelFor(qreal zoom) const
+{
+    int level = 0;
+    while(level + 1 < levels() && zoom * (2 << level) <= 1)
+        ++level;
+    return level;
+}
+
+/**
+ * @brief MipPyramid::draw - draw the part of the flattened layers within
+ *                           area, given in image coordinates, from the
+ *                           level that fits the zoom. The painter is
+ *                           expected to be scaled by the zoom.
+ *
+ */
+void MipPyramid::draw(QPainter &painter, const QRect &area, qreal zoom)
+{
+    QRect visible = area.intersected(layers->rect());
+    if(visible.isEmpty())
+        return;
+
+    prepareCache();
+    const int level = levelFor(zoom);
+    const int span = TILE_SIZE << level;
+    QRect range(QPoint(visible.left() / span, visible.top() / span),
+                QPoint(visible.right() / span, visible.bottom() / span));
+    QVector<QImage> images = tiles(level, range);
+
+    painter.save();
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, zoom < 1);
+    for(int row = range.top(); row <= range.bottom(); ++row)
+    {
+        for(int column = range.left(); column <= range.right(); ++column)
+        {
+            const QImage &tile = images.at((row - range.top()) * range.width()
+                                           + column - range.left());
+            QRect bounds = tileRect(level, column, row);
+
+            if(tile.hasAlphaChannel())
+                painter.fillRect(bounds, Qt::white);
+            painter.drawImage(QRectF(bounds), tile, QRectF(tile.rect()));
+        }
+    }
+    painter.restore();
+}
+
+int MipPyramid::columns(int level) const
+{
+    const int span = TILE_SIZE << level;
+    return (layers->size().width() + span - 1) / span;
+}
+
+int MipPyramid::rows(int level) const
+{
+    const int span = TILE_SIZE << level;
+    return (layers->size().height() + span - 1) / span;
+}
+
+/**
+ * @brief MipPyramid::tileRect - the area of the image a tile of a level
+ *                               covers, in image coordinates
+ *
+ */
+QRect MipPyramid::tileRect(int level, int column, int row) const
+{
+    const int span = TILE_SIZE << level;
+    return QRect(column * span, row * span, span, span)
+        .intersected(layers->rect());
+}
+
+/**
+ * @brief MipPyramid::tiles - the tiles of a level in range, row by row.
+ *                            The tiles below them are fetched first, then
+ *                            the tiles made from tiles that changed are
+ *                            halved again on the thread pool.
+ *
+ */
+QVector<QImage> MipPyramid::tiles(int level, const QRect &range)
+{
+    if(level == 0)
+        return layers->compositeTiles(range);
+
+    QRect below = QRect(range.left() * 2, range.top() * 2,
+                        range.width() * 2, range.height() * 2)
+        .intersected(QRect(0, 0, columns(level - 1), rows(level - 1)));
+    const QVector<QImage> children = tiles(level - 1, below);
+
+    QVector<CachedTile> &levelCache = cache[level];
+    levelCache.detach();
+
+    QVector<QImage> result(range.width() * range.height());
+    parallelFor(result.size(), [&](int i)
+    {
+        const int column = range.left() + i % range.width();
+        const int row = range.top() + i / range.width();
+
+        // the up to four tiles this one is made from
+        QImage parts[4];
+        QVector<qint64> keys;
+        for(int part = 0; part < 4; ++part)
+        {
+            QPoint child(column * 2 + part % 2, row * 2 + part / 2);
+            if(!below.contains(child))
+            {
+                keys << 0;
+                continue;
+            }
+            parts[part] = children.at((child.y() - below.top()) * below.width()
+                                      + child.x() - below.left());
+            keys << parts[part].cacheKey();
+        }
+
+        CachedTile &cached = levelCache[row * columns(level) + column];
+        if(cached.keys != keys)
+        {
+            QSize size(parts[0].width() + parts[1].width(),
+                       parts[0].height() + parts[2].height());
+            QImage joined(size, QImage::Format_ARGB32_Premultiplied);
+            {
+                QPainter painter(&joined);
+                painter.setCompositionMode(QPainter::CompositionMode_Source);
+                for(int part = 0; part < 4; ++part)
+                    if(!parts[part].isNull())
+                        painter.drawImage((part % 2) * TILE_SIZE,
+                                          (part / 2) * TILE_SIZE, parts[part]);
+            }
+            cached.image = halve(joined);
+            cached.keys = keys;
+        }
+        result[i] = cached.image;
+    });
+    return result;
+}
+
+/**
+ * @brief MipPyramid::prepareCache - start over with empty levels when the
+ *                                   size of the layers changed
+ *
+ */
+void MipPyramid::prepareCache()
+{
+    if(cacheSize == layers->size())
+        return;
+
+    cacheSize = layers->size();
+    cache = QVector<QVector<CachedTile> >(levels());
+    for(int level = 1; level < cache.size(); ++level)
+        cache[level] = QVector<CachedTile>(columns(level) * rows(level));
+}
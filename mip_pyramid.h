@@ -0,0 +1,50 @@
+#ifndef MIP_PYRAMID_H
+#define MIP_PYRAMID_H
+
+#include <QImage>
+#include <QPainter>
+#include <QVector>
+
+#include "layer_stack.h"
+
+
+/**
+ * the flattened layers at half, quarter, ... resolution, to draw zoomed out
+ * views from. Level 0 is the LayerStack composite, a tile of level n is
+ * made from the four tiles of level n - 1 it covers and is only made again
+ * once one of those changed, so after a stroke only the mips over the
+ * tiles it dirtied are rebuilt, and only when they are next drawn.
+ */
+class MipPyramid
+{
+public:
+    explicit MipPyramid(LayerStack*);
+
+    int levels() const;
+    int levelFor(qreal zoom) const;
+
+    void draw(QPainter&, const QRect&, qreal zoom);
+
+private:
+    /** a mip tile and the cache keys of the tiles it was made from */
+    struct CachedTile
+    {
+        QImage image;
+        QVector<qint64> keys;
+    };
+
+    int columns(int level) const;
+    int rows(int level) const;
+    QRect tileRect(int level, int column, int row) const;
+    QVector<QImage> tiles(int level, const QRect&);
+    void prepareCache();
+
+    LayerStack* layers;
+    QSize cacheSize;
+    QVector<QVector<CachedTile> > cache;
+
+    MipPyramid(const MipPyramid&);
+    MipPyramid& operator=(const MipPyramid&);
+};
+
+#endif // MIP_PYRAMID_H
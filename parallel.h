@@ -0,0 +1,72 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
+
+namespace parallel
+{
+/** take indices until there are none left */
+template<typename Function>
+void work(Function &function, QAtomicInt &next, int count)
+{
+    for(int i = next.fetchAndAddRelaxed(1); i < count;
+        i = next.fetchAndAddRelaxed(1))
+        function(i);
+}
+
+template<typename Function>
+class Worker : public QRunnable
+{
+public:
+    Worker(Function &function, QAtomicInt &next, int count, QSemaphore &done)
+        : function(function), next(next), count(count), done(done) {}
+
+    void run() override
+    {
+        work(function, next, count);
+        done.release();
+    }
+
+private:
+    Function &function;
+    QAtomicInt &next;
+    int count;
+    QSemaphore &done;
+};
+}
+
+/**
+ * run function(i) for every i in [0, count) on the global thread pool,
+ * the calling thread takes part. Only idle pool threads are used, so it
+ * can't wait on work that never gets a thread. Returns once every call
+ * returned.
+ */
+template<typename Function>
+void parallelFor(int count, Function function)
+{
+    QThreadPool *pool = QThreadPool::globalInstance();
+    QAtomicInt next(0);
+    QSemaphore done;
+
+    int workers = 0;
+    while(workers < qMin(count, pool->maxThreadCount()) - 1)
+    {
+        parallel::Worker<Function> *worker
+            = new parallel::Worker<Function>(function, next, count, done);
+        if(!pool->tryStart(worker))
+        {
+            delete worker;
+            break;
+        }
+        ++workers;
+    }
+
+    parallel::work(function, next, count);
+    done.acquire(workers);
+}
+
+#endif // PARALLEL_H
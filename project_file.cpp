@@ -0,0 +1,615 @@
+#include <QDataStream>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QtEndian>
+#include <climits>
+#include <cstring>
+
+#include "compression.h"
+#include "project_file.h"
+#include "vector_scene.h"
+
+
+namespace
+{
+const char MAGIC[8] = {'C', 'N', 'V', 'S', 'P', 'R', 'O', 'J'};
+const quint32 VERSION = 1;
+const int HEADER_SIZE = 64;
+const int CHUNK_HEADER_SIZE = 16;
+const int CHUNK_ALIGNMENT = 16;
+
+const char TILE_TAG[4] = {'T', 'I', 'L', 'E'};
+const char META_TAG[4] = {'M', 'E', 'T', 'A'};
+const char DIRC_TAG[4] = {'D', 'I', 'R', 'C'};
+
+/** how the pixels of a TILE chunk are stored, only older files have RLE */
+const quint8 RAW_ENCODING = 0;
+const quint8 RLE_ENCODING = 1;
+
+/** the file header, little endian on disk */
+struct Header
+{
+    quint32 version;
+    quint32 flags;
+    qint64 directoryOffset;
+    quint32 directoryLength;
+    qint64 fileEnd;
+};
+
+QByteArray packHeader(const Header &header)
+{
+    QByteArray data(HEADER_SIZE, 0);
+    uchar *out = reinterpret_cast<uchar*>(data.data());
+    memcpy(out, MAGIC, sizeof(MAGIC));
+    qToLittleEndian<quint32>(header.version, out + 8);
+    qToLittleEndian<quint32>(header.flags, out + 12);
+    qToLittleEndian<qint64>(header.directoryOffset, out + 16);
+    qToLittleEndian<quint32>(header.directoryLength, out + 24);
+    qToLittleEndian<qint64>(header.fileEnd, out + 32);
+    return data;
+}
+
+bool unpackHeader(const uchar *in, qint64 size, Header *header)
+{
+    if(size < HEADER_SIZE || memcmp(in, MAGIC, sizeof(MAGIC)) != 0)
+        return false;
+
+    header->version = qFromLittleEndian<quint32>(in + 8);
+    header->flags = qFromLittleEndian<quint32>(in + 12);
+    header->directoryOffset = qFromLittleEndian<qint64>(in + 16);
+    header->directoryLength = qFromLittleEndian<quint32>(in + 24);
+    header->fileEnd = qFromLittleEndian<qint64>(in + 32);
+    // QByteArray sizes are ints
+    return header->version == VERSION && header->fileEnd <= size
+           && header->directoryLength <= quint32(INT_MAX)
+           && header->directoryOffset >= HEADER_SIZE
+           && header->directoryLength <= header->fileEnd - header->directoryOffset;
+}
+
+/** appends chunks to a file from a position on */
+class ChunkWriter
+{
+public:
+    ChunkWriter(QFileDevice *file, qint64 at) : file(file), at(at) {}
+
+    qint64 position() const { return at; }
+
+    /** the offset of the payload, -1 if it couldn't be written */
+    qint64 write(const char *tag, const char *payload, qint64 length)
+    {
+        uchar header[CHUNK_HEADER_SIZE] = {};
+        memcpy(header, tag, 4);
+        qToLittleEndian<qint64>(length, header + 8);
+
+        static const char padding[CHUNK_ALIGNMENT] = {};
+        const int pad = int((CHUNK_ALIGNMENT - length % CHUNK_ALIGNMENT)
+                            % CHUNK_ALIGNMENT);
+
+        if(!file->seek(at)
+           || file->write(reinterpret_cast<const char*>(header), CHUNK_HEADER_SIZE)
+                  != CHUNK_HEADER_SIZE
+           || file->write(payload, length) != length
+           || file->write(padding, pad) != pad)
+            return -1;
+
+        const qint64 offset = at + CHUNK_HEADER_SIZE;
+        at = offset + length + pad;
+        return offset;
+    }
+
+    qint64 write(const char *tag, const QByteArray &payload)
+    {
+        return write(tag, payload.constData(), payload.size());
+    }
+
+private:
+    QFileDevice *file;
+    qint64 at;
+};
+}
+
+/** a project file mapped into memory, shared by the tiles used in place */
+class ProjectFile::Mapping
+{
+public:
+    Mapping(const QString &fileName) : file(fileName), data(0), size(0), refs(1) {}
+    ~Mapping()
+    {
+        if(data)
+            file.unmap(data);
+    }
+
+    /** the cleanup function of the tiles using the mapping */
+    static void release(void *info)
+    {
+        Mapping *mapping = static_cast<Mapping*>(info);
+        if(!mapping->refs.deref())
+            delete mapping;
+    }
+
+    QFile file;
+    uchar *data;
+    qint64 size;
+    QAtomicInt refs;
+};
+
+ProjectFile::ProjectFile()
+    : liveBytes(0), fileEnd(0)
+{
+}
+
+ProjectFile::~ProjectFile()
+{
+}
+
+/**
+ * @brief ProjectFile::save - save the layers and settings to fileName, only
+ *                            appending what changed when it is the file
+ *                            last saved or opened
+ *
+ */
+bool ProjectFile::save(const QString &fileName, const LayerStack &layers,
+                       const QByteArray &settings, QString *error)
+{
+    // write the file anew once most of it is garbage
+    if(fileName == path && liveBytes * 2 >= fileEnd
+       && append(layers, settings, error))
+        return true;
+
+    return saveAll(fileName, layers, settings, error);
+}
+
+/**
+ * @brief ProjectFile::open - replace the layers with the ones saved in
+ *                            fileName and hand back the settings saved
+ *                            with them
+ *
+ */
+bool ProjectFile::open(const QString &fileName, LayerStack *layers,
+                       QByteArray *settings, QString *error)
+{
+    Mapping *mapping = new Mapping(fileName);
+    if(!mapping->file.open(QIODevice::ReadOnly))
+    {
+        *error = mapping->file.errorString();
+        Mapping::release(mapping);
+        return false;
+    }
+    mapping->size = mapping->file.size();
+    mapping->data = mapping->size > 0 ? mapping->file.map(0, mapping->size) : 0;
+
+    const uchar *data = mapping->data;
+    Header header;
+    if(!data || !unpackHeader(data, mapping->size, &header))
+    {
+        *error = QObject::tr("This isn't a canvas project.");
+        Mapping::release(mapping);
+        return false;
+    }
+
+    // the directory, then the document it points at
+    QByteArray directory = QByteArray::fromRawData(
+        reinterpret_cast<const char*>(data + header.directoryOffset),
+        int(header.directoryLength));
+    QDataStream dirIn(directory);
+    dirIn.setVersion(QDataStream::Qt_5_6);
+    qint64 metaOffset;
+    quint32 metaLength;
+    dirIn >> metaOffset >> metaLength;
+    if(dirIn.status() != QDataStream::Ok || metaOffset < HEADER_SIZE
+       || metaLength > quint32(INT_MAX)
+       || metaLength > header.fileEnd - metaOffset)
+    {
+        *error = QObject::tr("The project is damaged.");
+        Mapping::release(mapping);
+        return false;
+    }
+
+    QByteArray meta = QByteArray::fromRawData(
+        reinterpret_cast<const char*>(data + metaOffset), int(metaLength));
+    QDataStream metaIn(meta);
+    metaIn.setVersion(QDataStream::Qt_5_6);
+
+    QSize size;
+    qint32 count, current;
+    metaIn >> size >> count >> current;
+    if(metaIn.status() != QDataStream::Ok || size.isEmpty()
+       || size.width() > MAX_IMG_WIDTH || size.height() > MAX_IMG_HEIGHT
+       || count < 1)
+    {
+        *error = QObject::tr("The project is damaged.");
+        Mapping::release(mapping);
+        return false;
+    }
+
+    QHash<qint64, Entry> opened;
+    qint64 live = HEADER_SIZE;
+    LayerStack::State before = layers->state();
+    bool damaged = false;
+
+    for(int i = 0; i < count && !damaged; ++i)
+    {
+        LayerRecord record;
+        metaIn >> record;
+
+        TiledImage image;
+        image.reset(size, record.fill, record.format);
+        if(!record.isValid())
+            damaged = true;
+
+        // the tiles of the layer
+        qint32 tiles;
+        dirIn >> tiles;
+        for(int t = 0; t < tiles && !damaged; ++t)
+        {
+            qint32 column, row;
+            Entry entry;
+            dirIn >> column >> row >> entry.encoding >> entry.offset >> entry.length;
+            if(dirIn.status() != QDataStream::Ok || column < 0 || row < 0
+               || column >= image.columns() || row >= image.rows()
+               || entry.offset < HEADER_SIZE
+               || entry.length > quint32(INT_MAX)
+               || entry.length > header.fileEnd - entry.offset)
+            {
+                damaged = true;
+                break;
+            }
+
+            const QRect rect = image.tileRect(column, row);
+            const uchar *payload = data + entry.offset;
+            QImage tile;
+            if(entry.encoding == RAW_ENCODING
+               && entry.length == quint32(rect.width() * rect.height() * 4)
+               && entry.offset % 4 == 0)
+            {
+                // used in place, the mapping stays until the tile goes
+                mapping->refs.ref();
+                tile = QImage(payload, rect.width(), rect.height(),
+                              rect.width() * 4, image.format(),
+                              Mapping::release, mapping);
+            }
+            else if(entry.encoding == RLE_ENCODING)
+            {
+                tile = decompressImage(QByteArray::fromRawData(
+                    reinterpret_cast<const char*>(payload), int(entry.length)),
+                    rect.size(), image.format());
+            }
+
+            if(tile.size() != rect.size() || tile.format() != image.format())
+            {
+                damaged = true;
+                break;
+            }
+            image.setTile(column, row, tile);
+            // decoded tiles are left out, the next save writes them raw
+            if(entry.encoding == RAW_ENCODING)
+                opened.insert(tile.cacheKey(), entry);
+            live += CHUNK_HEADER_SIZE + entry.length;
+        }
+
+        record.addTo(layers, i, image);
+    }
+
+    if(!damaged)
+        metaIn >> *settings;
+    if(damaged || metaIn.status() != QDataStream::Ok
+       || dirIn.status() != QDataStream::Ok)
+    {
+        // put the old layers back, dropping the half read ones
+        QList<Layer*> read;
+        for(int i = 0; i < layers->count(); ++i)
+            if(!before.layers.contains(layers->layer(i)))
+                read.append(layers->layer(i));
+        layers->restore(before);
+        qDeleteAll(read);
+
+        *error = QObject::tr("The project is damaged.");
+        Mapping::release(mapping);
+        return false;
+    }
+    layers->setCurrentIndex(qBound(0, int(current), layers->count() - 1));
+
+    path = fileName;
+    entries = opened;
+    liveBytes = live + metaLength + header.directoryLength + 2 * CHUNK_HEADER_SIZE;
+    fileEnd = header.fileEnd;
+    Mapping::release(mapping);
+    return true;
+}
+
+/**
+ * @brief ProjectFile::close - forget the file, the next save writes
+ *                             a whole new one
+ *
+ */
+void ProjectFile::close()
+{
+    path.clear();
+    entries.clear();
+    liveBytes = fileEnd = 0;
+}
+
+/**
+ * @brief ProjectFile::saveAll - write a whole new project file, replacing
+ *                               fileName only once it is complete
+ *
+ */
+bool ProjectFile::saveAll(const QString &fileName, const LayerStack &layers,
+                          const QByteArray &settings, QString *error)
+{
+    QSaveFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        *error = file.errorString();
+        return false;
+    }
+
+    entries.clear();
+    const QByteArray placeholder(HEADER_SIZE, 0);
+    if(file.write(placeholder) != HEADER_SIZE
+       || !write(&file, HEADER_SIZE, layers, settings, error))
+    {
+        if(error->isEmpty())
+            *error = file.errorString();
+        file.cancelWriting();
+        close();
+        return false;
+    }
+
+    if(!file.commit())
+    {
+        *error = file.errorString();
+        close();
+        return false;
+    }
+    path = fileName;
+    return true;
+}
+
+/**
+ * @brief ProjectFile::append - add what changed to the end of the file
+ *                              and point the header at it
+ *
+ */
+bool ProjectFile::append(const LayerStack &layers, const QByteArray &settings,
+                         QString *error)
+{
+    QFile file(path);
+    if(!file.open(QIODevice::ReadWrite))
+        return false;
+
+    // the file must still be the one we wrote last
+    const QByteArray head = file.read(HEADER_SIZE);
+    Header header;
+    if(!unpackHeader(reinterpret_cast<const uchar*>(head.constData()),
+                     head.size(), &header)
+       || header.fileEnd != fileEnd || file.size() < fileEnd)
+        return false;
+
+    // drop whatever an interrupted save left after the end
+    if(!file.resize(fileEnd))
+        return false;
+
+    const qint64 end = fileEnd;
+    if(!write(&file, end, layers, settings, error) || !file.flush())
+    {
+        file.resize(end);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief ProjectFile::write - write the tiles not in the file yet, the
+ *                             document and the directory from at on, then
+ *                             the header. The file must already hold the
+ *                             tiles in entries.
+ *
+ */
+bool ProjectFile::write(QFileDevice *file, qint64 at, const LayerStack &layers,
+                        const QByteArray &settings, QString *error)
+{
+    ChunkWriter writer(file, at);
+    QHash<qint64, Entry> written;
+    qint64 live = HEADER_SIZE;
+
+    // every tile of every layer, in the order of the directory
+    QVector<QVector<QPoint> > positions(layers.count());
+    QVector<QVector<qint64> > keys(layers.count());
+    for(int i = 0; i < layers.count(); ++i)
+    {
+        const TiledImage &image = layers.layer(i)->image;
+        for(int row = 0; row < image.rows(); ++row)
+        {
+            for(int column = 0; column < image.columns(); ++column)
+            {
+                QImage tile = image.tile(column, row);
+                if(tile.isNull())
+                    continue;
+
+                const qint64 key = tile.cacheKey();
+                positions[i].append(QPoint(column, row));
+                keys[i].append(key);
+                if(written.contains(key))
+                    continue;
+
+                if(entries.contains(key))
+                {
+                    written.insert(key, entries.value(key));
+                }
+                else
+                {
+                    // raw, so the next open uses it in place
+                    Entry entry;
+                    entry.encoding = RAW_ENCODING;
+                    entry.length = quint32(tile.bytesPerLine() * tile.height());
+                    entry.offset = writer.write(TILE_TAG,
+                        reinterpret_cast<const char*>(tile.constBits()),
+                        entry.length);
+                    if(entry.offset < 0)
+                        return false;
+                    written.insert(key, entry);
+                }
+            }
+        }
+    }
+
+    // the document
+    QByteArray meta;
+    QDataStream metaOut(&meta, QIODevice::WriteOnly);
+    metaOut.setVersion(QDataStream::Qt_5_6);
+    metaOut << layers.size() << qint32(layers.count()) << qint32(layers.currentIndex());
+    for(int i = 0; i < layers.count(); ++i)
+    {
+        metaOut << LayerRecord(*layers.layer(i));
+    }
+    metaOut << settings;
+
+    const qint64 metaOffset = writer.write(META_TAG, meta);
+    if(metaOffset < 0)
+        return false;
+
+    // and the directory
+    QByteArray directory;
+    QDataStream dirOut(&directory, QIODevice::WriteOnly);
+    dirOut.setVersion(QDataStream::Qt_5_6);
+    dirOut << metaOffset << quint32(meta.size());
+    QSet<qint64> counted;
+    for(int i = 0; i < layers.count(); ++i)
+    {
+        dirOut << qint32(positions.at(i).size());
+        for(int t = 0; t < positions.at(i).size(); ++t)
+        {
+            const Entry entry = written.value(keys.at(i).at(t));
+            dirOut << qint32(positions.at(i).at(t).x())
+                   << qint32(positions.at(i).at(t).y())
+                   << entry.encoding << entry.offset << entry.length;
+            if(!counted.contains(entry.offset))
+            {
+                counted.insert(entry.offset);
+                live += CHUNK_HEADER_SIZE + entry.length;
+            }
+        }
+    }
+
+    const qint64 directoryOffset = writer.write(DIRC_TAG, directory);
+    if(directoryOffset < 0)
+        return false;
+
+    // last, point the header at the new directory
+    Header header;
+    header.version = VERSION;
+    header.flags = 0;
+    header.directoryOffset = directoryOffset;
+    header.directoryLength = quint32(directory.size());
+    header.fileEnd = writer.position();
+    if(!file->seek(0) || file->write(packHeader(header)) != HEADER_SIZE)
+        return false;
+
+    entries = written;
+    liveBytes = live + meta.size() + directory.size() + 2 * CHUNK_HEADER_SIZE;
+    fileEnd = header.fileEnd;
+    error->clear();
+    return true;
+}
+
+/**
+ * @brief LayerRecord::LayerRecord - describe a layer
+ *
+ */
+LayerRecord::LayerRecord(const Layer &layer)
+    : style(layer.style), fill(layer.image.fillColor()),
+      format(layer.image.format()), vector(layer.isVector())
+{
+    if(vector)
+        for(int id : layer.scene->ids())
+            shapes.insert(id, layer.scene->shape(id));
+}
+
+/**
+ * @brief LayerRecord::isValid - whether the layer can be tiled like this
+ *
+ */
+bool LayerRecord::isValid() const
+{
+    return format == QImage::Format_RGB32
+           || format == QImage::Format_ARGB32_Premultiplied;
+}
+
+/**
+ * @brief LayerRecord::addTo - put the layer described with image as its
+ *                             pixels at index of layers. The layer at
+ *                             index 0 replaces every layer, the old ones
+ *                             are left to whoever holds their state.
+ *
+ */
+void LayerRecord::addTo(LayerStack *layers, int index,
+                        const TiledImage &image) const
+{
+    Layer *layer;
+    if(index == 0)
+    {
+        layers->reset(image, vector);
+        layer = layers->layer(0);
+    }
+    else
+    {
+        layer = layers->insert(index, style.name, vector);
+        layer->image = image;
+    }
+
+    // vector layers at the bottom keep their shapes too
+    if(layer->scene)
+    {
+        for(auto shape = shapes.constBegin(); shape != shapes.constEnd(); ++shape)
+            layer->scene->insert(shape.key(), shape.value());
+    }
+    layers->setStyle(index, style);
+}
+
+/**
+ * @brief operator<< - write a layer record to a stream
+ *
+ */
+QDataStream& operator<<(QDataStream &out, const LayerRecord &record)
+{
+    out << record.style.name << record.style.visible << record.style.opacity
+        << qint32(record.style.blend) << record.fill << qint32(record.format)
+        << record.vector;
+    if(record.vector)
+    {
+        out << qint32(record.shapes.size());
+        for(auto shape = record.shapes.constBegin();
+            shape != record.shapes.constEnd(); ++shape)
+            out << qint32(shape.key()) << shape.value();
+    }
+    return out;
+}
+
+/**
+ * @brief operator>> - read a layer record back from a stream
+ *
+ */
+QDataStream& operator>>(QDataStream &in, LayerRecord &record)
+{
+    qint32 blend, format;
+    in >> record.style.name >> record.style.visible >> record.style.opacity
+       >> blend >> record.fill >> format >> record.vector;
+    record.style.blend = QPainter::CompositionMode(blend);
+    record.format = QImage::Format(format);
+
+    record.shapes.clear();
+    qint32 count = 0;
+    if(record.vector)
+        in >> count;
+    for(int i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+    {
+        qint32 id;
+        Stroke stroke;
+        in >> id >> stroke;
+        record.shapes.insert(id, stroke);
+    }
+    return in;
+}
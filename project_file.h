@@ -0,0 +1,102 @@
+#ifndef PROJECT_FILE_H
+#define PROJECT_FILE_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QFileDevice>
+#include <QHash>
+#include <QMap>
+#include <QString>
+
+#include "layer_stack.h"
+
+
+/**
+ * everything about a layer but its pixels, as projects and the autosave
+ * journal keep it
+ */
+struct LayerRecord
+{
+    LayerRecord() : format(QImage::Format_ARGB32_Premultiplied), vector(false) {}
+    explicit LayerRecord(const Layer&);
+
+    bool isValid() const;
+    void addTo(LayerStack*, int index, const TiledImage&) const;
+
+    LayerStyle style;
+    QColor fill;
+    QImage::Format format;
+    bool vector;
+    QMap<int, Stroke> shapes;
+};
+
+QDataStream& operator<<(QDataStream&, const LayerRecord&);
+QDataStream& operator>>(QDataStream&, LayerRecord&);
+
+/**
+ * the native project file, keeping every layer with its style and shapes
+ * together with settings the canvas hands in as a blob.
+ *
+ * The file is a header followed by chunks, each a tag, a length and a
+ * payload padded to 16 bytes: one TILE chunk per tile holding its raw
+ * pixels (run-length encoded, see compression.h, in files saved by older
+ * versions), a META chunk describing the document and a DIRC chunk, the
+ * tile directory, listing where every tile of every layer is. The header
+ * points at the directory in use.
+ *
+ * Saving to the file last saved or opened only appends the tiles changed
+ * since, known by their QImage::cacheKey(), then a new META and DIRC, and
+ * finally points the header at the new directory, so an interrupted save
+ * leaves the previous one intact. Once more than half of the file is
+ * chunks no directory points at any more it is written anew.
+ *
+ * Opening maps the file into memory. Raw tiles are used in place, the
+ * operating system pages them in once they are drawn and they are only
+ * copied when painted on, so opening doesn't depend on the size of the
+ * image. Encoded tiles of older files are decoded on opening and written
+ * raw by the next save. The mapping lives as long as any tile still uses
+ * it.
+ */
+class ProjectFile
+{
+public:
+    ProjectFile();
+    ~ProjectFile();
+
+    QString fileName() const { return path; }
+
+    bool save(const QString &fileName, const LayerStack&,
+              const QByteArray &settings, QString *error);
+    bool open(const QString &fileName, LayerStack*, QByteArray *settings,
+              QString *error);
+    void close();
+
+private:
+    /** where the payload of a tile is in the file */
+    struct Entry
+    {
+        quint8 encoding;
+        qint64 offset;
+        quint32 length;
+    };
+
+    class Mapping;
+
+    bool saveAll(const QString &fileName, const LayerStack&,
+                 const QByteArray &settings, QString *error);
+    bool append(const LayerStack&, const QByteArray &settings, QString *error);
+    bool write(QFileDevice*, qint64 at, const LayerStack&,
+               const QByteArray &settings, QString *error);
+
+    QString path;
+
+    /** the tiles the directory in use points at, by cache key */
+    QHash<qint64, Entry> entries;
+    qint64 liveBytes;
+    qint64 fileEnd;
+
+    ProjectFile(const ProjectFile&);
+    ProjectFile& operator=(const ProjectFile&);
+};
+
+#endif // PROJECT_FILE_H
@@ -0,0 +1,276 @@
+#include <cstring>
+
+#include "qoi.h"
+
+
+namespace
+{
+const char MAGIC[] = "qoif";
+const int HEADER_SIZE = 14;
+const uchar END_MARKER[] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+const uchar OP_INDEX = 0x00;
+const uchar OP_DIFF = 0x40;
+const uchar OP_LUMA = 0x80;
+const uchar OP_RUN = 0xc0;
+const uchar OP_RGB = 0xfe;
+const uchar OP_RGBA = 0xff;
+const uchar OP_MASK = 0xc0;
+
+const int MAX_RUN = 62;
+
+/** an unpremultiplied pixel, in the byte order of Format_RGBA8888 */
+struct Pixel
+{
+    uchar r, g, b, a;
+
+    bool operator==(const Pixel &other) const
+    {
+        return r == other.r && g == other.g && b == other.b && a == other.a;
+    }
+    bool operator!=(const Pixel &other) const { return !(*this == other); }
+
+    int hash() const { return (r * 3 + g * 5 + b * 7 + a * 11) % 64; }
+};
+
+void putBigEndian(uchar *at, quint32 value)
+{
+    at[0] = uchar(value >> 24);
+    at[1] = uchar(value >> 16);
+    at[2] = uchar(value >> 8);
+    at[3] = uchar(value);
+}
+
+quint32 getBigEndian(const uchar *at)
+{
+    return quint32(at[0]) << 24 | quint32(at[1]) << 16 | quint32(at[2]) << 8 | at[3];
+}
+}
+
+/**
+ * @brief encodeQoi - code the pixels of image as QOI, with an alpha
+ *                    channel only if the image has one
+ *
+ */
+QByteArray encodeQoi(const QImage &image)
+{
+    if(image.isNull())
+        return QByteArray();
+
+    const bool alpha = image.hasAlphaChannel();
+    const QImage pixels = image.convertToFormat(alpha ? QImage::Format_RGBA8888
+                                                      : QImage::Format_RGBX8888);
+
+    // every pixel in full at worst
+    QByteArray data;
+    data.resize(HEADER_SIZE + pixels.width() * pixels.height() * 5
+                + int(sizeof(END_MARKER)));
+    uchar *out = reinterpret_cast<uchar*>(data.data());
+
+    memcpy(out, MAGIC, 4);
+    putBigEndian(out + 4, quint32(pixels.width()));
+    putBigEndian(out + 8, quint32(pixels.height()));
+    out[12] = alpha ? 4 : 3;
+    out[13] = 0;
+    out += HEADER_SIZE;
+
+    Pixel seen[64];
+    memset(seen, 0, sizeof(seen));
+    Pixel previous = {0, 0, 0, 255};
+    int run = 0;
+
+    for(int y = 0; y < pixels.height(); ++y)
+    {
+        const Pixel *line = reinterpret_cast<const Pixel*>(pixels.constScanLine(y));
+        for(int x = 0; x < pixels.width(); ++x)
+        {
+            const Pixel pixel = line[x];
+            if(pixel == previous)
+            {
+                if(++run == MAX_RUN)
+                {
+                    *out++ = OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if(run > 0)
+            {
+                *out++ = OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            const int index = pixel.hash();
+            if(seen[index] == pixel)
+            {
+                *out++ = OP_INDEX | index;
+            }
+            else
+            {
+                seen[index] = pixel;
+                if(pixel.a == previous.a)
+                {
+                    const signed char dr = static_cast<signed char>(pixel.r - previous.r);
+                    const signed char dg = static_cast<signed char>(pixel.g - previous.g);
+                    const signed char db = static_cast<signed char>(pixel.b - previous.b);
+                    const int drg = dr - dg;
+                    const int dbg = db - dg;
+
+                    if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                    {
+                        *out++ = OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                    }
+                    else if(dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7
+                            && dbg >= -8 && dbg <= 7)
+                    {
+                        *out++ = OP_LUMA | (dg + 32);
+                        *out++ = uchar((drg + 8) << 4 | (dbg + 8));
+                    }
+                    else
+                    {
+                        *out++ = OP_RGB;
+                        *out++ = pixel.r;
+                        *out++ = pixel.g;
+                        *out++ = pixel.b;
+                    }
+                }
+                else
+                {
+                    *out++ = OP_RGBA;
+                    *out++ = pixel.r;
+                    *out++ = pixel.g;
+                    *out++ = pixel.b;
+                    *out++ = pixel.a;
+                }
+            }
+            previous = pixel;
+        }
+    }
+    if(run > 0)
+        *out++ = OP_RUN | (run - 1);
+
+    memcpy(out, END_MARKER, sizeof(END_MARKER));
+    out += sizeof(END_MARKER);
+
+    data.resize(int(out - reinterpret_cast<uchar*>(data.data())));
+    return data;
+}
+
+/**
+ * @brief QoiDecoder::QoiDecoder - read the header of the QOI image in the
+ *                                 size bytes at data, which must stay
+ *                                 around while lines are read
+ *
+ */
+QoiDecoder::QoiDecoder(const uchar *data, qint64 size)
+    : in(data), end(data), alpha(false), run(0)
+{
+    memset(seen, 0, sizeof(seen));
+    pixel[0] = pixel[1] = pixel[2] = 0;
+    pixel[3] = 255;
+
+    if(size < HEADER_SIZE + qint64(sizeof(END_MARKER))
+       || memcmp(data, MAGIC, 4) != 0 || (data[12] != 3 && data[12] != 4))
+        return;
+
+    const quint32 width = getBigEndian(data + 4);
+    const quint32 height = getBigEndian(data + 8);
+    if(width == 0 || height == 0 || width > 32768 || height > 32768)
+        return;
+
+    imageSize = QSize(int(width), int(height));
+    alpha = data[12] == 4;
+    in = data + HEADER_SIZE;
+    end = data + size - sizeof(END_MARKER);
+}
+
+/**
+ * @brief QoiDecoder::readLine - decode the next line into line, as
+ *                               premultiplied ARGB32 when the image has an
+ *                               alpha channel and RGB32 otherwise. False if
+ *                               the data ends early.
+ *
+ */
+bool QoiDecoder::readLine(QRgb *line)
+{
+    if(imageSize.isEmpty())
+        return false;
+
+    for(int x = 0; x < imageSize.width(); ++x)
+    {
+        if(run > 0)
+        {
+            --run;
+        }
+        else
+        {
+            if(in >= end)
+                return false;
+
+            const uchar op = *in++;
+            if(op == OP_RGB || op == OP_RGBA)
+            {
+                const int size = op == OP_RGB ? 3 : 4;
+                if(end - in < size)
+                    return false;
+                memcpy(pixel, in, size);
+                in += size;
+            }
+            else if((op & OP_MASK) == OP_INDEX)
+            {
+                memcpy(pixel, seen[op], 4);
+            }
+            else if((op & OP_MASK) == OP_DIFF)
+            {
+                pixel[0] += ((op >> 4) & 3) - 2;
+                pixel[1] += ((op >> 2) & 3) - 2;
+                pixel[2] += (op & 3) - 2;
+            }
+            else if((op & OP_MASK) == OP_LUMA)
+            {
+                if(in >= end)
+                    return false;
+                const int dg = (op & 0x3f) - 32;
+                const uchar next = *in++;
+                pixel[0] += dg + ((next >> 4) & 0x0f) - 8;
+                pixel[1] += dg;
+                pixel[2] += dg + (next & 0x0f) - 8;
+            }
+            else
+            {
+                run = op & 0x3f;
+            }
+            memcpy(seen[(pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7
+                         + pixel[3] * 11) % 64], pixel, 4);
+        }
+
+        line[x] = alpha ? qPremultiply(qRgba(pixel[0], pixel[1], pixel[2], pixel[3]))
+                        : qRgb(pixel[0], pixel[1], pixel[2]);
+    }
+    return true;
+}
+
+/**
+ * @brief decodeQoi - the image coded in data, premultiplied ARGB32 when it
+ *                    has an alpha channel, RGB32 otherwise
+ *
+ */
+QImage decodeQoi(const QByteArray &data)
+{
+    QoiDecoder decoder(reinterpret_cast<const uchar*>(data.constData()),
+                       data.size());
+    if(!decoder.isValid())
+        return QImage();
+
+    QImage image(decoder.size(), decoder.hasAlphaChannel()
+                                     ? QImage::Format_ARGB32_Premultiplied
+                                     : QImage::Format_RGB32);
+    if(image.isNull())
+        return QImage();
+
+    for(int y = 0; y < image.height(); ++y)
+        if(!decoder.readLine(reinterpret_cast<QRgb*>(image.scanLine(y))))
+            return QImage();
+    return image;
+}
@@ -0,0 +1,46 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+
+
+/**
+ * the "Quite OK Image" format: lossless, about as small as PNG for drawings
+ * and many times faster to write and read. Pixels are coded one after the
+ * other as runs of the previous pixel, an index into the last 64 distinct
+ * pixels seen, a small difference from the previous pixel, or in full.
+ * See https://qoiformat.org for the specification.
+ */
+QByteArray encodeQoi(const QImage&);
+
+/** a null image if data isn't a whole QOI image */
+QImage decodeQoi(const QByteArray &data);
+
+/**
+ * decodes a QOI image a line at a time, top to bottom, so large images can
+ * be read straight out of a memory mapped file without a second copy
+ */
+class QoiDecoder
+{
+public:
+    QoiDecoder(const uchar *data, qint64 size);
+
+    bool isValid() const { return !imageSize.isEmpty(); }
+    QSize size() const { return imageSize; }
+    bool hasAlphaChannel() const { return alpha; }
+
+    bool readLine(QRgb *line);
+
+private:
+    const uchar *in;
+    const uchar *end;
+    QSize imageSize;
+    bool alpha;
+    int run;
+    uchar pixel[4];
+    uchar seen[64][4];
+};
+
+#endif // QOI_H
@@ -0,0 +1,389 @@
+#include <QVector>
+#include <QtMath>
+
+#include "parallel.h"
+#include "resample.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RESAMPLE_X86 1
+#include <immintrin.h>
+#endif
+
+
+/**
+ * Every output pixel is a weighted sum of a run of 'taps' source pixels,
+ * channel by channel, with weights in 14 bit fixed point adding up to
+ * exactly 1 << 14. The sums are rounded the same way by every kernel,
+ *
+ *   c = clamp((sum + (1 << 13)) >> 14, 0, 255),  c = min(c, alpha)
+ *
+ * so the scalar and vector kernels give the same pixels, and opaque images
+ * stay opaque. The last step keeps Lanczos' overshoot premultiplied.
+ */
+namespace
+{
+/** fraction bits of the weights */
+const int WEIGHT_BITS = 14;
+
+/** rows filtered by a thread at a time */
+const int BAND_ROWS = 16;
+
+typedef void (*HorizontalKernel)(quint32*, const quint32*, const int*,
+                                 const qint16*, int, int);
+typedef void (*VerticalKernel)(quint32*, const quint32* const*,
+                               const qint16*, int, int);
+
+/**
+ * the weights the pixels along one axis are summed with: output pixel i
+ * sums taps source pixels from first[i] on, with weights[i * taps] on
+ */
+struct Taps
+{
+    int taps;
+    QVector<int> first;
+    QVector<qint16> weights;
+};
+
+/**
+ * @brief filterRadius - how far from its center a filter reaches, in
+ *                       source pixels when enlarging
+ *
+ */
+qreal filterRadius(ResampleFilter filter)
+{
+    switch(filter)
+    {
+    case box_filter: return 0.5;
+    case bilinear_filter: return 1;
+    case lanczos_filter: return 3;
+    }
+    return 1;
+}
+
+qreal sinc(qreal x)
+{
+    if(x == 0)
+        return 1;
+    x *= M_PI;
+    return qSin(x) / x;
+}
+
+/**
+ * @brief filterWeight - the weight of a pixel x from the center, the box
+ *                       is half open so neighbours never share a pixel
+ *
+ */
+qreal filterWeight(ResampleFilter filter, qreal x)
+{
+    switch(filter)
+    {
+    case box_filter:
+        return x >= -0.5 && x < 0.5 ? 1 : 0;
+    case bilinear_filter:
+        return qMax<qreal>(0, 1 - qAbs(x));
+    case lanczos_filter:
+        return qAbs(x) < 3 ? sinc(x) * sinc(x / 3) : 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief makeTaps - the weights to resample from pixels to to pixels
+ *                   along an axis. Shrinking widens the filter by the
+ *                   ratio, pixels past the edges are left out and the
+ *                   rest weighed up to make up for them.
+ *
+ */
+Taps makeTaps(int from, int to, ResampleFilter filter)
+{
+    const qreal scale = qreal(to) / from;
+    const qreal stretch = qMax<qreal>(1, 1 / scale);
+    const qreal support = filterRadius(filter) * stretch;
+
+    Taps result;
+    result.taps = qMin(from, qCeil(support * 2) + 1);
+    result.first.resize(to);
+    result.weights.fill(0, to * result.taps);
+
+    QVector<qreal> weights(result.taps);
+    for(int i = 0; i < to; ++i)
+    {
+        const qreal center = (i + 0.5) / scale - 0.5;
+        const int first = qBound(0, qCeil(center - support), from - result.taps);
+
+        qreal total = 0;
+        for(int k = 0; k < result.taps; ++k)
+        {
+            weights[k] = filterWeight(filter, (first + k - center) / stretch);
+            total += weights[k];
+        }
+        if(total == 0)
+        {
+            // nothing under the filter, take the nearest pixel
+            weights.fill(0);
+            weights[qBound(0, qRound(center) - first, result.taps - 1)] = 1;
+            total = 1;
+        }
+
+        // the rounding error goes to the heaviest weight
+        qint16 *fixed = result.weights.data() + i * result.taps;
+        int sum = 0;
+        int heaviest = 0;
+        for(int k = 0; k < result.taps; ++k)
+        {
+            fixed[k] = qint16(qBound(-32767,
+                                     qRound(weights[k] / total * (1 << WEIGHT_BITS)),
+                                     32767));
+            sum += fixed[k];
+            if(qAbs(fixed[k]) > qAbs(fixed[heaviest]))
+                heaviest = k;
+        }
+        fixed[heaviest] += (1 << WEIGHT_BITS) - sum;
+        result.first[i] = first;
+    }
+    return result;
+}
+
+inline quint32 packScalar(const int *sums)
+{
+    int channels[4];
+    for(int c = 0; c < 4; ++c)
+        channels[c] = qBound(0, (sums[c] + (1 << (WEIGHT_BITS - 1))) >> WEIGHT_BITS, 255);
+
+    const int alpha = channels[3];
+    return quint32(qMin(channels[0], alpha)) | quint32(qMin(channels[1], alpha)) << 8
+           | quint32(qMin(channels[2], alpha)) << 16 | quint32(alpha) << 24;
+}
+
+void horizontalScalar(quint32 *dst, const quint32 *src, const int *first,
+                      const qint16 *weights, int taps, int width)
+{
+    for(int x = 0; x < width; ++x, weights += taps)
+    {
+        const quint32 *pixels = src + first[x];
+        int sums[4] = {0, 0, 0, 0};
+        for(int k = 0; k < taps; ++k)
+            for(int c = 0; c < 4; ++c)
+                sums[c] += int((pixels[k] >> (8 * c)) & 0xff) * weights[k];
+        dst[x] = packScalar(sums);
+    }
+}
+
+void verticalScalar(quint32 *dst, const quint32 * const *rows,
+                    const qint16 *weights, int taps, int width)
+{
+    for(int x = 0; x < width; ++x)
+    {
+        int sums[4] = {0, 0, 0, 0};
+        for(int k = 0; k < taps; ++k)
+            for(int c = 0; c < 4; ++c)
+                sums[c] += int((rows[k][x] >> (8 * c)) & 0xff) * weights[k];
+        dst[x] = packScalar(sums);
+    }
+}
+
+#ifdef RESAMPLE_X86
+
+//////////////////////////////////////////////////////////////
+// SSE2, two pixels' channels interleaved and summed by madd //
+//////////////////////////////////////////////////////////////
+
+__attribute__((target("sse2")))
+inline __m128i weightPairSse2(qint16 first, qint16 second)
+{
+    return _mm_set1_epi32(int(quint32(quint16(first))
+                              | quint32(quint16(second)) << 16));
+}
+
+__attribute__((target("sse2")))
+inline quint32 packSse2(__m128i sums)
+{
+    sums = _mm_srai_epi32(_mm_add_epi32(sums, _mm_set1_epi32(1 << (WEIGHT_BITS - 1))),
+                          WEIGHT_BITS);
+    __m128i channels = _mm_packs_epi32(sums, sums);
+    channels = _mm_min_epi16(_mm_max_epi16(channels, _mm_setzero_si128()),
+                             _mm_set1_epi16(255));
+    channels = _mm_min_epi16(channels, _mm_shufflelo_epi16(channels,
+                                                           _MM_SHUFFLE(3, 3, 3, 3)));
+    return quint32(_mm_cvtsi128_si32(_mm_packus_epi16(channels, channels)));
+}
+
+__attribute__((target("sse2")))
+void horizontalSse2(quint32 *dst, const quint32 *src, const int *first,
+                    const qint16 *weights, int taps, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    for(int x = 0; x < width; ++x, weights += taps)
+    {
+        const quint32 *pixels = src + first[x];
+        __m128i sums = zero;
+
+        int k = 0;
+        for(; k + 1 < taps; k += 2)
+        {
+            // b0 b1 g0 g1 r0 r1 a0 a1
+            __m128i pair = _mm_unpacklo_epi8(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels + k)), zero);
+            pair = _mm_unpacklo_epi16(pair, _mm_srli_si128(pair, 8));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(
+                pair, weightPairSse2(weights[k], weights[k + 1])));
+        }
+        if(k < taps)
+        {
+            __m128i single = _mm_unpacklo_epi8(_mm_cvtsi32_si128(int(pixels[k])), zero);
+            single = _mm_unpacklo_epi16(single, zero);
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(
+                single, weightPairSse2(weights[k], 0)));
+        }
+        dst[x] = packSse2(sums);
+    }
+}
+
+__attribute__((target("sse2")))
+void verticalSse2(quint32 *dst, const quint32 * const *rows,
+                  const qint16 *weights, int taps, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    int x = 0;
+    for(; x + 1 < width; x += 2)
+    {
+        __m128i left = zero;
+        __m128i right = zero;
+
+        for(int k = 0; k < taps; k += 2)
+        {
+            // two pixels from each of two rows, b b g g r r a a per pixel
+            __m128i upper = _mm_unpacklo_epi8(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k] + x)), zero);
+            __m128i lower = zero;
+            qint16 second = 0;
+            if(k + 1 < taps)
+            {
+                lower = _mm_unpacklo_epi8(
+                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k + 1] + x)),
+                    zero);
+                second = weights[k + 1];
+            }
+
+            const __m128i weight = weightPairSse2(weights[k], second);
+            left = _mm_add_epi32(left, _mm_madd_epi16(
+                _mm_unpacklo_epi16(upper, lower), weight));
+            right = _mm_add_epi32(right, _mm_madd_epi16(
+                _mm_unpackhi_epi16(upper, lower), weight));
+        }
+        dst[x] = packSse2(left);
+        dst[x + 1] = packSse2(right);
+    }
+
+    if(x < width)
+    {
+        QVector<const quint32*> last(taps);
+        for(int k = 0; k < taps; ++k)
+            last[k] = rows[k] + x;
+        verticalScalar(dst + x, last.constData(), weights, taps, 1);
+    }
+}
+
+#endif // RESAMPLE_X86
+
+struct Kernels
+{
+    HorizontalKernel horizontal;
+    VerticalKernel vertical;
+};
+
+Kernels detectKernels()
+{
+#ifdef RESAMPLE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2"))
+        return Kernels{horizontalSse2, verticalSse2};
+#endif
+    return Kernels{horizontalScalar, verticalScalar};
+}
+
+const Kernels& kernels()
+{
+    static const Kernels detected = detectKernels();
+    return detected;
+}
+}
+
+/**
+ * @brief resample - filter the rows of image into one as wide as size, then
+ *                   its columns into the result, a band of rows per thread
+ *
+ */
+QImage resample(const QImage &image, const QSize &size, ResampleFilter filter,
+                QAtomicInt *progress)
+{
+    if(image.isNull() || size.isEmpty())
+        return QImage();
+    if(image.format() != QImage::Format_ARGB32_Premultiplied
+       && image.format() != QImage::Format_RGB32)
+        return resample(image.convertToFormat(QImage::Format_ARGB32_Premultiplied),
+                        size, filter, progress);
+
+    const Taps across = makeTaps(image.width(), size.width(), filter);
+    const Taps down = makeTaps(image.height(), size.height(), filter);
+    const Kernels &kernel = kernels();
+
+    // the bits are taken once here, the threads never detach the images
+    const uchar *sourceBits = image.constBits();
+    const int sourceStride = image.bytesPerLine();
+
+    QImage rows(size.width(), image.height(), image.format());
+    uchar *rowBits = rows.bits();
+    const int rowStride = rows.bytesPerLine();
+
+    parallelFor((image.height() + BAND_ROWS - 1) / BAND_ROWS, [&](int band)
+    {
+        const int top = band * BAND_ROWS;
+        const int bottom = qMin(top + BAND_ROWS, image.height());
+        for(int y = top; y < bottom; ++y)
+            kernel.horizontal(reinterpret_cast<quint32*>(rowBits + y * rowStride),
+                              reinterpret_cast<const quint32*>(sourceBits
+                                                               + y * sourceStride),
+                              across.first.constData(), across.weights.constData(),
+                              across.taps, size.width());
+        if(progress)
+            progress->fetchAndAddRelaxed(bottom - top);
+    });
+
+    QImage result(size, image.format());
+    uchar *resultBits = result.bits();
+    const int resultStride = result.bytesPerLine();
+
+    parallelFor((size.height() + BAND_ROWS - 1) / BAND_ROWS, [&](int band)
+    {
+        const int top = band * BAND_ROWS;
+        const int bottom = qMin(top + BAND_ROWS, size.height());
+
+        QVector<const quint32*> lines(down.taps);
+        for(int y = top; y < bottom; ++y)
+        {
+            for(int k = 0; k < down.taps; ++k)
+                lines[k] = reinterpret_cast<const quint32*>(
+                    rowBits + (down.first.at(y) + k) * rowStride);
+            kernel.vertical(reinterpret_cast<quint32*>(resultBits + y * resultStride),
+                            lines.constData(), down.weights.constData() + y * down.taps,
+                            down.taps, size.width());
+        }
+        if(progress)
+            progress->fetchAndAddRelaxed(bottom - top);
+    });
+
+    return result;
+}
+
+/**
+ * @brief resampleSteps - a row for every source row filtered across and
+ *                        for every result row filtered down
+ *
+ */
+int resampleSteps(const QSize &from, const QSize &to)
+{
+    return from.height() + to.height();
+}
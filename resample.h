@@ -0,0 +1,26 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <QAtomicInt>
+#include <QImage>
+#include <QSize>
+
+#include "constants.h"
+
+
+/**
+ * resize a premultiplied ARGB32 or RGB32 image to size, keeping its format,
+ * with a separable filter: box (the average of the pixels covered, nearest
+ * neighbour when enlarging), bilinear or Lanczos-3, all widened when
+ * shrinking so every source pixel counts. Rows are filtered first, then
+ * columns, with 14 bit fixed point weights summed by SSE2 when the CPU
+ * has it, bands of rows spread across threads. When progress is given it
+ * is raised by one for every row filtered, resampleSteps() in all.
+ */
+QImage resample(const QImage&, const QSize&, ResampleFilter,
+                QAtomicInt *progress = 0);
+
+/** the rows resample() filters to resize from one size to another */
+int resampleSteps(const QSize &from, const QSize &to);
+
+#endif // RESAMPLE_H
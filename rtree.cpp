@@ -0,0 +1,379 @@
+#include "rtree.h"
+
+
+namespace
+{
+qint64 area(const QRect &rect)
+{
+    return qint64(rect.width()) * rect.height();
+}
+
+/** how much bigger box has to become to take in rect */
+qint64 enlargement(const QRect &box, const QRect &rect)
+{
+    return area(box.united(rect)) - area(box);
+}
+}
+
+RTree::RTree()
+    : root(0), count(0)
+{
+    clear();
+}
+
+RTree::~RTree()
+{
+    destroy(root);
+}
+
+/**
+ * @brief RTree::insert - add an id with its bounding rectangle, ids should
+ *                        not be added twice
+ *
+ */
+void RTree::insert(int id, const QRect &rect)
+{
+    Entry entry;
+    entry.box = rect;
+    entry.id = id;
+    entry.child = 0;
+    add(chooseLeaf(rect), entry);
+    ++count;
+}
+
+/**
+ * @brief RTree::remove - remove an id, given the rectangle it was added with
+ *
+ */
+bool RTree::remove(int id, const QRect &rect)
+{
+    Node *leaf = findLeaf(root, id, rect);
+    if(!leaf)
+        return false;
+
+    for(int i = 0; i < leaf->entries.size(); ++i)
+    {
+        if(leaf->entries.at(i).id == id)
+        {
+            leaf->entries.remove(i);
+            break;
+        }
+    }
+    --count;
+    condense(leaf);
+    return true;
+}
+
+/**
+ * @brief RTree::query - the ids whose rectangles intersect rect, in no
+ *                       particular order
+ *
+ */
+QVector<int> RTree::query(const QRect &rect) const
+{
+    QVector<int> result;
+    query(root, rect, result);
+    return result;
+}
+
+void RTree::clear()
+{
+    destroy(root);
+    root = new Node;
+    root->leaf = true;
+    root->parent = 0;
+    count = 0;
+}
+
+/**
+ * @brief RTree::chooseLeaf - the leaf whose bounds grow least by taking in
+ *                            rect, smallest first on a tie
+ *
+ */
+RTree::Node* RTree::chooseLeaf(const QRect &rect) const
+{
+    Node *node = root;
+    while(!node->leaf)
+    {
+        const Entry *best = 0;
+        qint64 bestGrowth = 0;
+        for(const Entry &entry : node->entries)
+        {
+            qint64 growth = enlargement(entry.box, rect);
+            if(!best || growth < bestGrowth
+               || (growth == bestGrowth && area(entry.box) < area(best->box)))
+            {
+                best = &entry;
+                bestGrowth = growth;
+            }
+        }
+        node = best->child;
+    }
+    return node;
+}
+
+/**
+ * @brief RTree::findLeaf - the leaf below node holding id, only the
+ *                          branches whose bounds contain rect are searched
+ *
+ */
+RTree::Node* RTree::findLeaf(Node *node, int id, const QRect &rect) const
+{
+    for(const Entry &entry : node->entries)
+    {
+        if(node->leaf)
+        {
+            if(entry.id == id)
+                return node;
+        }
+        else if(entry.box.contains(rect))
+        {
+            Node *leaf = findLeaf(entry.child, id, rect);
+            if(leaf)
+                return leaf;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief RTree::add - put an entry into node, splitting it and its
+ *                     ancestors as they overflow
+ *
+ */
+void RTree::add(Node *node, const Entry &entry)
+{
+    if(entry.child)
+        entry.child->parent = node;
+    node->entries.append(entry);
+
+    if(node->entries.size() <= MAX_ENTRIES)
+    {
+        adjust(node);
+        return;
+    }
+
+    Node *sibling = split(node);
+    if(node == root)
+    {
+        root = new Node;
+        root->leaf = false;
+        root->parent = 0;
+
+        Entry left = { boxOf(node), 0, node };
+        Entry right = { boxOf(sibling), 0, sibling };
+        root->entries << left << right;
+        node->parent = root;
+        sibling->parent = root;
+        return;
+    }
+
+    adjust(node);
+    Entry right = { boxOf(sibling), 0, sibling };
+    add(node->parent, right);
+}
+
+/**
+ * @brief RTree::split - Guttman's quadratic split. The two entries that
+ *                       would waste most area together seed two groups,
+ *                       then the entry with the strongest preference goes
+ *                       next. node keeps one group, the other is returned.
+ *
+ */
+RTree::Node* RTree::split(Node *node)
+{
+    QVector<Entry> entries = node->entries;
+    node->entries.clear();
+
+    Node *sibling = new Node;
+    sibling->leaf = node->leaf;
+    sibling->parent = node->parent;
+
+    int first = 0;
+    int second = 1;
+    qint64 worst = -1;
+    for(int i = 0; i < entries.size(); ++i)
+    {
+        for(int j = i + 1; j < entries.size(); ++j)
+        {
+            qint64 waste = area(entries.at(i).box.united(entries.at(j).box))
+                - area(entries.at(i).box) - area(entries.at(j).box);
+            if(waste > worst)
+            {
+                worst = waste;
+                first = i;
+                second = j;
+            }
+        }
+    }
+
+    QVector<Entry> groups[2];
+    QRect boxes[2] = { entries.at(first).box, entries.at(second).box };
+    groups[0] << entries.at(first);
+    groups[1] << entries.at(second);
+    entries.remove(second);
+    entries.remove(first);
+
+    while(!entries.isEmpty())
+    {
+        // make sure both groups end up with enough entries
+        for(int group = 0; group < 2; ++group)
+        {
+            if(groups[group].size() + entries.size() == MIN_ENTRIES)
+            {
+                groups[group] += entries;
+                entries.clear();
+            }
+        }
+        if(entries.isEmpty())
+            break;
+
+        int next = 0;
+        qint64 preference = -1;
+        for(int i = 0; i < entries.size(); ++i)
+        {
+            qint64 difference = qAbs(enlargement(boxes[0], entries.at(i).box)
+                                     - enlargement(boxes[1], entries.at(i).box));
+            if(difference > preference)
+            {
+                preference = difference;
+                next = i;
+            }
+        }
+
+        const Entry entry = entries.takeAt(next);
+        qint64 growth0 = enlargement(boxes[0], entry.box);
+        qint64 growth1 = enlargement(boxes[1], entry.box);
+        int group = 0;
+        if(growth1 < growth0
+           || (growth1 == growth0 && (area(boxes[1]) < area(boxes[0])
+                                      || (area(boxes[1]) == area(boxes[0])
+                                          && groups[1].size() < groups[0].size()))))
+            group = 1;
+
+        groups[group] << entry;
+        boxes[group] = boxes[group].united(entry.box);
+    }
+
+    node->entries = groups[0];
+    sibling->entries = groups[1];
+    for(const Entry &entry : sibling->entries)
+        if(entry.child)
+            entry.child->parent = sibling;
+    return sibling;
+}
+
+/**
+ * @brief RTree::adjust - update the bounds kept for node and its ancestors
+ *
+ */
+void RTree::adjust(Node *node)
+{
+    while(node->parent)
+    {
+        Node *parent = node->parent;
+        for(Entry &entry : parent->entries)
+        {
+            if(entry.child == node)
+            {
+                entry.box = boxOf(node);
+                break;
+            }
+        }
+        node = parent;
+    }
+}
+
+/**
+ * @brief RTree::condense - after removing from a leaf, drop the nodes left
+ *                          with too few entries on the way up and add their
+ *                          ids again
+ *
+ */
+void RTree::condense(Node *node)
+{
+    QVector<Entry> orphans;
+    while(node->parent)
+    {
+        Node *parent = node->parent;
+        if(node->entries.size() < MIN_ENTRIES)
+        {
+            for(int i = 0; i < parent->entries.size(); ++i)
+            {
+                if(parent->entries.at(i).child == node)
+                {
+                    parent->entries.remove(i);
+                    break;
+                }
+            }
+            collect(node, orphans);
+        }
+        else
+        {
+            adjust(node);
+        }
+        node = parent;
+    }
+
+    while(!root->leaf && root->entries.size() == 1)
+    {
+        Node *child = root->entries.first().child;
+        delete root;
+        root = child;
+        root->parent = 0;
+    }
+    if(!root->leaf && root->entries.isEmpty())
+        root->leaf = true;
+
+    for(const Entry &orphan : orphans)
+        add(chooseLeaf(orphan.box), orphan);
+}
+
+/**
+ * @brief RTree::collect - move the ids below node into entries and free
+ *                         the nodes
+ *
+ */
+void RTree::collect(Node *node, QVector<Entry> &entries)
+{
+    if(node->leaf)
+        entries += node->entries;
+    else
+        for(const Entry &entry : node->entries)
+            collect(entry.child, entries);
+    delete node;
+}
+
+void RTree::query(const Node *node, const QRect &rect,
+                  QVector<int> &result) const
+{
+    for(const Entry &entry : node->entries)
+    {
+        if(!entry.box.intersects(rect))
+            continue;
+
+        if(node->leaf)
+            result.append(entry.id);
+        else
+            query(entry.child, rect, result);
+    }
+}
+
+QRect RTree::boxOf(const Node *node) const
+{
+    QRect box;
+    for(const Entry &entry : node->entries)
+        box = box.united(entry.box);
+    return box;
+}
+
+void RTree::destroy(Node *node)
+{
+    if(!node)
+        return;
+
+    if(!node->leaf)
+        for(const Entry &entry : node->entries)
+            destroy(entry.child);
+    delete node;
+}
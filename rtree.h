@@ -0,0 +1,65 @@
+#ifndef RTREE_H
+#define RTREE_H
+
+#include <QRect>
+#include <QVector>
+
+
+/**
+ * an R-tree of ids and their bounding rectangles. Nodes hold up to
+ * MAX_ENTRIES entries and are split with Guttman's quadratic split, so
+ * finding the ids intersecting an area takes logarithmic time in the
+ * number of ids plus the number found.
+ */
+class RTree
+{
+public:
+    RTree();
+    ~RTree();
+
+    int size() const { return count; }
+    void insert(int id, const QRect&);
+    bool remove(int id, const QRect&);
+    QVector<int> query(const QRect&) const;
+    void clear();
+
+private:
+    struct Node;
+
+    /** a child node, or an id in a leaf */
+    struct Entry
+    {
+        QRect box;
+        int id;
+        Node* child;
+    };
+
+    struct Node
+    {
+        bool leaf;
+        Node* parent;
+        QVector<Entry> entries;
+    };
+
+    static const int MAX_ENTRIES = 16;
+    static const int MIN_ENTRIES = 6;
+
+    Node* chooseLeaf(const QRect&) const;
+    Node* findLeaf(Node*, int id, const QRect&) const;
+    void add(Node*, const Entry&);
+    Node* split(Node*);
+    void adjust(Node*);
+    void condense(Node*);
+    void collect(Node*, QVector<Entry>&);
+    void query(const Node*, const QRect&, QVector<int>&) const;
+    QRect boxOf(const Node*) const;
+    void destroy(Node*);
+
+    Node* root;
+    int count;
+
+    RTree(const RTree&);
+    RTree& operator=(const RTree&);
+};
+
+#endif // RTREE_H
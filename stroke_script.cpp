@@ -0,0 +1,442 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QTextStream>
+#include <vtkNew.h>
+#include <vtkRenderWindow.h>
+
+#include "image_saver.h"
+#include "stroke_script.h"
+
+
+namespace
+{
+/** parse "X,Y" */
+bool parsePoint(const QString &word, QPoint *point)
+{
+    const QStringList parts = word.split(',');
+    bool xOk = false, yOk = false;
+    if(parts.size() == 2)
+        *point = QPoint(parts.at(0).toInt(&xOk), parts.at(1).toInt(&yOk));
+    return xOk && yOk;
+}
+
+/** parse "X Y W H" from words, starting at the second */
+bool parseRect(const QStringList &words, QRect *rect)
+{
+    if(words.size() != 5)
+        return false;
+
+    int values[4];
+    for(int i = 0; i < 4; ++i)
+    {
+        bool ok = false;
+        values[i] = words.at(i + 1).toInt(&ok);
+        if(!ok)
+            return false;
+    }
+    *rect = QRect(values[0], values[1], values[2], values[3]);
+    // rendered offscreen at that size, so no bigger than an image
+    return rect->width() > 0 && rect->height() > 0
+           && rect->width() <= MAX_IMG_WIDTH && rect->height() <= MAX_IMG_HEIGHT;
+}
+}
+
+StrokeScript::StrokeScript()
+    : foregroundColor(Qt::black), backgroundColor(Qt::white), saved(false)
+{
+    // the same tools and defaults the canvas starts with
+    penTool = new PenTool(QBrush(Qt::black), DEFAULT_PEN_THICKNESS);
+    lineTool = new LineTool(QBrush(Qt::black), DEFAULT_PEN_THICKNESS);
+    eraserTool = new EraserTool(QBrush(Qt::white), DEFAULT_ERASER_THICKNESS);
+    rectTool = new RectTool(QBrush(Qt::black), DEFAULT_PEN_THICKNESS);
+    fillTool = new FillTool(QBrush(Qt::black));
+    currentTool = penTool;
+
+    image.reset(QSize(DEFAULT_IMG_WIDTH, DEFAULT_IMG_HEIGHT), backgroundColor);
+}
+
+StrokeScript::~StrokeScript()
+{
+    delete penTool;
+    delete lineTool;
+    delete eraserTool;
+    delete rectTool;
+    delete fillTool;
+}
+
+/**
+ * @brief StrokeScript::run - draw the script in fileName, saving relative
+ *                            file names to output. A script that saves
+ *                            nothing is saved as a PNG named after it.
+ *                            Stops at the first line that fails.
+ *
+ */
+bool StrokeScript::run(const QString &fileName, const QDir &output,
+                       QString *error)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        *error = file.errorString();
+        return false;
+    }
+    outputDir = output;
+
+    QTextStream in(&file);
+    for(int number = 1; !in.atEnd(); ++number)
+    {
+        const QString line = in.readLine().trimmed();
+        if(line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        QString lineError;
+        if(!execute(line.split(QRegExp("\\s+")), &lineError))
+        {
+            *error = QObject::tr("line %1: %2").arg(number).arg(lineError);
+            return false;
+        }
+    }
+
+    if(!saved)
+        return save(QFileInfo(fileName).completeBaseName() + ".png",
+                    DEFAULT_PNG_COMPRESSION, error);
+    return true;
+}
+
+/**
+ * @brief StrokeScript::execute - run the command of one line
+ *
+ */
+bool StrokeScript::execute(const QStringList &words, QString *error)
+{
+    const QString command = words.first().toLower();
+
+    if(command == "stroke")
+    {
+        QVector<QPoint> points;
+        for(int i = 1; i < words.size(); ++i)
+        {
+            QPoint point;
+            if(!parsePoint(words.at(i), &point))
+            {
+                *error = QObject::tr("bad point \"%1\"").arg(words.at(i));
+                return false;
+            }
+            points.append(point);
+        }
+        if(points.isEmpty())
+        {
+            *error = QObject::tr("a stroke needs a point");
+            return false;
+        }
+        stroke(points);
+        return true;
+    }
+
+    if(command == "cube" || command == "sphere" || command == "cylinder")
+    {
+        QRect rect;
+        if(!parseRect(words, &rect))
+        {
+            *error = QObject::tr("%1 needs X Y W H").arg(command);
+            return false;
+        }
+        stamp(command == "cube" ? cube_primitive
+              : command == "sphere" ? sphere_primitive
+                                    : cylinder_primitive, rect);
+        return true;
+    }
+
+    if(command == "size")
+    {
+        bool widthOk = false, heightOk = false;
+        QSize size;
+        if(words.size() == 3)
+            size = QSize(words.at(1).toInt(&widthOk), words.at(2).toInt(&heightOk));
+        if(!widthOk || !heightOk || size.isEmpty())
+        {
+            *error = QObject::tr("size needs W H");
+            return false;
+        }
+        if(size.width() > MAX_IMG_WIDTH || size.height() > MAX_IMG_HEIGHT)
+        {
+            *error = QObject::tr("size is at most %1 %2")
+                         .arg(MAX_IMG_WIDTH).arg(MAX_IMG_HEIGHT);
+            return false;
+        }
+        image.reset(size, backgroundColor);
+        return true;
+    }
+
+    if(command == "save")
+    {
+        int compression = DEFAULT_PNG_COMPRESSION;
+        bool ok = words.size() == 2 || words.size() == 3;
+        if(words.size() == 3)
+            compression = words.at(2).toInt(&ok);
+        if(!ok)
+        {
+            *error = QObject::tr("save needs FILE [LEVEL]");
+            return false;
+        }
+        return save(words.at(1), compression, error);
+    }
+
+    if(words.size() != 2)
+    {
+        *error = QObject::tr("unknown command \"%1\"").arg(words.join(' '));
+        return false;
+    }
+
+    const QString value = words.at(1);
+    if(command == "color" || command == "background")
+    {
+        QColor color(value);
+        if(!color.isValid())
+        {
+            *error = QObject::tr("bad color \"%1\"").arg(value);
+            return false;
+        }
+        setColor(color, command == "color" ? foreground : background);
+        return true;
+    }
+
+    const bool ok = command == "tool" ? setTool(value.toLower())
+                                      : setOption(command, value.toLower());
+    if(ok)
+        return true;
+
+    *error = QObject::tr("bad command \"%1\"").arg(words.join(' '));
+    return false;
+}
+
+/**
+ * @brief StrokeScript::setTool - make the named tool the current one
+ *
+ */
+bool StrokeScript::setTool(const QString &name)
+{
+    if(name == "pen")
+        currentTool = penTool;
+    else if(name == "line")
+        currentTool = lineTool;
+    else if(name == "eraser")
+        currentTool = eraserTool;
+    else if(name == "rect")
+        currentTool = rectTool;
+    else if(name == "fill")
+        currentTool = fillTool;
+    else
+        return false;
+    return true;
+}
+
+/**
+ * @brief StrokeScript::setOption - change a setting of the current tool,
+ *                                  or of the rect and fill tools for the
+ *                                  settings only they have
+ *
+ */
+bool StrokeScript::setOption(const QString &name, const QString &value)
+{
+    bool ok = false;
+    if(name == "width")
+    {
+        const int width = value.toInt(&ok);
+        if(ok && width > 0)
+            currentTool->setWidth(width);
+        return ok && width > 0;
+    }
+    if(name == "curve")
+    {
+        const int curve = value.toInt(&ok);
+        if(ok)
+            rectTool->setCurve(curve);
+        return ok;
+    }
+    if(name == "tolerance")
+    {
+        const int tolerance = value.toInt(&ok);
+        if(ok)
+            fillTool->setTolerance(tolerance);
+        return ok;
+    }
+
+    if(name == "cap")
+    {
+        if(value == "flat")
+            currentTool->setCapStyle(Qt::FlatCap);
+        else if(value == "square")
+            currentTool->setCapStyle(Qt::SquareCap);
+        else if(value == "round")
+            currentTool->setCapStyle(Qt::RoundCap);
+        else
+            return false;
+        return true;
+    }
+    if(name == "join")
+    {
+        if(value == "miter")
+            currentTool->setJoinStyle(Qt::MiterJoin);
+        else if(value == "bevel")
+            currentTool->setJoinStyle(Qt::BevelJoin);
+        else if(value == "round")
+            currentTool->setJoinStyle(Qt::RoundJoin);
+        else
+            return false;
+        return true;
+    }
+    if(name == "style")
+    {
+        if(value == "solid")
+            currentTool->setStyle(Qt::SolidLine);
+        else if(value == "dash")
+            currentTool->setStyle(Qt::DashLine);
+        else if(value == "dot")
+            currentTool->setStyle(Qt::DotLine);
+        else if(value == "dash_dot")
+            currentTool->setStyle(Qt::DashDotLine);
+        else if(value == "dash_dot_dot")
+            currentTool->setStyle(Qt::DashDotDotLine);
+        else
+            return false;
+        return true;
+    }
+    if(name == "shape")
+    {
+        if(value == "rectangle")
+            rectTool->setShapeType(rectangle);
+        else if(value == "rounded_rectangle")
+            rectTool->setShapeType(rounded_rectangle);
+        else if(value == "ellipse")
+            rectTool->setShapeType(ellipse);
+        else
+            return false;
+        return true;
+    }
+    if(name == "fill")
+    {
+        // like Canvas::OnFillConfig
+        if(value == "foreground")
+        {
+            rectTool->setFillMode(foreground);
+            rectTool->setFillColor(foregroundColor);
+        }
+        else if(value == "background")
+        {
+            rectTool->setFillMode(background);
+            rectTool->setFillColor(backgroundColor);
+        }
+        else if(value == "none")
+        {
+            rectTool->setFillMode(no_fill);
+            rectTool->setFillColor(QColor(Qt::transparent));
+        }
+        else
+            return false;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief StrokeScript::setColor - change the foreground or background
+ *                                 color, like Canvas::updateColorConfig
+ *
+ */
+void StrokeScript::setColor(const QColor &color, int which)
+{
+    if(which == foreground)
+    {
+        foregroundColor = color;
+        penTool->setColor(foregroundColor);
+        lineTool->setColor(foregroundColor);
+        rectTool->setColor(foregroundColor);
+        fillTool->setColor(foregroundColor);
+
+        if(rectTool->getFillMode() == foreground)
+            rectTool->setFillColor(foregroundColor);
+    }
+    else
+    {
+        backgroundColor = color;
+        eraserTool->setColor(backgroundColor);
+
+        if(rectTool->getFillMode() == background)
+            rectTool->setFillColor(backgroundColor);
+    }
+}
+
+/**
+ * @brief StrokeScript::stroke - draw through points with the current tool
+ *                               the way Canvas::mousePressEvent,
+ *                               flushInput and mouseReleaseEvent do: the
+ *                               pen and eraser through every point, lines
+ *                               and shapes from the first point to the
+ *                               last, the fill at the last
+ *
+ */
+void StrokeScript::stroke(const QVector<QPoint> &points)
+{
+    currentTool->setStartPoint(points.first());
+
+    // the tools keep a shallow copy of the image before the stroke
+    TiledImage oldImage = image;
+    currentTool->beginStroke(oldImage);
+
+    ToolType type = currentTool->getType();
+    if(type == pen || type == eraser)
+    {
+        // a single point is a click, which leaves a dab
+        currentTool->drawTo(points.size() > 1 ? points.mid(1) : points, 0,
+                            &image);
+    }
+    else if(type == fill_tool || points.size() > 1)
+    {
+        currentTool->drawTo(points.last(), 0, &image);
+    }
+
+    currentTool->endStroke();
+}
+
+/**
+ * @brief StrokeScript::stamp - render a 3D primitive offscreen and draw it
+ *                              into rect, like the render tool draws the
+ *                              canvas' render window
+ *
+ */
+void StrokeScript::stamp(PrimitiveType type, const QRect &rect)
+{
+    // creating OpenGL contexts isn't thread-safe on every platform, the
+    // scripts only wait on each other for their 3D primitives
+    static QMutex mutex;
+    QMutexLocker lock(&mutex);
+
+    vtkNew<vtkRenderWindow> window;
+    window->SetOffScreenRendering(1);
+    window->SetSize(rect.width(), rect.height());
+    RenderTool::addPrimitive(window, type, foregroundColor, backgroundColor);
+    window->Render();
+    RenderTool::drawWindow(window, rect, &image);
+}
+
+/**
+ * @brief StrokeScript::save - write the image to fileName, relative to the
+ *                             output directory
+ *
+ */
+bool StrokeScript::save(const QString &fileName, int compression,
+                        QString *error)
+{
+    const QString path = outputDir.absoluteFilePath(fileName);
+    saved = true;
+    if(ImageSaver::write(image.toImage(), path, ImageSaver::formatOf(path),
+                         compression, error))
+        return true;
+
+    *error = QObject::tr("%1: %2").arg(path).arg(*error);
+    return false;
+}
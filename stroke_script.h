@@ -0,0 +1,77 @@
+#ifndef STROKE_SCRIPT_H
+#define STROKE_SCRIPT_H
+
+#include <QColor>
+#include <QDir>
+#include <QString>
+#include <QStringList>
+
+#include "tiled_image.h"
+#include "tool.h"
+
+
+/**
+ * draws a stroke script with the canvas tools, without a window. A script
+ * is a text file of one command per line, blank lines and lines starting
+ * with # are skipped:
+ *
+ *   size W H              a new image of the background color, at most
+ *                         MAX_IMG_WIDTH by MAX_IMG_HEIGHT
+ *   color C               the foreground color, #rrggbb or a color name
+ *   background C          the background color, the eraser draws with it
+ *   tool T                pen, line, eraser, rect or fill
+ *   width N               the width of the current tool
+ *   cap C                 flat, square or round
+ *   join J                miter, bevel or round
+ *   style S               solid, dash, dot, dash_dot or dash_dot_dot
+ *   shape S               rectangle, rounded_rectangle or ellipse
+ *   fill F                none, foreground or background, for shapes
+ *   curve N               the corner curve of rounded rectangles
+ *   tolerance N           the tolerance of the fill
+ *   stroke X,Y X,Y ...    press at the first point, drag through the
+ *                         others and release at the last
+ *   cube X Y W H          a 3D primitive of the foreground color on the
+ *   sphere X Y W H        background color, rendered into the area
+ *   cylinder X Y W H
+ *   save FILE [LEVEL]     write the image, as PNG, QOI or BMP by suffix
+ *
+ * The tools are driven like the canvas drives them from the mouse, so a
+ * script draws what the same strokes drawn by hand would.
+ */
+class StrokeScript
+{
+public:
+    StrokeScript();
+    ~StrokeScript();
+
+    bool run(const QString &fileName, const QDir &output, QString *error);
+
+private:
+    bool execute(const QStringList &words, QString *error);
+    bool setTool(const QString &name);
+    bool setOption(const QString &name, const QString &value);
+    void setColor(const QColor&, int which);
+    void stroke(const QVector<QPoint>&);
+    void stamp(PrimitiveType, const QRect&);
+    bool save(const QString &fileName, int compression, QString *error);
+
+    PenTool *penTool;
+    LineTool *lineTool;
+    EraserTool *eraserTool;
+    RectTool *rectTool;
+    FillTool *fillTool;
+    Tool *currentTool;
+
+    TiledImage image;
+    QColor foregroundColor;
+    QColor backgroundColor;
+
+    /** where relative file names are saved to, and if anything was */
+    QDir outputDir;
+    bool saved;
+
+    StrokeScript(const StrokeScript&);
+    StrokeScript& operator=(const StrokeScript&);
+};
+
+#endif // STROKE_SCRIPT_H
@@ -0,0 +1,237 @@
+#include "resample.h"
+#include "tiled_image.h"
+
+
+/**
+ * @brief TiledImage::TiledImage - a null image
+ *
+ */
+TiledImage::TiledImage()
+    : tileFormat(QImage::Format_ARGB32_Premultiplied)
+{
+}
+
+/**
+ * @brief TiledImage::TiledImage - an image of the given size with no
+ *                                 tiles allocated
+ *
+ */
+TiledImage::TiledImage(const QSize &size, const QColor &fill)
+{
+    reset(size, fill);
+}
+
+/**
+ * @brief TiledImage::formatFor - the tile format for an image filled with
+ *                                fill, with or without an alpha channel
+ *
+ */
+QImage::Format TiledImage::formatFor(const QColor &fill, bool alpha)
+{
+    if(alpha || fill.alpha() != 255)
+        return QImage::Format_ARGB32_Premultiplied;
+    return QImage::Format_RGB32;
+}
+
+/**
+ * @brief TiledImage::reset - resize the image, dropping every tile
+ *
+ */
+void TiledImage::reset(const QSize &size, const QColor &fill)
+{
+    reset(size, fill, formatFor(fill));
+}
+
+/**
+ * @brief TiledImage::reset - resize the image and change its tile format,
+ *                            dropping every tile
+ *
+ */
+void TiledImage::reset(const QSize &size, const QColor &fill,
+                       QImage::Format format)
+{
+    imageSize = size.isValid() ? size : QSize();
+    color = fill;
+    tileFormat = format;
+    tiles = QVector<QImage>(columns() * rows());
+}
+
+/**
+ * @brief TiledImage::fill - fill the whole image, dropping every tile
+ *
+ */
+void TiledImage::fill(const QColor &fill)
+{
+    reset(imageSize, fill);
+}
+
+/**
+ * @brief TiledImage::load - split an image into tiles
+ *
+ */
+void TiledImage::load(const QImage &image, const QColor &fill)
+{
+    reset(image.size(), fill, formatFor(fill, image.hasAlphaChannel()));
+
+    QImage source = image.convertToFormat(tileFormat);
+    for(int row = 0; row < rows(); ++row)
+        for(int column = 0; column < columns(); ++column)
+            setTile(column, row, source.copy(tileRect(column, row)));
+}
+
+/**
+ * @brief TiledImage::scaled - a copy of the image scaled to size with a
+ *                            filter, see resample()
+ *
+ */
+TiledImage TiledImage::scaled(const QSize &size, ResampleFilter filter,
+                              QAtomicInt *progress) const
+{
+    TiledImage result;
+    result.load(resample(toImage(), size, filter, progress), color);
+    return result;
+}
+
+/**
+ * @brief TiledImage::tileRect - the area a tile covers, tiles on the right
+ *                               and bottom edges may be smaller
+ *
+ */
+QRect TiledImage::tileRect(int column, int row) const
+{
+    return QRect(column * TILE_SIZE, row * TILE_SIZE, TILE_SIZE, TILE_SIZE)
+        .intersected(rect());
+}
+
+/**
+ * @brief TiledImage::tilesIn - the columns (x) and rows (y) of the tiles
+ *                              intersecting area, empty if there are none
+ *
+ */
+QRect TiledImage::tilesIn(const QRect &area) const
+{
+    QRect visible = area.normalized().intersected(rect());
+    if(visible.isEmpty())
+        return QRect();
+
+    return QRect(QPoint(visible.left() / TILE_SIZE, visible.top() / TILE_SIZE),
+                 QPoint(visible.right() / TILE_SIZE, visible.bottom() / TILE_SIZE));
+}
+
+/**
+ * @brief TiledImage::tile - the tile's image, null if not allocated
+ *
+ */
+QImage TiledImage::tile(int column, int row) const
+{
+    return tiles.at(row * columns() + column);
+}
+
+/**
+ * @brief TiledImage::tileImage - the tile's image, unallocated tiles are
+ *                                returned filled with the fill color
+ *
+ */
+QImage TiledImage::tileImage(int column, int row) const
+{
+    QImage image = tile(column, row);
+    if(image.isNull())
+    {
+        image = QImage(tileRect(column, row).size(), tileFormat);
+        image.fill(color);
+    }
+    return image;
+}
+
+/**
+ * @brief TiledImage::setTile - replace a tile, a null image frees it
+ *
+ */
+void TiledImage::setTile(int column, int row, const QImage &image)
+{
+    if(image.isNull() || image.format() == tileFormat)
+        tiles[row * columns() + column] = image;
+    else
+        tiles[row * columns() + column] = image.convertToFormat(tileFormat);
+}
+
+/**
+ * @brief TiledImage::tileEquals - compare a tile with the same tile of an
+ *                                 image of the same size. Tiles still shared
+ *                                 between the two are equal without
+ *                                 looking at their pixels.
+ *
+ */
+bool TiledImage::tileEquals(const TiledImage &other, int column, int row) const
+{
+    const QImage a = tile(column, row);
+    const QImage b = other.tile(column, row);
+
+    if(a.isNull() && b.isNull())
+        return color == other.color;
+    if(!a.isNull() && !b.isNull() && a.constBits() == b.constBits())
+        return true;
+
+    return tileImage(column, row) == other.tileImage(column, row);
+}
+
+/**
+ * @brief TiledImage::writableTile - the tile's image, allocating it
+ *                                   if necessary
+ *
+ */
+QImage& TiledImage::writableTile(int column, int row)
+{
+    QImage &image = tiles[row * columns() + column];
+    if(image.isNull())
+    {
+        image = QImage(tileRect(column, row).size(), tileFormat);
+        image.fill(color);
+    }
+    return image;
+}
+
+/**
+ * @brief TiledImage::draw - draw part of the image at the same
+ *                           coordinates with the given painter
+ *
+ */
+void TiledImage::draw(QPainter &painter, const QRect &area) const
+{
+    QRect visible = area.intersected(rect());
+    if(visible.isEmpty())
+        return;
+
+    for(int row = visible.top() / TILE_SIZE; row <= visible.bottom() / TILE_SIZE; ++row)
+    {
+        for(int column = visible.left() / TILE_SIZE;
+            column <= visible.right() / TILE_SIZE; ++column)
+        {
+            QRect bounds = tileRect(column, row);
+            QRect target = bounds.intersected(visible);
+            const QImage &image = tiles.at(row * columns() + column);
+
+            if(image.isNull())
+                painter.fillRect(target, color);
+            else
+                painter.drawImage(target, image,
+                                  target.translated(-bounds.topLeft()));
+        }
+    }
+}
+
+/**
+ * @brief TiledImage::toImage - flatten the tiles into a single image
+ *
+ */
+QImage TiledImage::toImage() const
+{
+    if(isNull())
+        return QImage();
+
+    QImage image(imageSize, tileFormat);
+    QPainter painter(&image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    draw(painter, rect());
+    return image;
+}
@@ -0,0 +1,123 @@
+#ifndef TILED_IMAGE_H
+#define TILED_IMAGE_H
+
+#include <QAtomicInt>
+#include <QImage>
+#include <QColor>
+#include <QPainter>
+#include <QVector>
+
+#include "constants.h"
+
+
+/**
+ * an image split into TILE_SIZE x TILE_SIZE tiles. Tiles are only allocated
+ * once something is painted on them, until then they are filled with the
+ * fill color. Copies share their tiles until one of them paints on a tile.
+ * Opaque images keep their tiles in RGB32, the others in premultiplied
+ * ARGB32, both are drawn without conversion by the raster engine.
+ */
+class TiledImage
+{
+public:
+    TiledImage();
+    TiledImage(const QSize&, const QColor&);
+
+    bool isNull() const { return imageSize.isEmpty(); }
+    QSize size() const { return imageSize; }
+    int width() const { return imageSize.width(); }
+    int height() const { return imageSize.height(); }
+    QRect rect() const { return QRect(QPoint(0, 0), imageSize); }
+    QColor fillColor() const { return color; }
+    QImage::Format format() const { return tileFormat; }
+
+    static QImage::Format formatFor(const QColor&, bool alpha = false);
+
+    void reset(const QSize&, const QColor&);
+    void reset(const QSize&, const QColor&, QImage::Format);
+    void fill(const QColor&);
+    void load(const QImage&, const QColor&);
+    TiledImage scaled(const QSize&, ResampleFilter = bilinear_filter,
+                      QAtomicInt *progress = 0) const;
+
+    int columns() const { return (width() + TILE_SIZE - 1) / TILE_SIZE; }
+    int rows() const { return (height() + TILE_SIZE - 1) / TILE_SIZE; }
+    QRect tileRect(int column, int row) const;
+    QRect tilesIn(const QRect&) const;
+
+    QImage tile(int column, int row) const;
+    QImage tileImage(int column, int row) const;
+    void setTile(int column, int row, const QImage&);
+    bool tileEquals(const TiledImage&, int column, int row) const;
+
+    template<typename Paint>
+    void paint(const QRect &bounds, Paint paintTile);
+    template<typename Process>
+    void process(const QRect &bounds, Process processTile);
+
+    void draw(QPainter&, const QRect&) const;
+    QImage toImage() const;
+
+private:
+    QImage& writableTile(int column, int row);
+
+    QSize imageSize;
+    QColor color;
+    QImage::Format tileFormat;
+    QVector<QImage> tiles;
+};
+
+/**
+ * @brief TiledImage::paint - run paintTile(QPainter&) once for every tile
+ *                            intersecting bounds, the painter is translated
+ *                            so it can draw in image coordinates
+ *
+ */
+template<typename Paint>
+void TiledImage::paint(const QRect &bounds, Paint paintTile)
+{
+    QRect area = bounds.normalized().intersected(rect());
+    if(area.isEmpty())
+        return;
+
+    for(int row = area.top() / TILE_SIZE; row <= area.bottom() / TILE_SIZE; ++row)
+    {
+        for(int column = area.left() / TILE_SIZE;
+            column <= area.right() / TILE_SIZE; ++column)
+        {
+            QPainter painter(&writableTile(column, row));
+            painter.translate(-column * TILE_SIZE, -row * TILE_SIZE);
+            paintTile(painter);
+        }
+    }
+}
+
+/**
+ * @brief TiledImage::process - run processTile(QImage&, const QRect&, column,
+ *                              row) once for every tile intersecting bounds,
+ *                              for kernels working on the pixels directly.
+ *                              The rect is the part of bounds on the tile,
+ *                              in tile coordinates.
+ *
+ */
+template<typename Process>
+void TiledImage::process(const QRect &bounds, Process processTile)
+{
+    QRect area = bounds.normalized().intersected(rect());
+    if(area.isEmpty())
+        return;
+
+    for(int row = area.top() / TILE_SIZE; row <= area.bottom() / TILE_SIZE; ++row)
+    {
+        for(int column = area.left() / TILE_SIZE;
+            column <= area.right() / TILE_SIZE; ++column)
+        {
+            QRect tile = tileRect(column, row);
+            processTile(writableTile(column, row),
+                        tile.intersected(area).translated(-tile.topLeft()),
+                        column, row);
+        }
+    }
+}
+
+#endif // TILED_IMAGE_H
@@ -1,6 +1,11 @@
+#include <QLineF>
 #include <QPainter>
+#include <QPolygon>
+#include <QtMath>
 #include <vtkBorderWidget.h>
 #include <vtkCommand.h>
+#include <vtkCubeSource.h>
+#include <vtkCylinderSource.h>
 #include <vtkGenericOpenGLRenderWindow.h>
 #include <vtkNamedColors.h>
 #include <vtkNew.h>
@@ -13,6 +18,7 @@
 
 #include "tool.h"
 #include "canvas.h"
+#include "flood_fill.h"
 
 //
 
@@ -20,11 +26,260 @@
 #define VTK890 1
 #endif
 
+namespace
+{
+/**
+ * @brief strokeBounds - the area a pen can touch when stroking a shape
+ *                       covering rect, plus a pixel for rounding.
+ *
+ *                       -open lines reach half the pen width past their
+ *                        ends, square caps reach up to half the diagonal
+ *                        of the cap on slanted lines
+ *                       -the shapes are axis aligned, so any join stays
+ *                        within half the pen width of their bounds
+ *
+ */
+QRect strokeBounds(const QPen &pen, const QRect &rect, bool capped)
+{
+    const qreal half = qMax<qreal>(pen.widthF(), 1) / 2;
+    qreal extent = half;
+    if(capped && pen.capStyle() == Qt::SquareCap)
+        extent = half * M_SQRT2;
+
+    int pad = qCeil(extent) + 1;
+    return rect.normalized().adjusted(-pad, -pad, +pad, +pad);
+}
+
+/**
+ * @brief paintShape - draw a rectangle, rounded rectangle or ellipse,
+ *                     shared by RectTool::drawTo and replayStroke
+ *
+ */
+void paintShape(QPainter &painter, const QRect &rect, ShapeType shapeType,
+                const QColor &fillColor, FillColor fillMode, int roundedCurve)
+{
+    //draw a rectangle, square, or ellipse--fill or no fill--based on settings
+    switch(shapeType)
+    {
+        case rectangle:
+        {
+            if(fillColor != no_fill)
+                painter.fillRect(rect, fillColor);
+            painter.drawRect(rect);
+            break;
+        }
+        case rounded_rectangle:
+        {
+            if(fillMode != no_fill)
+                painter.setBrush(QBrush(fillColor));
+            painter.drawRoundedRect(rect, roundedCurve,
+                                    roundedCurve,
+                                    Qt::RelativeSize);
+            break;
+        }
+        case ellipse:
+        {
+            if(fillMode != no_fill)
+                painter.setBrush(QBrush(fillColor));
+            painter.drawEllipse(rect);
+            break;
+        }
+        default:
+          break;
+    }
+}
+}
+
+/**
+ * @brief strokeArea - the area a recorded stroke can touch
+ *
+ */
+QRect strokeArea(const Stroke &stroke)
+{
+    if(stroke.points.isEmpty())
+        return QRect();
+
+    return strokeBounds(stroke.pen, QPolygon(stroke.points).boundingRect(),
+                        stroke.type != rect_tool);
+}
+
+/**
+ * @brief paintStroke - draw a recorded stroke exactly like the tool that
+ *                      recorded it did
+ *
+ */
+void paintStroke(QPainter &painter, const Stroke &stroke)
+{
+    if(stroke.points.isEmpty())
+        return;
+
+    painter.setPen(stroke.pen);
+    painter.setBrush(Qt::NoBrush);
+
+    switch(stroke.type)
+    {
+        case pen:
+        case eraser:
+        {
+            // stamped like PenTool::drawTo, within the painter's clip
+            QRect clip = strokeArea(stroke);
+            if(painter.hasClipping())
+                clip &= painter.clipBoundingRect().toAlignedRect();
 
-void RenderTool::drawTo(const QPoint &endPoint, Canvas *canvas, QPixmap *image) {
+            Brush brush;
+            brush.reset(stroke.pen, clip);
+            QRect area = brush.stamp(stroke.points);
+            if(!area.isEmpty())
+                painter.drawImage(area.topLeft(), brush.toImage(area));
+            break;
+        }
+        case line:
+        {
+            painter.drawLine(stroke.points.first(), stroke.points.last());
+            break;
+        }
+        case rect_tool:
+        {
+            QRect rect = RectTool::adjustPoints(stroke.points.first(),
+                                                stroke.points.last());
+            paintShape(painter, rect, stroke.shapeType, stroke.fillColor,
+                       stroke.fillMode, stroke.roundedCurve);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief replayStroke - draw a recorded stroke onto the image
+ *
+ */
+void replayStroke(const Stroke &stroke, TiledImage *image)
+{
+    if(stroke.points.isEmpty())
+        return;
+
+    if(stroke.type == pen || stroke.type == eraser)
+    {
+        // stamped straight into the tiles, like PenTool::drawTo
+        Brush brush;
+        brush.reset(stroke.pen, image->rect());
+        TiledImage background = *image;
+        brush.composite(image, background, brush.stamp(stroke.points));
+        return;
+    }
+
+    image->paint(strokeArea(stroke), [&](QPainter &painter)
+    {
+        paintStroke(painter, stroke);
+    });
+}
+
+/**
+ * @brief operator<< - write a recorded stroke to a stream
+ *
+ */
+QDataStream& operator<<(QDataStream &out, const Stroke &stroke)
+{
+    return out << qint32(stroke.type) << stroke.pen << qint32(stroke.shapeType)
+               << stroke.fillColor << qint32(stroke.fillMode)
+               << qint32(stroke.roundedCurve) << stroke.points;
+}
+
+/**
+ * @brief operator>> - read a recorded stroke back from a stream
+ *
+ */
+QDataStream& operator>>(QDataStream &in, Stroke &stroke)
+{
+    qint32 type, shapeType, fillMode, roundedCurve;
+    in >> type >> stroke.pen >> shapeType >> stroke.fillColor >> fillMode
+       >> roundedCurve >> stroke.points;
+    stroke.type = ToolType(type);
+    stroke.shapeType = ShapeType(shapeType);
+    stroke.fillMode = FillColor(fillMode);
+    stroke.roundedCurve = roundedCurve;
+    return in;
+}
+
+/**
+ * @brief Tool::drawTo - draw through several points in turn, tools that
+ *                       can do better draw them in one go
+ *
+ */
+QRect Tool::drawTo(const QVector<QPoint> &points, Canvas *canvas,
+                   TiledImage *image)
+{
+    QRect drawn;
+    for(const QPoint &point : points)
+        drawn |= drawTo(point, canvas, image);
+    return drawn;
+}
+
+/**
+ * @brief Tool::record - save the tool settings needed to replay a stroke
+ *
+ */
+void Tool::record(Stroke &stroke) const
+{
+    stroke.type = getType();
+    stroke.pen = static_cast<QPen>(*this);
+}
+
+
+/**
+ * @brief RenderTool::addPrimitive - add a cube, sphere or cylinder in color
+ *                                   on background to the render window
+ *
+ */
+void RenderTool::addPrimitive(vtkRenderWindow *window, PrimitiveType type,
+                              const QColor &color, const QColor &background)
+{
+    vtkNew<vtkPolyDataMapper> mapper;
+    if(type == cube_primitive)
+    {
+        vtkNew<vtkCubeSource> source;
+        mapper->SetInputConnection(source->GetOutputPort());
+    }
+    else if(type == sphere_primitive)
+    {
+        vtkNew<vtkSphereSource> source;
+        mapper->SetInputConnection(source->GetOutputPort());
+    }
+    else
+    {
+        vtkNew<vtkCylinderSource> source;
+        source->SetResolution(8);
+        mapper->SetInputConnection(source->GetOutputPort());
+    }
+
+    vtkNew<vtkActor> actor;
+    actor->SetMapper(mapper);
+    actor->GetProperty()->SetColor(color.red()/255.0,
+                                   color.green()/255.0,
+                                   color.blue()/255.0);
+
+    vtkNew<vtkRenderer> renderer;
+    renderer->AddActor(actor);
+    renderer->SetBackground(background.red()/255.0,
+                            background.green()/255.0,
+                            background.blue()/255.0);
+    window->AddRenderer(renderer);
+    window->SetWindowName("RenderWindowNoUIFile");
+}
+
+/**
+ * @brief RenderTool::drawWindow - draw what the render window shows,
+ *                                 scaled into bounds of the image
+ *
+ */
+QRect RenderTool::drawWindow(vtkRenderWindow *window, const QRect &bounds,
+                             TiledImage *image)
+{
     vtkWindowToImageFilter *w2if = vtkWindowToImageFilter::New();
     w2if->ReadFrontBufferOff();
-    w2if->SetInput(renderWindow);
+    w2if->SetInput(window);
     w2if->SetInputBufferTypeToRGBA();
     w2if->Update();
     //TODO (fix) extract foreground only
@@ -32,62 +287,39 @@ void RenderTool::drawTo(const QPoint &endPoint, Canvas *canvas, QPixmap *image)
     int *dims = img->GetDimensions();
     int width=dims[0];
     int height=dims[1];
-    QImage qimage(width, height,  QImage::Format_ARGB32);
-    //image is mirrored vertically
-    qimage=qimage.mirrored(false, true);
-    //rgb channels are swapped
-    qimage=qimage.rgbSwapped();
-    /*
-    QImage qimage(width, height, QImage::Format_RGBA64);
-    QRgba64* rgbaPtr =
-        reinterpret_cast<QRgba64*>(qimage.bits()) + width * (height - 1);
-    unsigned char* colorsPtr =
-        reinterpret_cast<unsigned char*>(img->GetScalarPointer());
-
-    for (int row = 0; row < height; row++)
-    {
-        for (int col = 0; col < width; col++)
-        {
-            //TODO (fix) some pixels coordinates are out of range!
-            // Swap the vtkImageData RGBA values with an equivalent QColor
-            *(rgbaPtr++) = QColor(colorsPtr[0], colorsPtr[1], colorsPtr[2], 255).rgba64();
-            colorsPtr += img->GetNumberOfScalarComponents();
-
-            qimage.setPixel(row, col, *rgbaPtr);
-        }
-        rgbaPtr -= width * 2;
-    }
-    */
-
-    //QPixmap *alpha = new QPixmap;
-    //alpha->fill(Qt::transparent);
-    //
-    QPixmap *overlay = new QPixmap;
-    //overlay->setAlphaChannel(*alpha);
-    //overlay->fill(Qt::transparent);
-    *overlay = QPixmap::fromImage(qimage);
+    // VTK hands out bottom-up RGBA rows, draw a flipped copy of them
+    // straight into the tiles, the raster engine reads RGBA8888 as is
+    QImage qimage = QImage(static_cast<const uchar*>(img->GetScalarPointer()),
+                           width, height, width * 4,
+                           QImage::Format_RGBA8888).mirrored(false, true);
+    w2if->Delete();
 
-    QPixmap result(image->width(), image->height());
-    //result.fill(Qt::transparent); // force alpha channel
+    // only the tiles under the overlay are touched
+    image->paint(bounds, [&](QPainter &painter)
     {
-        QPainter painter(&result);
         //painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
         //painter.setOpacity(0.5);
-        painter.drawPixmap(0, 0, *image);
-
-        QPoint startp = getStartPoint();
-        int x1 = startp.x();
-        int y1 = startp.y();
-        int x2 = endPoint.x();
-        int y2 = endPoint.y();
-        int x = std::min(x1, x2);
-        int y = std::min(y1, y2);
-        int h = std::max(y1, y2) - y;
-        int w = std::max(x1, x2) - x;
-        painter.drawPixmap(x, y, h, w, *overlay);
-    }
-    *image=result;
-    canvas->update();
+        painter.drawImage(bounds, qimage);
+    });
+    return bounds.intersected(image->rect());
+}
+
+QRect RenderTool::drawTo(const QPoint &endPoint, Canvas *canvas, TiledImage *image) {
+    QPoint startp = getStartPoint();
+    int x1 = startp.x();
+    int y1 = startp.y();
+    int x2 = endPoint.x();
+    int y2 = endPoint.y();
+    int x = std::min(x1, x2);
+    int y = std::min(y1, y2);
+    int h = std::max(y1, y2) - y;
+    int w = std::max(x1, x2) - x;
+
+    QRect bounds(x, y, w, h);
+    QRect drawn = drawWindow(renderWindow, bounds, image);
+    if(canvas)
+        canvas->updateArea(bounds);
+    return drawn;
 }
 /**
  * @brief PenTool::drawTo - Draws line from startPoint to endPoint, where
@@ -99,19 +331,70 @@ void RenderTool::drawTo(const QPoint &endPoint, Canvas *canvas, QPixmap *image)
  *                          -endPoint is where the mouse was moved TO on this event.
  *
  */
-void PenTool::drawTo(const QPoint &endPoint, Canvas *canvas, QPixmap *image)
+QRect PenTool::drawTo(const QPoint &endPoint, Canvas *canvas, TiledImage *image)
 {
-    QPainter painter(image);
-    painter.setPen(static_cast<QPen>(*this));
-    painter.drawLine(getStartPoint(), endPoint);
+    return drawTo(QVector<QPoint>() << endPoint, canvas, image);
+}
 
-    // speed things up a bit by only updating the immediate
-    // radius of the Canvas
-    int rad = (this->width() / 2) + 2;
-    canvas->update(QRect(getStartPoint(), endPoint)
-                     .normalized()
-                     .adjusted(-rad, -rad, +rad, +rad));
-    setStartPoint(endPoint);
+/**
+ * @brief PenTool::drawTo - Extends the stroke from startPoint through all
+ *                          the points queued since the last frame.
+ *
+ *                          Dabs are stamped along the new segments into
+ *                          the coverage of the whole stroke, so overlapping
+ *                          segments of a translucent pen don't darken each
+ *                          other. Only the area of the new segments is
+ *                          repainted, from the image before the stroke and
+ *                          the coverage.
+ *
+ */
+QRect PenTool::drawTo(const QVector<QPoint> &points, Canvas *canvas,
+                      TiledImage *image)
+{
+    if(points.isEmpty())
+        return QRect();
+
+    // drawing without beginStroke, e.g. from a script
+    if(background.isNull())
+        beginStroke(*image);
+
+    QRect bounds;
+    QPoint from = getStartPoint();
+    for(const QPoint &point : points)
+    {
+        bounds |= brush.stamp(from, point);
+        from = point;
+    }
+    brush.composite(image, background, bounds);
+
+    // speed things up a bit by only updating the area
+    // the new segments touched
+    if(canvas)
+        canvas->updateArea(bounds);
+    setStartPoint(points.last());
+    return bounds;
+}
+
+/**
+ * @brief PenTool::beginStroke - start a new stroke with no coverage, the
+ *                               image is kept to repaint the stroke on
+ *
+ */
+void PenTool::beginStroke(const TiledImage &image)
+{
+    brush.reset(*this, image.rect());
+    background = image;
+}
+
+/**
+ * @brief PenTool::endStroke - let go of the coverage and the old image's
+ *                             tiles
+ *
+ */
+void PenTool::endStroke()
+{
+    brush = Brush();
+    background = TiledImage();
 }
 
 /**
@@ -120,14 +403,38 @@ void PenTool::drawTo(const QPoint &endPoint, Canvas *canvas, QPixmap *image)
  *                           -endPoint is where the mouse was released
  *
  */
-void LineTool::drawTo(const QPoint &endPoint,
+QRect LineTool::drawTo(const QPoint &endPoint,
                       Canvas *canvas,
-                      QPixmap *image)
+                      TiledImage *image)
+{
+    QRect bounds = this->bounds(endPoint);
+    image->paint(bounds, [&](QPainter &painter)
+    {
+        paint(painter, endPoint);
+    });
+    if(canvas)
+        canvas->updateArea(bounds);
+    return bounds.intersected(image->rect());
+}
+
+/**
+ * @brief LineTool::bounds - the area drawing a line to endPoint touches
+ *
+ */
+QRect LineTool::bounds(const QPoint &endPoint) const
+{
+    return strokeBounds(*this, QRect(getStartPoint(), endPoint), true);
+}
+
+/**
+ * @brief LineTool::paint - draw a line to endPoint, used both for the
+ *                          preview while dragging and the image itself
+ *
+ */
+void LineTool::paint(QPainter &painter, const QPoint &endPoint) const
 {
-    QPainter painter(image);
     painter.setPen(static_cast<QPen>(*this));
     painter.drawLine(getStartPoint(), endPoint);
-    canvas->update();
 }
 
 /**
@@ -156,44 +463,52 @@ RectTool::RectTool(const QBrush &brush, qreal width,
  *                           -endPoint is where the mouse was released
  *
  */
-void RectTool::drawTo(const QPoint &endPoint,
+QRect RectTool::drawTo(const QPoint &endPoint,
                       Canvas *canvas,
-                      QPixmap *image)
+                      TiledImage *image)
+{
+    QRect bounds = this->bounds(endPoint);
+    image->paint(bounds, [&](QPainter &painter)
+    {
+        paint(painter, endPoint);
+    });
+    if(canvas)
+        canvas->updateArea(bounds);
+    return bounds.intersected(image->rect());
+}
+
+/**
+ * @brief RectTool::bounds - the area drawing a shape to endPoint touches
+ *
+ */
+QRect RectTool::bounds(const QPoint &endPoint) const
+{
+    return strokeBounds(*this, adjustPoints(endPoint), false);
+}
+
+/**
+ * @brief RectTool::paint - draw a shape to endPoint, used both for the
+ *                          preview while dragging and the image itself
+ *
+ */
+void RectTool::paint(QPainter &painter, const QPoint &endPoint) const
 {
-    QPainter painter(image);
     painter.setPen(static_cast<QPen>(*this));
-    QRect rect = adjustPoints(endPoint);
+    paintShape(painter, adjustPoints(endPoint), shapeType, fillColor,
+               fillMode, roundedCurve);
+}
 
-    //draw a rectangle, square, or ellipse--fill or no fill--based on settings
-    switch(shapeType)
-    {
-        case rectangle:
-        {
-            if(fillColor != no_fill)
-                painter.fillRect(rect, fillColor);
-            painter.drawRect(rect);
-            break;
-        }
-        case rounded_rectangle:
-        {
-            if(fillMode != no_fill)
-                painter.setBrush(QBrush(fillColor));
-            painter.drawRoundedRect(rect, roundedCurve,
-                                    roundedCurve,
-                                    Qt::RelativeSize);
-            break;
-        }
-        case ellipse:
-        {
-            if(fillMode != no_fill)
-                painter.setBrush(QBrush(fillColor));
-            painter.drawEllipse(rect);
-            break;
-        }
-        default:
-          break;
-    }
-    canvas->update();
+/**
+ * @brief RectTool::record - save the pen and shape settings
+ *
+ */
+void RectTool::record(Stroke &stroke) const
+{
+    Tool::record(stroke);
+    stroke.shapeType = shapeType;
+    stroke.fillColor = fillColor;
+    stroke.fillMode = fillMode;
+    stroke.roundedCurve = roundedCurve;
 }
 
 /**
@@ -201,14 +516,282 @@ void RectTool::drawTo(const QPoint &endPoint,
  *                                 a rectangle
  *
  */
-QRect RectTool::adjustPoints(const QPoint &endPoint)
+QRect RectTool::adjustPoints(const QPoint &endPoint) const
+{
+    return adjustPoints(getStartPoint(), endPoint);
+}
+
+QRect RectTool::adjustPoints(const QPoint &startPoint, const QPoint &endPoint)
 {
     // 'top left' and 'bottom right' are relative, so we may need to
     // switch the points
     QRect rect;
-    if(endPoint.x() < getStartPoint().x())
-        rect = QRect(endPoint, getStartPoint());
+    if(endPoint.x() < startPoint.x())
+        rect = QRect(endPoint, startPoint);
     else
-        rect = QRect(getStartPoint(), endPoint);
+        rect = QRect(startPoint, endPoint);
     return rect;
 }
+
+/**
+ * @brief FillTool::drawTo - Fill the region around endPoint whose colors
+ *                           are within the tolerance of the color there
+ *
+ */
+QRect FillTool::drawTo(const QPoint &endPoint, Canvas *canvas, TiledImage *image)
+{
+    QRect filled = floodFill(image, endPoint, color(), tolerance);
+    if(canvas)
+        canvas->updateArea(filled);
+    return filled;
+}
+
+/**
+ * @brief SelectTool::selection - the outline of the selection where it is
+ *                                now, dragged or not
+ *
+ */
+QPolygonF SelectTool::selection() const
+{
+    return (transform * dragging).map(QPolygonF(outline));
+}
+
+/**
+ * @brief SelectTool::selectionArea - the pixels the outline of the
+ *                                    selection is drawn over
+ *
+ */
+QRect SelectTool::selectionArea() const
+{
+    if(!hasSelection())
+        return QRect();
+
+    return selection().boundingRect().toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+/**
+ * @brief SelectTool::begin - start dragging the selection when pressed
+ *                            inside it, the modifiers pick how, otherwise
+ *                            drop it and start selecting anew from image.
+ *                            hole is the color left where pixels are moved
+ *                            from. Returns the area to repaint.
+ *
+ */
+QRect SelectTool::begin(const QPoint &point, Qt::KeyboardModifiers modifiers,
+                        const TiledImage &image, const QColor &hole)
+{
+    dragFrom = point;
+    dragging = QTransform();
+
+    QPointF center = QPointF(point) + QPointF(0.5, 0.5);
+    if(outline.size() > 2 && selection().containsPoint(center, Qt::OddEvenFill))
+    {
+        if(modifiers & Qt::ShiftModifier)
+            action = scaling;
+        else if(modifiers & Qt::ControlModifier)
+            action = rotating;
+        else
+            action = moving;
+        return QRect();
+    }
+
+    // the image is shared, not copied, the pixels stay in it until moved
+    QRect damage = clear();
+    original = image;
+    holeColor = hole;
+    outline << point;
+    action = selecting;
+    return damage;
+}
+
+/**
+ * @brief SelectTool::dragTo - grow the outline being selected, or draw the
+ *                             selection dragged to point nearest-neighbour.
+ *                             Returns the area to repaint.
+ *
+ */
+QRect SelectTool::dragTo(const QPoint &point, TiledImage *image)
+{
+    QRect damage = selectionArea();
+
+    switch(action)
+    {
+    case selecting:
+        if(mode == rect_select)
+        {
+            // the outline runs around the pixels, not through them
+            QRect rect = QRect(dragFrom, point).normalized();
+            outline = QPolygon(rect.adjusted(0, 0, 1, 1));
+        }
+        else if(outline.last() != point)
+        {
+            outline << point;
+        }
+        break;
+    case moving:
+    case scaling:
+    case rotating:
+        dragging = dragTransform(point);
+        damage |= render(image, transform * dragging, false);
+        break;
+    case idle:
+        return QRect();
+    }
+
+    return damage | selectionArea();
+}
+
+/**
+ * @brief SelectTool::finish - stop selecting, a click selects nothing, or
+ *                             draw the dragged selection again smoothly.
+ *                             Returns the pixels changed since begin.
+ *
+ */
+QRect SelectTool::finish(TiledImage *image)
+{
+    Action finished = action;
+    action = idle;
+
+    if(finished == selecting && outline.size() < 3)
+        clear();
+    if(finished == idle || finished == selecting)
+        return QRect();
+
+    QRect changed = render(image, transform * dragging, true);
+    transform *= dragging;
+    dragging = QTransform();
+    return changed;
+}
+
+/**
+ * @brief SelectTool::clear - drop the selection, leaving its pixels where
+ *                            they are. Returns the area to repaint.
+ *
+ */
+QRect SelectTool::clear()
+{
+    QRect damage = selectionArea();
+
+    action = idle;
+    outline.clear();
+    original = TiledImage();
+    transform = QTransform();
+    dragging = QTransform();
+    rendered = QRect();
+    return damage;
+}
+
+/**
+ * @brief SelectTool::dragTransform - the move, scale about the center of
+ *                                    the selection or rotation about it of
+ *                                    a drag from dragFrom to point
+ *
+ */
+QTransform SelectTool::dragTransform(const QPoint &point) const
+{
+    const QPointF center = transform.map(QPolygonF(outline)).boundingRect().center();
+    const QLineF from(center, dragFrom);
+    const QLineF to(center, point);
+
+    QTransform drag;
+    switch(action)
+    {
+    case moving:
+        drag.translate(point.x() - dragFrom.x(), point.y() - dragFrom.y());
+        break;
+    case scaling:
+    {
+        qreal factor = 1;
+        if(from.length() > 0)
+            factor = qMax(MIN_SELECTION_SCALE, to.length() / from.length());
+        drag.translate(center.x(), center.y());
+        drag.scale(factor, factor);
+        drag.translate(-center.x(), -center.y());
+        break;
+    }
+    case rotating:
+    {
+        // y grows downwards, so growing angles turn clockwise like rotate
+        qreal angle = qAtan2(to.dy(), to.dx()) - qAtan2(from.dy(), from.dx());
+        drag.translate(center.x(), center.y());
+        drag.rotate(qRadiansToDegrees(angle));
+        drag.translate(-center.x(), -center.y());
+        break;
+    }
+    default:
+        break;
+    }
+    return drag;
+}
+
+/**
+ * @brief SelectTool::render - draw the selected pixels moved into image,
+ *                             over the hole they left. Tiles are first
+ *                             shared with the original image again, so only
+ *                             the tiles under the hole and the moved pixels
+ *                             are copied. Returns the area that changed.
+ *
+ */
+QRect SelectTool::render(TiledImage *image, const QTransform &moved, bool smooth)
+{
+    const QRect source = outline.boundingRect().intersected(original.rect());
+    const QRect target = moved.mapRect(QRectF(source)).toAlignedRect()
+                             .adjusted(-1, -1, 1, 1);
+    const QRect drawn = (source | target).intersected(image->rect());
+    const QRect area = drawn | rendered;
+
+    const QRect tiles = image->tilesIn(area);
+    for(int row = tiles.top(); row <= tiles.bottom(); ++row)
+        for(int column = tiles.left(); column <= tiles.right(); ++column)
+            image->setTile(column, row, original.tile(column, row));
+    rendered = drawn;
+
+    if(source.isEmpty())
+        return area;
+
+    QPainterPath hole;
+    hole.addPolygon(QPolygonF(outline));
+    hole.closeSubpath();
+
+    // smoothing samples across tile edges, so the selected pixels are
+    // copied out once to be drawn from a single image
+    QImage pixels;
+    if(smooth)
+    {
+        pixels = QImage(source.size(), QImage::Format_ARGB32_Premultiplied);
+        pixels.fill(Qt::transparent);
+
+        QPainter painter(&pixels);
+        painter.translate(-source.topLeft());
+        original.draw(painter, source);
+    }
+
+    const QTransform back = moved.inverted();
+    image->paint(drawn, [&](QPainter &painter)
+    {
+        const QPaintDevice *tile = painter.device();
+        const QRect tileArea = painter.worldTransform().inverted()
+            .mapRect(QRect(0, 0, tile->width(), tile->height()));
+
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.setClipPath(hole);
+        painter.fillRect(source, holeColor);
+
+        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform, smooth);
+        painter.setTransform(moved, true);
+        painter.setClipPath(hole);
+        if(smooth)
+        {
+            painter.drawImage(source.topLeft(), pixels);
+        }
+        else
+        {
+            // only the selected pixels landing on this tile
+            QRect under = back.mapRect(QRectF(tileArea)).toAlignedRect()
+                              .adjusted(-1, -1, 1, 1);
+            original.draw(painter, under.intersected(source));
+        }
+    });
+    return area;
+}
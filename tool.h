@@ -2,8 +2,13 @@
 #define TOOL_H
 
 #include <QWidget>
+#include <QDataStream>
 #include <QPen>
+#include <QPainterPath>
+#include <QPolygon>
+#include <QTransform>
 #include <QSlider>
+#include <QVector>
 #include <vtkActor.h>
 #include <vtkGenericOpenGLRenderWindow.h>
 #include <vtkNamedColors.h>
@@ -19,11 +24,31 @@
 #include <QDebug>
 #include <vtkWindowToImageFilter.h>
 
+#include "brush.h"
 #include "constants.h"
+#include "tiled_image.h"
 
 
 class Canvas;
 
+/** everything needed to draw a stroke again, see Tool::record */
+struct Stroke
+{
+    ToolType type;
+    QPen pen;
+    ShapeType shapeType;
+    QColor fillColor;
+    FillColor fillMode;
+    int roundedCurve;
+    QVector<QPoint> points;
+};
+
+extern QRect strokeArea(const Stroke&);
+extern void paintStroke(QPainter&, const Stroke&);
+extern void replayStroke(const Stroke&, TiledImage*);
+extern QDataStream& operator<<(QDataStream&, const Stroke&);
+extern QDataStream& operator>>(QDataStream&, Stroke&);
+
 class Tool : public QPen
 {
 public:
@@ -35,7 +60,15 @@ public:
     virtual ~Tool() {}
 
     virtual ToolType getType() const = 0;
-    virtual void drawTo(const QPoint&, Canvas*, QPixmap*) {}
+    virtual QRect drawTo(const QPoint&, Canvas*, TiledImage*) { return QRect(); }
+    virtual QRect drawTo(const QVector<QPoint>&, Canvas*, TiledImage*);
+    virtual QRect bounds(const QPoint&) const { return QRect(); }
+    virtual void paint(QPainter&, const QPoint&) const {}
+    virtual void record(Stroke&) const;
+
+    /** called when the mouse is pressed on and released from the image */
+    virtual void beginStroke(const TiledImage&) {}
+    virtual void endStroke() {}
 
     QPoint getStartPoint() const { return startPoint; }
     void setStartPoint(QPoint point) { startPoint = point; }
@@ -54,7 +87,11 @@ public:
     vtkNew<vtkGenericOpenGLRenderWindow> renderWindow;
     RenderTool() : Tool(QBrush(Qt::black), 0) {}
     virtual ToolType getType() const {return render3d; }
-    virtual void drawTo(const QPoint&, Canvas*, QPixmap*);
+    virtual QRect drawTo(const QPoint&, Canvas*, TiledImage*);
+
+    static void addPrimitive(vtkRenderWindow*, PrimitiveType,
+                             const QColor &color, const QColor &background);
+    static QRect drawWindow(vtkRenderWindow*, const QRect&, TiledImage*);
 private:
     RenderTool(const RenderTool&);
     RenderTool & operator=(const RenderTool&);
@@ -69,8 +106,16 @@ public:
             Qt::PenJoinStyle j = Qt::BevelJoin)
         : Tool(brush, width, s, c, j) {}
     virtual ToolType getType() const { return pen; }
-    virtual void drawTo(const QPoint&, Canvas*, QPixmap*);
+    virtual QRect drawTo(const QPoint&, Canvas*, TiledImage*);
+    virtual QRect drawTo(const QVector<QPoint>&, Canvas*, TiledImage*);
+    virtual void beginStroke(const TiledImage&);
+    virtual void endStroke();
 private:
+    /** the coverage of the stroke so far and the image before it,
+        while drawing */
+    Brush brush;
+    TiledImage background;
+
     /** Don't allow copying */
     PenTool(const PenTool&);
     PenTool& operator=(const PenTool&);
@@ -85,7 +130,9 @@ public:
              Qt::PenJoinStyle j = Qt::BevelJoin)
        : Tool(brush, width, s, c, j) {}
     virtual ToolType getType() const { return line; }
-    virtual void drawTo(const QPoint&, Canvas*, QPixmap*);
+    virtual QRect drawTo(const QPoint&, Canvas*, TiledImage*);
+    virtual QRect bounds(const QPoint&) const;
+    virtual void paint(QPainter&, const QPoint&) const;
 
 private:
     /** Don't allow copying */
@@ -123,14 +170,18 @@ public:
              int roundedCurve = DEFAULT_RECT_CURVE);
 
     virtual ToolType getType() const { return rect_tool; }
-    virtual void drawTo(const QPoint&, Canvas*, QPixmap*);
+    virtual QRect drawTo(const QPoint&, Canvas*, TiledImage*);
+    virtual QRect bounds(const QPoint&) const;
+    virtual void paint(QPainter&, const QPoint&) const;
+    virtual void record(Stroke&) const;
 
     FillColor getFillMode() const { return fillMode; }
     void setFillMode(FillColor mode) { fillMode = mode; }
     void setShapeType(ShapeType shape) { shapeType = shape; }
     void setFillColor(QColor color) { fillColor = color; }
     void setCurve(int value) { roundedCurve = value; }
-    QRect adjustPoints(const QPoint&);
+    QRect adjustPoints(const QPoint&) const;
+    static QRect adjustPoints(const QPoint&, const QPoint&);
 
 private:
     ShapeType shapeType;
@@ -143,4 +194,83 @@ private:
     RectTool& operator=(const RectTool&);
 };
 
+class FillTool : public Tool
+{
+public:
+    FillTool(const QBrush &brush, int tolerance = DEFAULT_FILL_TOLERANCE)
+        : Tool(brush, 0), tolerance(tolerance) {}
+
+    virtual ToolType getType() const { return fill_tool; }
+    virtual QRect drawTo(const QPoint&, Canvas*, TiledImage*);
+
+    int getTolerance() const { return tolerance; }
+    void setTolerance(int value) { tolerance = value; }
+
+private:
+    int tolerance;
+
+    /** Don't allow copying */
+    FillTool(const FillTool&);
+    FillTool& operator=(const FillTool&);
+};
+
+/**
+ * selects pixels of the current layer inside a dragged rectangle or a
+ * freeform outline, which are then moved by dragging inside the selection,
+ * scaled with shift held and rotated with ctrl held. The selected pixels
+ * are never copied out of the layer: the selection keeps a shallow copy of
+ * the image they were selected from, sharing its tiles, and draws them
+ * from there wherever they are moved to. Dragging shows them resampled
+ * nearest-neighbour; the release resamples them once smoothly, from the
+ * pixels as they were selected however often they were moved since.
+ */
+class SelectTool : public Tool
+{
+public:
+    SelectTool()
+        : Tool(QBrush(Qt::black), 0), mode(rect_select), action(idle) {}
+
+    virtual ToolType getType() const { return select_tool; }
+
+    SelectMode getMode() const { return mode; }
+    void setMode(SelectMode value) { mode = value; }
+
+    bool hasSelection() const { return !outline.isEmpty(); }
+    QPolygonF selection() const;
+    QRect selectionArea() const;
+
+    QRect begin(const QPoint&, Qt::KeyboardModifiers, const TiledImage&,
+               const QColor &hole);
+    QRect dragTo(const QPoint&, TiledImage*);
+    QRect finish(TiledImage*);
+    QRect clear();
+
+private:
+    enum Action {idle, selecting, moving, scaling, rotating};
+
+    QTransform dragTransform(const QPoint&) const;
+    QRect render(TiledImage*, const QTransform&, bool smooth);
+
+    SelectMode mode;
+    Action action;
+
+    /** the selected pixels, where and from what image they were selected,
+        the color left where they were and where they have been moved to */
+    QPolygon outline;
+    TiledImage original;
+    QColor holeColor;
+    QTransform transform;
+
+    /** the drag on top of transform, while dragging */
+    QTransform dragging;
+    QPoint dragFrom;
+
+    /** the area the pixels were last drawn in, moved or not */
+    QRect rendered;
+
+    /** Don't allow copying */
+    SelectTool(const SelectTool&);
+    SelectTool& operator=(const SelectTool&);
+};
+
 #endif // TOOL_H
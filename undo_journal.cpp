@@ -0,0 +1,264 @@
+#include <QDir>
+
+#include "undo_journal.h"
+#include "compression.h"
+
+
+/**
+ * @brief UndoJournal::UndoJournal - the backing file lives in the system
+ *                                   temp directory and is only created
+ *                                   once something is spilled
+ */
+UndoJournal::UndoJournal()
+    : file(QDir::temp().filePath("canvas_undo_XXXXXX.journal")),
+      mapped(0), mappedSize(0)
+{
+}
+
+UndoJournal::~UndoJournal()
+{
+    if(mapped)
+        file.unmap(mapped);
+}
+
+/**
+ * @brief UndoJournal::append - write data to the first hole it fits in,
+ *                              or else to the end of the journal, returns
+ *                              its offset or -1 on failure
+ */
+qint64 UndoJournal::append(const QByteArray &data)
+{
+    if(!open())
+        return -1;
+
+    for(auto hole = holes.begin(); hole != holes.end(); ++hole)
+    {
+        if(hole.value() < data.size())
+            continue;
+
+        const qint64 offset = hole.key();
+        if(!file.seek(offset)
+           || file.write(data) != data.size()
+           || !file.flush())
+            return -1;
+
+        const qint64 rest = hole.value() - data.size();
+        holes.erase(hole);
+        if(rest > 0)
+            holes.insert(offset + data.size(), rest);
+        return offset;
+    }
+
+    qint64 offset = file.size();
+    if(!file.seek(offset)
+       || file.write(data) != data.size()
+       || !file.flush())
+    {
+        // leave the journal as it was, e.g. when the disk is full
+        file.resize(offset);
+        return -1;
+    }
+    return offset;
+}
+
+/**
+ * @brief UndoJournal::read - page data back in from the mapping,
+ *                            growing the mapping if the file grew
+ */
+QByteArray UndoJournal::read(qint64 offset, int size)
+{
+    if(offset + size > mappedSize && !remap(file.size()))
+        return QByteArray();
+
+    return QByteArray(reinterpret_cast<const char*>(mapped + offset), size);
+}
+
+/**
+ * @brief UndoJournal::release - give back the space of an entry no longer
+ *                               needed, merged with the holes next to it.
+ *                               Space at the end is cut off the file.
+ */
+void UndoJournal::release(qint64 offset, qint64 size)
+{
+    if(size <= 0)
+        return;
+
+    auto next = holes.lowerBound(offset);
+    if(next != holes.end() && offset + size == next.key())
+    {
+        size += next.value();
+        next = holes.erase(next);
+    }
+    if(next != holes.begin())
+    {
+        auto previous = next;
+        --previous;
+        if(previous.key() + previous.value() == offset)
+        {
+            offset = previous.key();
+            size += previous.value();
+            holes.erase(previous);
+        }
+    }
+
+    if(offset + size < file.size())
+    {
+        holes.insert(offset, size);
+        return;
+    }
+
+    // nothing is read past the new end, the next read maps the file anew
+    unmap();
+    file.resize(offset);
+}
+
+/**
+ * @brief UndoJournal::clear - throw away everything written so far
+ */
+void UndoJournal::clear()
+{
+    unmap();
+    holes.clear();
+
+    if(file.isOpen())
+        file.resize(0);
+}
+
+bool UndoJournal::open()
+{
+    return file.isOpen() || file.open();
+}
+
+bool UndoJournal::remap(qint64 size)
+{
+    unmap();
+
+    mapped = file.map(0, size);
+    if(!mapped)
+        return false;
+
+    mappedSize = size;
+    return true;
+}
+
+void UndoJournal::unmap()
+{
+    if(mapped)
+        file.unmap(mapped);
+    mapped = 0;
+    mappedSize = 0;
+}
+
+/**
+ * @brief StoredImage::StoredImage - compress an image into memory
+ */
+StoredImage::StoredImage(const QImage &image)
+    : data(compressImage(image)), offset(-1), length(0)
+{
+}
+
+/**
+ * @brief StoredImage::image - decompress the image, reading it back
+ *                             from the journal if it was spilled
+ */
+QImage StoredImage::image(UndoJournal *journal) const
+{
+    if(!isSpilled())
+        return decompressImage(data);
+
+    return decompressImage(journal->read(offset, length));
+}
+
+/**
+ * @brief StoredImage::spill - move the compressed data to the journal,
+ *                             keeps it in memory if that fails
+ */
+bool StoredImage::spill(UndoJournal *journal)
+{
+    if(isSpilled())
+        return true;
+
+    qint64 at = journal->append(data);
+    if(at < 0)
+        return false;
+
+    offset = at;
+    length = data.size();
+    data = QByteArray();
+    return true;
+}
+
+/**
+ * @brief StoredImage::release - give the journal space of a spilled image
+ *                               back, the image is gone afterwards
+ */
+void StoredImage::release(UndoJournal *journal)
+{
+    if(!isSpilled())
+        return;
+
+    journal->release(offset, length);
+    offset = -1;
+    length = 0;
+}
+
+/**
+ * @brief StoredTiles::StoredTiles - compress every allocated tile
+ */
+StoredTiles::StoredTiles(const TiledImage &image)
+    : size(image.size()), fill(image.fillColor()), format(image.format())
+{
+    for(int row = 0; row < image.rows(); ++row)
+    {
+        for(int column = 0; column < image.columns(); ++column)
+        {
+            QImage tile = image.tile(column, row);
+            if(tile.isNull())
+                continue;
+            positions.append(QPoint(column, row));
+            tiles.append(StoredImage(tile));
+        }
+    }
+}
+
+/**
+ * @brief StoredTiles::image - rebuild the tiled image
+ */
+TiledImage StoredTiles::image(UndoJournal *journal) const
+{
+    TiledImage result;
+    result.reset(size, fill, format);
+    for(int i = 0; i < tiles.size(); ++i)
+        result.setTile(positions.at(i).x(), positions.at(i).y(),
+                       tiles.at(i).image(journal));
+    return result;
+}
+
+/**
+ * @brief StoredTiles::spill - move every tile to the journal
+ */
+bool StoredTiles::spill(UndoJournal *journal)
+{
+    bool ok = true;
+    for(int i = 0; ok && i < tiles.size(); ++i)
+        ok = tiles[i].spill(journal);
+    return ok;
+}
+
+/**
+ * @brief StoredTiles::release - give the journal space of every spilled
+ *                               tile back
+ */
+void StoredTiles::release(UndoJournal *journal)
+{
+    for(int i = 0; i < tiles.size(); ++i)
+        tiles[i].release(journal);
+}
+
+qint64 StoredTiles::byteSize() const
+{
+    qint64 bytes = positions.size() * qint64(sizeof(QPoint));
+    for(const StoredImage &tile : tiles)
+        bytes += sizeof(tile) + tile.byteSize();
+    return bytes;
+}
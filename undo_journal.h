@@ -0,0 +1,92 @@
+#ifndef UNDO_JOURNAL_H
+#define UNDO_JOURNAL_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QMap>
+#include <QVector>
+#include <QTemporaryFile>
+
+#include "tiled_image.h"
+
+
+/**
+ * a temporary file older undo entries are written to, read back through
+ * a memory mapping of the file. Entries of dropped commands are released
+ * as holes that later entries are written into, and the file shrinks
+ * whenever its end is released.
+ */
+class UndoJournal
+{
+public:
+    UndoJournal();
+    ~UndoJournal();
+
+    qint64 append(const QByteArray&);
+    QByteArray read(qint64 offset, int size);
+    void release(qint64 offset, qint64 size);
+    void clear();
+
+private:
+    bool open();
+    bool remap(qint64 size);
+    void unmap();
+
+    QTemporaryFile file;
+    uchar* mapped;
+    qint64 mappedSize;
+
+    /** released space before the end of the file, by offset */
+    QMap<qint64, qint64> holes;
+
+    UndoJournal(const UndoJournal&);
+    UndoJournal& operator=(const UndoJournal&);
+};
+
+/**
+ * a compressed image kept either in memory or in an UndoJournal
+ */
+class StoredImage
+{
+public:
+    StoredImage() : offset(-1), length(0) {}
+    explicit StoredImage(const QImage&);
+
+    QImage image(UndoJournal*) const;
+    bool spill(UndoJournal*);
+    void release(UndoJournal*);
+
+    bool isSpilled() const { return offset >= 0; }
+    qint64 byteSize() const { return data.size(); }
+
+private:
+    QByteArray data;
+    qint64 offset;
+    int length;
+};
+
+/**
+ * a compressed copy of a whole TiledImage, only its allocated tiles
+ * take up space
+ */
+class StoredTiles
+{
+public:
+    StoredTiles() : format(QImage::Format_ARGB32_Premultiplied) {}
+    explicit StoredTiles(const TiledImage&);
+
+    TiledImage image(UndoJournal*) const;
+    bool spill(UndoJournal*);
+    void release(UndoJournal*);
+
+    qint64 byteSize() const;
+
+private:
+    QSize size;
+    QColor fill;
+    QImage::Format format;
+    QVector<QPoint> positions;
+    QVector<StoredImage> tiles;
+};
+
+#endif // UNDO_JOURNAL_H
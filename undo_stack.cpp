@@ -0,0 +1,136 @@
+#include "undo_stack.h"
+
+
+/**
+ * @brief UndoStack::UndoStack - an empty stack allowed to hold up to
+ *                               'budget' bytes of commands in memory,
+ *                               of which only the 'residentCommands'
+ *                               most recent ones are never spilled
+ */
+UndoStack::UndoStack(qint64 budget, int residentCommands)
+    : index(0), bytes(0), budget(budget), residentCommands(residentCommands)
+{
+}
+
+UndoStack::~UndoStack()
+{
+    clear();
+}
+
+/**
+ * @brief UndoStack::push - push an already applied command, discarding
+ *                          anything that could have been redone
+ */
+void UndoStack::push(CanvasCommand *command)
+{
+    while(commands.size() > index)
+    {
+        CanvasCommand *dropped = commands.takeLast();
+        bytes -= dropped->byteSize();
+        delete dropped;
+    }
+
+    command->follow(commands.isEmpty() ? 0 : commands.last());
+    commands.append(command);
+    bytes += command->byteSize();
+    index = commands.size();
+
+    trim();
+}
+
+/**
+ * @brief UndoStack::undo - undo the command below the current index,
+ *                          returns it or 0 if there is none
+ */
+CanvasCommand* UndoStack::undo()
+{
+    if(!canUndo())
+        return 0;
+
+    CanvasCommand *command = commands.at(--index);
+    command->undo();
+    return command;
+}
+
+/**
+ * @brief UndoStack::redo - redo the command at the current index,
+ *                          returns it or 0 if there is none
+ */
+CanvasCommand* UndoStack::redo()
+{
+    if(!canRedo())
+        return 0;
+
+    CanvasCommand *command = commands.at(index++);
+    command->redo();
+    return command;
+}
+
+/**
+ * @brief UndoStack::clear - drop every command
+ */
+void UndoStack::clear()
+{
+    qDeleteAll(commands);
+    commands.clear();
+    index = 0;
+    bytes = 0;
+    journal.clear();
+}
+
+/**
+ * @brief UndoStack::trim - spill everything older than the resident
+ *                          commands, then keep spilling from the oldest
+ *                          command on until the stack fits in its budget.
+ *                          Only if spilling fails are the oldest commands
+ *                          dropped. The most recent command is always
+ *                          kept. Called after a push, so nothing can be
+ *                          redone.
+ */
+void UndoStack::trim()
+{
+    const int firstResident = commands.size() - residentCommands;
+    for(int i = 0; i < firstResident; ++i)
+        spill(commands.at(i));
+
+    for(int i = 0; bytes > budget && i < commands.size() - 1; ++i)
+        spill(commands.at(i));
+
+    while(bytes > budget && commands.size() > 1)
+        dropOldest();
+}
+
+/**
+ * @brief UndoStack::spill - move a command's tiles to the journal,
+ *                           keeping the byte count up to date
+ */
+bool UndoStack::spill(CanvasCommand *command)
+{
+    if(command->isSpilled())
+        return true;
+
+    bytes -= command->byteSize();
+    bool ok = command->spill(&journal);
+    bytes += command->byteSize();
+    return ok;
+}
+
+/**
+ * @brief UndoStack::dropOldest - forget the oldest command, its journal
+ *                                space is released for later spills
+ */
+void UndoStack::dropOldest()
+{
+    CanvasCommand *dropped = commands.takeFirst();
+    if(!commands.isEmpty())
+    {
+        CanvasCommand *next = commands.first();
+        bytes -= next->byteSize();
+        next->forget(dropped);
+        bytes += next->byteSize();
+    }
+    bytes -= dropped->byteSize();
+    delete dropped;
+    if(index > 0)
+        --index;
+}
@@ -0,0 +1,49 @@
+#ifndef UNDO_STACK_H
+#define UNDO_STACK_H
+
+#include <QList>
+
+#include "commands.h"
+#include "undo_journal.h"
+
+
+/**
+ * an undo stack bounded by the memory its commands take up rather than
+ * by their number. Only the most recent commands stay in memory, older
+ * ones are spilled to a journal on disk. The oldest commands are only
+ * dropped if the journal can't take them and the budget is exceeded.
+ */
+class UndoStack
+{
+public:
+    UndoStack(qint64 budget, int residentCommands);
+    ~UndoStack();
+
+    void push(CanvasCommand*);
+    CanvasCommand* undo();
+    CanvasCommand* redo();
+    void clear();
+
+    bool canUndo() const { return index > 0; }
+    bool canRedo() const { return index < commands.size(); }
+
+    qint64 byteSize() const { return bytes; }
+
+private:
+    void trim();
+    bool spill(CanvasCommand*);
+    void dropOldest();
+
+    QList<CanvasCommand*> commands;
+    int index;
+    qint64 bytes;
+    qint64 budget;
+
+    int residentCommands;
+    UndoJournal journal;
+
+    UndoStack(const UndoStack&);
+    UndoStack& operator=(const UndoStack&);
+};
+
+#endif // UNDO_STACK_H
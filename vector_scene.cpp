@@ -0,0 +1,205 @@
+#include <QPainter>
+#include <QPainterPathStroker>
+#include <QPolygon>
+#include <algorithm>
+
+#include "vector_scene.h"
+
+
+VectorScene::VectorScene()
+    : nextId(0)
+{
+}
+
+/**
+ * @brief VectorScene::add - put a shape on top of the others, returns its id
+ *
+ */
+int VectorScene::add(const Stroke &stroke)
+{
+    int id = nextId;
+    insert(id, stroke);
+    return id;
+}
+
+/**
+ * @brief VectorScene::insert - put a shape back under the id it had, so it
+ *                              goes back to the same place in the stack
+ *
+ */
+void VectorScene::insert(int id, const Stroke &stroke)
+{
+    if(shapes.contains(id))
+        take(id);
+
+    Shape shape;
+    shape.stroke = stroke;
+    shape.bounds = strokeArea(stroke);
+    shapes.insert(id, shape);
+    index.insert(id, shape.bounds);
+    nextId = qMax(nextId, id + 1);
+}
+
+/**
+ * @brief VectorScene::take - remove a shape and return it
+ *
+ */
+Stroke VectorScene::take(int id)
+{
+    QMap<int, Shape>::iterator shape = shapes.find(id);
+    if(shape == shapes.end())
+        return Stroke();
+
+    Stroke stroke = shape->stroke;
+    index.remove(id, shape->bounds);
+    shapes.erase(shape);
+    return stroke;
+}
+
+void VectorScene::clear()
+{
+    shapes.clear();
+    index.clear();
+}
+
+/**
+ * @brief VectorScene::shapesIn - the ids of the shapes that can touch area,
+ *                                bottom first
+ *
+ */
+QVector<int> VectorScene::shapesIn(const QRect &area) const
+{
+    QVector<int> ids = index.query(area);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+/**
+ * @brief VectorScene::shapeAt - the id of the topmost shape drawn at or
+ *                               within HIT_TOLERANCE of point, -1 if none
+ *
+ */
+int VectorScene::shapeAt(const QPoint &point) const
+{
+    QRect nearby(point - QPoint(HIT_TOLERANCE, HIT_TOLERANCE),
+               point + QPoint(HIT_TOLERANCE, HIT_TOLERANCE));
+    QVector<int> ids = shapesIn(nearby);
+
+    for(int i = ids.size() - 1; i >= 0; --i)
+        if(outline(shape(ids.at(i))).contains(QPointF(point)))
+            return ids.at(i);
+    return -1;
+}
+
+/**
+ * @brief VectorScene::render - draw area of image again from the shapes
+ *                              over it, tile by tile so every tile only
+ *                              draws the shapes that touch it
+ *
+ */
+void VectorScene::render(TiledImage *image, const QRect &area) const
+{
+    QRect damaged = area.normalized().intersected(image->rect());
+    if(damaged.isEmpty())
+        return;
+
+    QVector<int> ids = shapesIn(damaged);
+    QRect range = image->tilesIn(damaged);
+    for(int row = range.top(); row <= range.bottom(); ++row)
+    {
+        for(int column = range.left(); column <= range.right(); ++column)
+        {
+            QRect bounds = image->tileRect(column, row).intersected(damaged);
+            image->paint(bounds, [&](QPainter &painter)
+            {
+                painter.setClipRect(bounds);
+                painter.setCompositionMode(QPainter::CompositionMode_Source);
+                painter.fillRect(bounds, image->fillColor());
+                painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+
+                for(int id : ids)
+                {
+                    const Shape &shape = *shapes.constFind(id);
+                    if(shape.bounds.intersects(bounds))
+                        paintStroke(painter, shape.stroke);
+                }
+            });
+        }
+    }
+}
+
+/**
+ * @brief VectorScene::scaled - a copy of the scene with every shape moved
+ *                              and stretched by sx and sy, pen widths are
+ *                              kept
+ *
+ */
+VectorScene* VectorScene::scaled(qreal sx, qreal sy) const
+{
+    VectorScene *scene = new VectorScene;
+    for(QMap<int, Shape>::const_iterator shape = shapes.constBegin();
+        shape != shapes.constEnd(); ++shape)
+    {
+        Stroke stroke = shape->stroke;
+        for(QPoint &point : stroke.points)
+            point = QPoint(qRound(point.x() * sx), qRound(point.y() * sy));
+        scene->insert(shape.key(), stroke);
+    }
+    scene->nextId = nextId;
+    return scene;
+}
+
+/**
+ * @brief VectorScene::outline - the area a shape covers, for hit testing.
+ *                               Lines are widened to at least twice
+ *                               HIT_TOLERANCE so thin ones can be clicked.
+ *
+ */
+QPainterPath VectorScene::outline(const Stroke &stroke)
+{
+    if(stroke.points.isEmpty())
+        return QPainterPath();
+
+    QPainterPath path(stroke.points.first());
+    bool filled = false;
+    switch(stroke.type)
+    {
+        case pen:
+        case eraser:
+        {
+            for(int i = 1; i < stroke.points.size(); ++i)
+                path.lineTo(stroke.points.at(i));
+            break;
+        }
+        case line:
+        {
+            path.lineTo(stroke.points.last());
+            break;
+        }
+        case rect_tool:
+        {
+            QRect rect = RectTool::adjustPoints(stroke.points.first(),
+                                                stroke.points.last());
+            path = QPainterPath();
+            if(stroke.shapeType == rounded_rectangle)
+                path.addRoundedRect(rect, stroke.roundedCurve,
+                                    stroke.roundedCurve, Qt::RelativeSize);
+            else if(stroke.shapeType == ellipse)
+                path.addEllipse(rect);
+            else
+                path.addRect(rect);
+            filled = stroke.fillMode != no_fill;
+            break;
+        }
+        default:
+            break;
+    }
+
+    QPainterPathStroker stroker(stroke.pen);
+    stroker.setWidth(qMax<qreal>(stroke.pen.widthF(), 2 * HIT_TOLERANCE));
+    stroker.setDashPattern(Qt::SolidLine);
+    QPainterPath covered = stroker.createStroke(path);
+    if(filled)
+        covered = covered.united(path);
+    return covered;
+}
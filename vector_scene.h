@@ -0,0 +1,61 @@
+#ifndef VECTOR_SCENE_H
+#define VECTOR_SCENE_H
+
+#include <QMap>
+#include <QPainterPath>
+#include <QRect>
+#include <QVector>
+
+#include "rtree.h"
+#include "tiled_image.h"
+#include "tool.h"
+
+
+/**
+ * the shapes of a vector layer: lines, polylines (pen and eraser strokes),
+ * rectangles, rounded rectangles and ellipses, each kept as the Stroke
+ * that drew it. Shapes are stacked in the order of their ids, new shapes
+ * on top. Their bounds are kept in an R-tree, so finding the shapes under
+ * a point or within an area doesn't depend on how many shapes there are
+ * elsewhere, and an area is drawn again from just the shapes over it.
+ */
+class VectorScene
+{
+public:
+    VectorScene();
+
+    int count() const { return shapes.size(); }
+    QList<int> ids() const { return shapes.keys(); }
+    bool contains(int id) const { return shapes.contains(id); }
+    const Stroke& shape(int id) const { return shapes.constFind(id)->stroke; }
+    QRect bounds(int id) const { return shapes.constFind(id)->bounds; }
+
+    int add(const Stroke&);
+    void insert(int id, const Stroke&);
+    Stroke take(int id);
+    void clear();
+
+    QVector<int> shapesIn(const QRect&) const;
+    int shapeAt(const QPoint&) const;
+    void render(TiledImage*, const QRect&) const;
+    VectorScene* scaled(qreal sx, qreal sy) const;
+
+private:
+    /** a shape and the area it can touch */
+    struct Shape
+    {
+        Stroke stroke;
+        QRect bounds;
+    };
+
+    static QPainterPath outline(const Stroke&);
+
+    QMap<int, Shape> shapes;
+    RTree index;
+    int nextId;
+
+    VectorScene(const VectorScene&);
+    VectorScene& operator=(const VectorScene&);
+};
+
+#endif // VECTOR_SCENE_H